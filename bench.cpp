@@ -0,0 +1,475 @@
+// File: bench.cpp
+//
+// Brief: Micro benchmarks of the engine hot paths, and macro benchmarks of
+//        whole games and expectimax search. Prints one "name value" line per
+//        benchmark. Names ending in _ns time one operation in nanoseconds,
+//        names ending in _per_second count operations per second. Given a
+//        baseline printed by an earlier run, adds the baseline value and the
+//        speedup over it, above 1 being faster.
+//
+//        Before timing anything, checks that the fast paths it times agree
+//        with their references, and fails without timing if one does not.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: ./bench > baseline.txt
+//        ./bench -b baseline.txt -f slide_4x4
+//        ./bench -c
+//
+
+#include <getopt.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "expectimax.h"
+#include "game.h"
+#include "ntuple.h"
+#include "simulator.h"
+#include "slide_kernel.h"
+
+namespace {
+
+const int kSizes[] = {2, 3, 4, 5, 8, 16};
+const char* const kDirectionNames[] = {"up", "down", "left", "right"};
+// Boards per fixture, cycled through so no branch sees one board only.
+const int kFixtureBoards = 256;
+
+// Keeps results alive so the work cannot be optimized away.
+volatile uint64_t g_sink;
+
+struct BenchOptions {
+  double min_seconds = 0.1;
+  std::string filter;
+  std::map<std::string, double> baseline;
+};
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start).count();
+}
+
+// Runs op(i) for i in [0, n) with n growing until one round takes
+// min_seconds. Returns nanoseconds per call.
+template <typename Op>
+double NanosPerOp(const Op& op, double min_seconds) {
+  for (long long n = 16; ; ) {
+    auto start = std::chrono::steady_clock::now();
+    for (long long i = 0; i < n; ++i)
+      op(i);
+    double seconds = Seconds(start);
+    if (seconds >= min_seconds || n >= (1LL << 40))
+      return seconds * 1e9 / n;
+    n *= seconds < min_seconds / 64 ? 16 : 2;
+  }
+}
+
+bool Selected(const BenchOptions& options, const std::string& name) {
+  return name.find(options.filter) != std::string::npos;
+}
+
+void Report(const BenchOptions& options, const std::string& name,
+            double value) {
+  auto baseline = options.baseline.find(name);
+  if (baseline == options.baseline.end() || !baseline->second || !value) {
+    printf("%s %.6g\n", name.c_str(), value);
+  } else {
+    bool per_second = name.size() > 11 &&
+                      !name.compare(name.size() - 11, 11, "_per_second");
+    double speedup = per_second ? value / baseline->second
+                                : baseline->second / value;
+    printf("%s %.6g %.6g %.3f\n", name.c_str(), value, baseline->second,
+           speedup);
+  }
+  fflush(stdout);
+}
+
+template <typename Op>
+void Micro(const BenchOptions& options, const std::string& name,
+           const Op& op) {
+  if (Selected(options, name))
+    Report(options, name + "_ns", NanosPerOp(op, options.min_seconds));
+}
+
+std::string SizeName(int size) {
+  return std::to_string(size) + "x" + std::to_string(size);
+}
+
+GameOptions Options(int size, int seed) {
+  GameOptions options = GameOptions();
+  options.game_size = size;
+  options.rand_seed = seed;
+  return options;
+}
+
+// Exposes the spawn of a generic game.
+class BenchGame: public SquareMergeGame {
+ public:
+  explicit BenchGame(const GameOptions& options): SquareMergeGame(options) {}
+
+  void set_board(const GameBoard& board) {
+    state.board = board;
+  }
+
+  bool spawn_tile() {
+    return spawn();
+  }
+};
+
+// Prints a failed check to stderr and returns false.
+bool Fail(const std::string& check, const std::string& detail) {
+  fprintf(stderr, "check %s failed: %s\n", check.c_str(), detail.c_str());
+  return false;
+}
+
+// Slides random rows of every wide length both ways with each supported
+// kernel, and compares rows and scores with the scalar reference.
+bool CheckSlideKernels() {
+  const int kRowsPerCall = GameBoard::kMaxSize;
+  const int kCalls = 1024;
+  SlideKernel::Best();
+  SlideKernel::uptr scalar(SlideKernel::Create("scalar"));
+  bool passed = true;
+  for (const std::string& name: SlideKernel::GetChildren()) {
+    SlideKernel::uptr kernel(SlideKernel::Create(name));
+    if (!kernel || !kernel->supported() || name == "scalar")
+      continue;
+    uint64_t draws = 0;
+    for (int length = GameBoard::kCompactSize + 1;
+         length <= GameBoard::kMaxSize; ++length) {
+      for (int call = 0; call < kCalls; ++call) {
+        uint64_t rows[kRowsPerCall];
+        uint64_t expected[kRowsPerCall];
+        for (int row = 0; row < kRowsPerCall; ++row) {
+          // Mostly small exponents, so rows hold many equal runs and gaps,
+          // and some full ones, which never merge.
+          rows[row] = 0;
+          for (int i = 0; i < length; ++i) {
+            uint32_t draw = RandomSource::SplitMix(length, draws++);
+            uint64_t exponent = draw % 16 ? draw / 16 % 4
+                                          : GameBoard::kMaxExponent;
+            rows[row] |= exponent << (4 * i);
+          }
+          expected[row] = rows[row];
+        }
+        bool reverse = call & 1;
+        int score = kernel->slide_rows(rows, kRowsPerCall, length, reverse);
+        int expected_score =
+            scalar->slide_rows(expected, kRowsPerCall, length, reverse);
+        if (score != expected_score ||
+            !std::equal(rows, rows + kRowsPerCall, expected)) {
+          passed = Fail("slide_kernel_" + name,
+                        "length " + std::to_string(length) +
+                            (reverse ? " reversed" : ""));
+          break;
+        }
+      }
+    }
+  }
+  return passed;
+}
+
+// Plays random games of sizes 2 to 9, and takes back every move twice:
+// once from the delta that apply() fills, on a copy of the board, and once
+// more through the history of undo(), down to the first board.
+bool CheckMoveDeltas() {
+  const int kGames = 64;
+  const int kMoves = 64;
+  for (int size = 2; size <= 9; ++size) {
+    std::string check = "move_delta_" + SizeName(size);
+    for (int seed = 0; seed < kGames; ++seed) {
+      GameOptions options = Options(size, seed);
+      // Every other game wraps its history.
+      options.max_undo = seed % 2 ? kMoves / 3 : kMoves;
+      std::unique_ptr<SquareMergeGame> game(SquareMergeGame::Create(options));
+      const GameState& state = game->game_state();
+      std::vector<GameBoard> boards = {state.board};
+      std::vector<int> scores = {state.score};
+      for (int move = 0; move < kMoves && !state.over; ++move) {
+        Direction direction =
+            Direction(RandomSource::SplitMix(seed, move) % kDirections);
+        MoveDelta delta;
+        if (!game->apply(direction, &delta))
+          continue;
+        GameBoard reverted = state.board;
+        if (!reverted.can_revert(delta) ||
+            reverted.revert(delta) != state.score - scores.back() ||
+            reverted != boards.back())
+          return Fail(check, "revert of move " + std::to_string(move) +
+                                 " of seed " + std::to_string(seed));
+        boards.push_back(state.board);
+        scores.push_back(state.score);
+      }
+      size_t kept = boards.size() -
+                    std::min(boards.size() - 1, size_t(options.max_undo));
+      while (game->undo()) {
+        boards.pop_back();
+        scores.pop_back();
+        if (boards.empty() || state.board != boards.back() ||
+            state.score != scores.back())
+          return Fail(check, "undo of seed " + std::to_string(seed));
+      }
+      if (boards.size() != kept)
+        return Fail(check, "history of seed " + std::to_string(seed));
+    }
+  }
+  return true;
+}
+
+bool SelfChecks() {
+  return CheckSlideKernels() & CheckMoveDeltas();
+}
+
+// Mid-game states of random games of size, each some way into its game.
+std::vector<GameState> Fixture(int size) {
+  std::vector<GameState> states;
+  MoveMethod::ptr policy(MoveMethod::Create("random"));
+  for (int i = 0; i < kFixtureBoards; ++i) {
+    GameOptions options = Options(size, i);
+    options.max_undo = 4;
+    SquareMergeGame* game = SquareMergeGame::Create(options);
+    int moves = 1 + i % (8 * size * size);
+    for (int move = 0; move < moves && !game->game_state().over; ++move) {
+      int direction = policy->decide(game->game_state());
+      if (direction < 0)
+        break;
+      game->advance(Direction(direction));
+    }
+    states.push_back(game->game_state());
+    delete game;
+  }
+  return states;
+}
+
+void SlideBenchmarks(const BenchOptions& options, int size,
+                     const std::vector<GameState>& states) {
+  for (int direction = 0; direction < kDirections; ++direction) {
+    std::string name =
+        "slide_" + SizeName(size) + "_" + kDirectionNames[direction];
+    Micro(options, name, [&](long long i) {
+      GameBoard board = states[i % kFixtureBoards].board;
+      int score = 0;
+      board.slide(Direction(direction), &score);
+      g_sink = g_sink + score;
+    });
+  }
+  // Working out the legal slides, not reading the cached ones.
+  Micro(options, "legal_moves_" + SizeName(size), [&](long long i) {
+    GameBoard board = states[i % kFixtureBoards].board;
+    board.set(0, 0, board.get(0, 0));
+    g_sink = g_sink + board.legal_moves();
+  });
+  Micro(options, "canonical_zobrist_" + SizeName(size), [&](long long i) {
+    g_sink = g_sink + states[i % kFixtureBoards].board.canonical_zobrist();
+  });
+}
+
+void SpawnBenchmarks(const BenchOptions& options, int size,
+                     const std::vector<GameState>& states) {
+  BenchGame game(Options(size, 1));
+  Micro(options, "spawn_" + SizeName(size), [&](long long i) {
+    game.set_board(states[i % kFixtureBoards].board);
+    g_sink = g_sink + game.spawn_tile();
+  });
+}
+
+void StateBenchmarks(const BenchOptions& options, int size,
+                     const std::vector<GameState>& states) {
+  std::string saved;
+  Micro(options, "save_state_" + SizeName(size), [&](long long i) {
+    states[i % kFixtureBoards].save_state(&saved);
+    g_sink = g_sink + saved.size();
+  });
+  std::vector<std::string> all;
+  for (const GameState& state: states)
+    all.push_back(state.save_state());
+  GameState loaded = states[0];
+  Micro(options, "load_state_" + SizeName(size), [&](long long i) {
+    g_sink = g_sink + loaded.load_state(all[i % kFixtureBoards]);
+  });
+  Micro(options, "state_round_trip_" + SizeName(size), [&](long long i) {
+    states[i % kFixtureBoards].save_state(&saved);
+    g_sink = g_sink + loaded.load_state(saved);
+  });
+}
+
+void EventBenchmarks(const BenchOptions& options,
+                     const std::vector<GameState>& states) {
+  for (const char* event_name: {"2048", "corner"}) {
+    Event::ptr event(Event::Create(event_name));
+    Micro(options, std::string("event_") + event_name + "_check",
+          [&](long long i) {
+            g_sink = g_sink + event->check(states[i % kFixtureBoards]);
+          });
+    BoardChange change;
+    Micro(options, std::string("event_") + event_name + "_check_move",
+          [&](long long i) {
+            const GameState& state = states[i % kFixtureBoards];
+            change.before = &state.board;
+            g_sink = g_sink + event->check_move(state, change);
+          });
+  }
+  // What SquareMergeGame::advance() checks for a loss without a LoseEvent.
+  Micro(options, "lose_check", [&](long long i) {
+    g_sink = g_sink + states[i % kFixtureBoards].stats.can_slide();
+  });
+}
+
+// An untrained network looks up as many weights as a trained one.
+void EvaluatorBenchmarks(const BenchOptions& options,
+                         const std::vector<GameState>& states) {
+  Micro(options, "evaluate_heuristic_4x4", [&](long long i) {
+    g_sink = g_sink + ExpectimaxMoveMethod::Evaluate(
+        states[i % kFixtureBoards].board);
+  });
+  std::unique_ptr<NTupleNetwork> network(
+      NTupleNetwork::Create(NTupleNetwork::DefaultTuples()));
+  Micro(options, "evaluate_ntuple_4x4", [&](long long i) {
+    g_sink = g_sink + network->evaluate(
+        states[i % kFixtureBoards].board.compact_bits());
+  });
+  Micro(options, "evaluate_ntuple_shared_4x4", [&](long long i) {
+    g_sink = g_sink + network->evaluate_shared(
+        states[i % kFixtureBoards].board.compact_bits());
+  });
+}
+
+void RegistryBenchmarks(const BenchOptions& options) {
+  Micro(options, "create_by_name", [](long long) {
+    MoveMethod* method = MoveMethod::Create("random");
+    g_sink = g_sink + (method != nullptr);
+    delete method;
+  });
+  MoveMethod::Handle handle = MoveMethod::Find("random");
+  Micro(options, "create_by_handle", [handle](long long) {
+    MoveMethod* method = MoveMethod::Create(handle);
+    g_sink = g_sink + (method != nullptr);
+    delete method;
+  });
+  RegisterArena arena;
+  Micro(options, "create_in_arena", [&arena, handle](long long i) {
+    g_sink = g_sink + (MoveMethod::Create(&arena, handle) != nullptr);
+    if (i % 1024 == 1023)
+      arena.clear();
+  });
+  Micro(options, "shared", [handle](long long) {
+    g_sink = g_sink + (MoveMethod::Shared(handle) != nullptr);
+  });
+}
+
+void GameBenchmarks(const BenchOptions& options) {
+  for (const char* policy: {"random", "greedy"}) {
+    std::string name = std::string("games_") + policy + "_4x4_per_second";
+    if (!Selected(options, name))
+      continue;
+    SimulationOptions simulation;
+    simulation.game = Options(4, 1);
+    simulation.policy = policy;
+    simulation.threads = 1;
+    simulation.games = 256;
+    SimulationStats stats;
+    do {
+      simulation.games *= 2;
+      stats = Simulate(simulation);
+    } while (stats.seconds < options.min_seconds && simulation.games < 1 << 24);
+    Report(options, name, stats.games_per_second());
+    Report(options, std::string("moves_") + policy + "_4x4_per_second",
+           stats.moves_per_second());
+  }
+
+  std::string name = "expectimax_nodes_per_second";
+  if (!Selected(options, name))
+    return;
+  std::vector<GameState> states = Fixture(4);
+  ExpectimaxMoveMethod search;
+  search.set_depth(2);
+  search.set_threads(1);
+  // Whole passes over the fixture, whose boards take unequal searches.
+  auto start = std::chrono::steady_clock::now();
+  do {
+    for (const GameState& state: states)
+      g_sink = g_sink + search.decide(state);
+  } while (Seconds(start) < options.min_seconds);
+  Report(options, name, search.nodes() / Seconds(start));
+}
+
+bool ReadBaseline(const char* path, std::map<std::string, double>* baseline) {
+  std::ifstream in(path);
+  if (!in)
+    return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    char name[256];
+    double value;
+    if (sscanf(line.c_str(), "%255s %lf", name, &value) == 2)
+      (*baseline)[name] = value;
+  }
+  return true;
+}
+
+void Usage() {
+  fprintf(stderr,
+          "bench [-t seconds] [-f filter] [-b baseline] [-c]\n"
+          "  -t  least seconds per benchmark, 0.1 by default\n"
+          "  -f  only run benchmarks whose name contains filter\n"
+          "  -b  compare against the output of an earlier run\n"
+          "  -c  only check the fast paths against their references\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  bool check_only = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:f:b:ch")) != -1) {
+    switch (opt) {
+      case 't':
+        options.min_seconds = atof(optarg);
+        break;
+      case 'f':
+        options.filter = optarg;
+        break;
+      case 'b':
+        if (!ReadBaseline(optarg, &options.baseline)) {
+          fprintf(stderr, "Cannot read baseline \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'c':
+        check_only = true;
+        break;
+      default:
+        Usage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (!SelfChecks())
+    return EXIT_FAILURE;
+  if (check_only)
+    return EXIT_SUCCESS;
+
+  for (int size: kSizes) {
+    std::vector<GameState> states = Fixture(size);
+    SlideBenchmarks(options, size, states);
+    SpawnBenchmarks(options, size, states);
+    StateBenchmarks(options, size, states);
+    if (size == 4) {
+      EventBenchmarks(options, states);
+      EvaluatorBenchmarks(options, states);
+    }
+  }
+  RegistryBenchmarks(options);
+  GameBenchmarks(options);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,417 @@
+// File: checkpoint.cpp
+//
+// Brief: The checkpoint writer thread, compaction and recovery.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "checkpoint.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+namespace {
+
+const char kSegmentMagic[] = "SMGC";
+const char kSegmentPrefix[] = "checkpoint-";
+const char kSegmentSuffix[] = ".smgc";
+
+// The latest state of each key, or an empty one for a key that ended after
+// a state of it was read.
+using LatestStates = std::unordered_map<uint32_t, std::string_view>;
+
+void PutBytes(std::string* out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    out->push_back(char(value >> (8 * i)));
+}
+
+uint64_t GetBytes(const char* data, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i)
+    value |= uint64_t(uint8_t(data[i])) << (8 * i);
+  return value;
+}
+
+uint32_t Fnv1a(std::string_view data) {
+  uint32_t hash = 2166136261u;
+  for (char c: data) {
+    hash ^= uint8_t(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+std::string SegmentHeader() {
+  std::string header(kSegmentMagic, 4);
+  PutBytes(&header, CheckpointWriter::kCheckpointVersion, 1);
+  header.append(3, '\0');
+  return header;
+}
+
+void PutRecordHeader(std::string* out, uint32_t key, std::string_view state) {
+  PutBytes(out, key, 4);
+  PutBytes(out, state.size(), 4);
+  PutBytes(out, Fnv1a(state), 4);
+}
+
+std::string SegmentPath(const std::string& directory, int number) {
+  char name[32];
+  snprintf(name, sizeof(name), "%s%08d%s", kSegmentPrefix, number,
+           kSegmentSuffix);
+  return directory + "/" + name;
+}
+
+// Numbers of the segments in directory into *numbers, oldest first.
+bool ListSegments(const std::string& directory, std::vector<int>* numbers) {
+  numbers->clear();
+  DIR* dir = opendir(directory.c_str());
+  if (!dir)
+    return false;
+  size_t prefix = strlen(kSegmentPrefix);
+  size_t suffix = strlen(kSegmentSuffix);
+  while (const dirent* entry = readdir(dir)) {
+    std::string_view name = entry->d_name;
+    if (name.size() <= prefix + suffix ||
+        name.substr(0, prefix) != kSegmentPrefix ||
+        name.substr(name.size() - suffix) != kSegmentSuffix)
+      continue;
+    std::string_view digits =
+        name.substr(prefix, name.size() - prefix - suffix);
+    if (digits.size() > 9 ||
+        !std::all_of(digits.begin(), digits.end(),
+                     [](char c) { return c >= '0' && c <= '9'; }))
+      continue;
+    numbers->push_back(atoi(std::string(digits).c_str()));
+  }
+  closedir(dir);
+  std::sort(numbers->begin(), numbers->end());
+  return true;
+}
+
+// Makes renames and new files in directory durable.
+bool SyncDirectory(const std::string& directory) {
+  int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  bool synced = !fsync(fd);
+  close(fd);
+  return synced;
+}
+
+// Writes every byte of vectors[0, count), which it changes, IOV_MAX at a time.
+bool WriteAll(int fd, iovec* vectors, size_t count) {
+  while (count) {
+    ssize_t bytes = writev(fd, vectors, int(std::min<size_t>(count, IOV_MAX)));
+    if (bytes < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    size_t left = size_t(bytes);
+    while (count && left >= vectors->iov_len) {
+      left -= vectors->iov_len;
+      ++vectors;
+      --count;
+    }
+    if (count) {
+      vectors->iov_base = static_cast<char*>(vectors->iov_base) + left;
+      vectors->iov_len -= left;
+    }
+  }
+  return true;
+}
+
+// A read-only mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile() {}
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    if (data_)
+      munmap(const_cast<char*>(data_), size_);
+  }
+
+  bool open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) || info.st_size <= 0) {
+      ::close(fd);
+      return false;
+    }
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+      return false;
+    data_ = static_cast<const char*>(data);
+    size_ = info.st_size;
+    madvise(data, size_, MADV_SEQUENTIAL);
+    return true;
+  }
+
+  std::string_view data() const {
+    return std::string_view(data_, size_);
+  }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Applies the records of segment to *latest, up to the first torn or
+// corrupt one.
+void ReadSegment(std::string_view segment, LatestStates* latest) {
+  if (segment.substr(0, CheckpointWriter::kSegmentHeaderSize) !=
+      SegmentHeader())
+    return;
+  size_t offset = CheckpointWriter::kSegmentHeaderSize;
+  while (segment.size() - offset >=
+         size_t(CheckpointWriter::kRecordHeaderSize)) {
+    const char* record = segment.data() + offset;
+    uint32_t key = uint32_t(GetBytes(record, 4));
+    size_t size = size_t(GetBytes(record + 4, 4));
+    offset += CheckpointWriter::kRecordHeaderSize;
+    if (segment.size() - offset < size)
+      return;
+    std::string_view state = segment.substr(offset, size);
+    if (Fnv1a(state) != uint32_t(GetBytes(record + 8, 4)))
+      return;
+    if (size) {
+      (*latest)[key] = state;
+    } else {
+      auto found = latest->find(key);
+      if (found != latest->end())
+        found->second = std::string_view();
+    }
+    offset += size;
+  }
+}
+
+// Maps the segments numbers of directory into *files, and applies their
+// records to *latest, oldest first. Segments that cannot be read count as
+// empty.
+void ReadSegments(const std::string& directory,
+                  const std::vector<int>& numbers,
+                  std::vector<std::unique_ptr<MappedFile>>* files,
+                  LatestStates* latest) {
+  for (int number: numbers) {
+    files->emplace_back(new MappedFile);
+    if (files->back()->open(SegmentPath(directory, number)))
+      ReadSegment(files->back()->data(), latest);
+  }
+}
+
+}  // namespace
+
+bool CheckpointWriter::open(const CheckpointOptions& options) {
+  close();
+  options_ = options;
+  failed_ = false;
+  stop_ = false;
+  written_bytes_.store(0, std::memory_order_relaxed);
+  if (mkdir(options_.directory.c_str(), 0755) && errno != EEXIST)
+    return false;
+  if (!ListSegments(options_.directory, &full_segments_))
+    return false;
+  next_segment_ = full_segments_.empty() ? 1 : full_segments_.back() + 1;
+  if (!start_segment())
+    return false;
+  thread_ = std::thread([this] { run(); });
+  return true;
+}
+
+void CheckpointWriter::submit(std::string records) {
+  if (records.empty())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_.push_back(std::move(records));
+  }
+  wake_.notify_one();
+}
+
+bool CheckpointWriter::close() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+  }
+  if (fd_ >= 0)
+    ::close(fd_);
+  fd_ = -1;
+  return !failed_;
+}
+
+void CheckpointWriter::AddState(std::string* out, uint32_t key,
+                                std::string_view state) {
+  PutRecordHeader(out, key, state);
+  out->append(state);
+}
+
+void CheckpointWriter::AddEnd(std::string* out, uint32_t key) {
+  PutRecordHeader(out, key, std::string_view());
+}
+
+void CheckpointWriter::run() {
+  // Segments left by earlier runs count as full.
+  if (options_.compact_segments > 0 &&
+      int(full_segments_.size()) >= options_.compact_segments &&
+      !compact())
+    failed_ = true;
+  std::vector<std::string> batches;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this] { return stop_ || !queued_.empty(); });
+      if (queued_.empty())
+        return;
+      // All batches that came in during the last write go in the next one.
+      batches.swap(queued_);
+    }
+    if (!write(&batches))
+      failed_ = true;
+    batches.clear();
+  }
+}
+
+bool CheckpointWriter::write(std::vector<std::string>* batches) {
+  std::vector<iovec> vectors;
+  long long bytes = 0;
+  for (std::string& batch: *batches) {
+    vectors.push_back({&batch[0], batch.size()});
+    bytes += batch.size();
+  }
+  bool written = fd_ >= 0 && WriteAll(fd_, vectors.data(), vectors.size()) &&
+                 (!options_.sync || !fdatasync(fd_));
+  if (written) {
+    segment_size_ += bytes;
+    written_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  // A failed write may leave a torn record, which hides any record after it
+  // from recovery, so later ones go to a new segment.
+  if (written && segment_size_ < options_.segment_bytes)
+    return true;
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+    full_segments_.push_back(next_segment_ - 1);
+  }
+  if (options_.compact_segments > 0 &&
+      int(full_segments_.size()) >= options_.compact_segments &&
+      !compact())
+    written = false;
+  return start_segment() && written;
+}
+
+bool CheckpointWriter::start_segment() {
+  const std::string& directory = options_.directory;
+  fd_ = ::open(SegmentPath(directory, next_segment_++).c_str(),
+               O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+    return false;
+  std::string header = SegmentHeader();
+  if (::write(fd_, header.data(), header.size()) != ssize_t(header.size()) ||
+      (options_.sync && (fdatasync(fd_) || !SyncDirectory(directory)))) {
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  segment_size_ = kSegmentHeaderSize;
+  written_bytes_.fetch_add(kSegmentHeaderSize, std::memory_order_relaxed);
+  return true;
+}
+
+bool CheckpointWriter::compact() {
+  const std::string& directory = options_.directory;
+  std::vector<std::unique_ptr<MappedFile>> files;
+  LatestStates latest;
+  ReadSegments(directory, full_segments_, &files, &latest);
+
+  // Headers of all records go in one buffer, and the states straight from
+  // the mappings.
+  std::string headers = SegmentHeader();
+  headers.reserve(headers.size() + latest.size() * kRecordHeaderSize);
+  std::vector<iovec> vectors;
+  vectors.reserve(1 + latest.size() * 2);
+  for (const auto& record: latest)
+    PutRecordHeader(&headers, record.first, record.second);
+  vectors.push_back({&headers[0], size_t(kSegmentHeaderSize)});
+  size_t offset = kSegmentHeaderSize;
+  long long bytes = headers.size();
+  for (const auto& record: latest) {
+    vectors.push_back({&headers[offset], size_t(kRecordHeaderSize)});
+    if (!record.second.empty())
+      vectors.push_back({const_cast<char*>(record.second.data()),
+                         record.second.size()});
+    offset += kRecordHeaderSize;
+    bytes += record.second.size();
+  }
+
+  // The compacted segment replaces the last full one only once it is on
+  // the disk, since later segments may hold newer states. Until the older
+  // ones are gone they are read first, so a crash between loses nothing,
+  // and the end records above keep their states of ended keys dead. Keys
+  // that only have an end record in the full segments have no state left
+  // to hide, so their end records are dropped.
+  int last = full_segments_.back();
+  std::string path = SegmentPath(directory, last);
+  std::string temporary = path + ".tmp";
+  int fd = ::open(temporary.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+  bool written = WriteAll(fd, vectors.data(), vectors.size()) &&
+                 !fdatasync(fd);
+  ::close(fd);
+  if (!written || rename(temporary.c_str(), path.c_str()) ||
+      !SyncDirectory(directory)) {
+    unlink(temporary.c_str());
+    return false;
+  }
+  written_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  // A segment that stays has to be compacted again, with the end records
+  // that hide its states.
+  std::vector<int> kept;
+  for (int number: full_segments_)
+    if (number != last && unlink(SegmentPath(directory, number).c_str()))
+      kept.push_back(number);
+  kept.push_back(last);
+  full_segments_.swap(kept);
+  // The next compaction drops the end records, so the unlinks have to be
+  // on the disk first.
+  return SyncDirectory(directory);
+}
+
+bool RecoverCheckpoints(
+    const std::string& directory,
+    const std::function<void(uint32_t key, std::string_view state)>& found) {
+  std::vector<int> numbers;
+  if (!ListSegments(directory, &numbers))
+    return false;
+  std::vector<std::unique_ptr<MappedFile>> files;
+  LatestStates latest;
+  ReadSegments(directory, numbers, &files, &latest);
+  for (const auto& record: latest)
+    if (!record.second.empty())
+      found(record.first, record.second);
+  return true;
+}
@@ -0,0 +1,138 @@
+// File: checkpoint.h
+//
+// Brief: Write-behind checkpoints of game states. Owners gather the states
+//        of their changed sessions into a batch, once per durability window
+//        no matter how many moves each made, and submit it. One background
+//        thread writes all batches submitted meanwhile with one writev() to
+//        the newest segment file, syncs it, starts a new segment once it
+//        passes segment_bytes, and compacts old segments into one that
+//        keeps only the latest state of every live session, and an end
+//        record of every session that ended over the old segments. Until
+//        the other old segments are unlinked, those end records keep their
+//        states from coming back after a crash. Recovery maps
+//        the segments into memory and hands out the latest states straight
+//        from the mapping, for GameState::load_state().
+//
+//        Segments are named checkpoint-<number>.smgc in one directory, and
+//        later numbers override earlier ones. A segment is "SMGC", version,
+//        3 zero bytes, then records, all little-endian:
+//          [0, 4)   key, e.g. the session ID
+//          [4, 8)   bytes of the state, 0 if the session ended
+//          [8, 12)  FNV-1a hash of the state
+//        then the state. Recovery stops reading a segment at the first torn
+//        or corrupt record.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: CheckpointWriter writer;
+//        writer.open(options);
+//        std::string batch;
+//        CheckpointWriter::AddState(&batch, id, game->save_state());
+//        CheckpointWriter::AddEnd(&batch, ended_id);
+//        writer.submit(std::move(batch));
+//        writer.close();
+//
+//        RecoverCheckpoints("sessions", [](uint32_t key,
+//                                          std::string_view state) { ... });
+//
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct CheckpointOptions {
+  std::string directory;
+  // Starts a new segment past this size.
+  long long segment_bytes = 64 << 20;
+  // Compacts once this many full segments pile up, 0 never.
+  int compact_segments = 4;
+  // Syncs every write to the disk.
+  bool sync = true;
+};
+
+class CheckpointWriter {
+ public:
+  static const int kCheckpointVersion = 1;
+  static const int kSegmentHeaderSize = 8;
+  static const int kRecordHeaderSize = 12;
+
+  CheckpointWriter() {}
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+  ~CheckpointWriter() {
+    close();
+  }
+
+  // Starts a new segment after the existing ones in options.directory, and
+  // the thread that writes it. Returns false if it cannot be created.
+  bool open(const CheckpointOptions& options);
+
+  // Queues records made by AddState() and AddEnd() for the thread to write.
+  // Safe to call from many threads at once.
+  void submit(std::string records);
+
+  // Writes what is queued and stops the thread. Returns false if any write
+  // failed.
+  bool close();
+
+  // Bytes written so far, segment headers and compaction included, from any
+  // thread.
+  long long written_bytes() const {
+    return written_bytes_.load(std::memory_order_relaxed);
+  }
+
+  // Appends the record of the latest state of key to *out.
+  static void AddState(std::string* out, uint32_t key, std::string_view state);
+
+  // Appends the record that key ended, so recovery drops it.
+  static void AddEnd(std::string* out, uint32_t key);
+
+ private:
+  void run();
+
+  // Writes records to the current segment, and starts a new one if it is
+  // full. Called by the thread only.
+  bool write(std::vector<std::string>* batches);
+
+  // Starts segment number next_segment_.
+  bool start_segment();
+
+  // Folds every full segment into the last of them.
+  bool compact();
+
+  CheckpointOptions options_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::vector<std::string> queued_;
+  bool stop_ = false;
+  bool failed_ = false;
+  int fd_ = -1;
+  long long segment_size_ = 0;
+  std::atomic<long long> written_bytes_{0};
+  int next_segment_ = 0;
+  // Numbers of the full segments, oldest first.
+  std::vector<int> full_segments_;
+};
+
+// Calls found(key, state) with the latest state of every key that did not
+// end, over the segments in directory, oldest first. state points into a
+// mapping that stays valid during the call only. Returns false if the
+// directory cannot be read.
+bool RecoverCheckpoints(
+    const std::string& directory,
+    const std::function<void(uint32_t key, std::string_view state)>& found);
+
+#endif  // CHECKPOINT_H_
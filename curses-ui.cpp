@@ -1,266 +1,669 @@
 // File: curses-ui.cpp
 //
-// Brief: Play the 2048-like game in a linux terminal.
+// Brief: Play the square merge game in a linux terminal. The screen is drawn
+//        in full once. After that, each frame redraws only the cells that
+//        differ from what is on screen, plus the status line when it
+//        changes, so a keypress sends a few cells' worth of bytes. Tiles
+//        that merged or spawned in the last move, read from its MoveDelta,
+//        flash for a few frames. Frames are paced by the clock instead of
+//        sleeps: keys are applied as they arrive, and the loop blocks in
+//        getch() whenever nothing is left to draw. With -R, it shows a
+//        game of a replay log instead, and the keys scrub through its moves
+//        by the snapshots of the log.
 //
 // Author: Pufan He <hpfdf@126.com>
 //
-// Version: 2014/08/19
+// Version: 2026/10/14
+//
+// Usage: ./square-merge-game -s 4
+//        ./square-merge-game -s 5 -p expectimax -d 50
+//        ./square-merge-game -l de
+//        ./square-merge-game -R games.smgr -g 12
+//
 
 #include <curses.h>
-#include <unistd.h>
 #include <getopt.h>
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
-#include <cstring>
-
-int main(int argc, char** argv)
-{
-  int NTiles = 0, FromCol, ToCol, opt;
-  unsigned char AutoFlag = 0;
-
-  if(argc<2 || argc>3){ Usage();exit(0);}
-  while( (opt=getopt(argc,argv,"s:size:n:h") )!=-1)
-    switch (opt)
-    {
-      case 'n':
-        NTiles = atoi(optarg);
-        if (NTiles > MAXTILES || NTiles < MINTILES)
-        {   fprintf(stderr, "Step number from %d to %d\n", MINTILES, MAXTILES);
-          return EXIT_FAILURE;
-        }
-        AutoFlag = FALSE;
-        break;
-      case 'a':
-        NTiles = atoi(optarg);
-        if (NTiles > MAXTILES || NTiles < MINTILES)
-        {       fprintf(stderr, "Step number %d from %d\n", MINTILES, MAXTILES);
-          return EXIT_FAILURE;
-        }
-        AutoFlag = TRUE;
-        break;
-      case 'h':
-      case '?':
-      case ':':
-        Usage();
-        exit(0);
+#include <ctime>
+#include <string>
+#include <vector>
 
+#include "game.h"
+#include "instrument.h"
+#include "replay_log.h"
+#include "resource_text.h"
 
-    }
+namespace {
 
-  initscr();
-  if (has_colors())
-  {
-    int i;
-    int bg = COLOR_BLACK;
-    start_color();
-    if (use_default_colors() == OK)
-      bg = -1;
-    for (i = 0; i < 9; i++)
-      init_pair(i + 1, bg, TileColour[i]);
+using Clock = std::chrono::steady_clock;
+
+constexpr char kArrowKeysMove[] = "arrow_keys";
+constexpr char kViKeysMove[] = "vi_keys";
+constexpr char kUndoKeyMove[] = "undo_key";
+
+// Frames a merged or spawned tile stays highlighted.
+const int kFlashFrames = 6;
+const int kStatusPair = 16;
+// Moves a replay steps by without snapshots, times 100 for a page.
+const int kReplayStep = 10;
+
+const char kReplayHelp[] =
+    "Scrub through the game, K being the snapshot interval.";
+const char kReplayKeys[] =
+    "left right 1 move   up down K   page 100 K   home end   space play   "
+    "q quit";
+
+// Backgrounds of tiles 2 to 128, repeated in bold from 256 up.
+const short kTileColors[] = {COLOR_WHITE, COLOR_YELLOW, COLOR_GREEN,
+                             COLOR_CYAN,  COLOR_BLUE,   COLOR_MAGENTA,
+                             COLOR_RED};
+const int kTileColorCount = sizeof(kTileColors) / sizeof(kTileColors[0]);
+
+// The key read by the frame loop, until a move takes it.
+int g_key = ERR;
+
+// Takes g_key if it is one of the arrow keys or w, a, s, d.
+class ArrowKeysMove: public Register<ArrowKeysMove, Move, kArrowKeysMove> {
+ public:
+  const char* info() override {
+    return "Slides with the arrow keys or w, a, s, d.";
   }
-  cbreak();
-  /*LINES and COLS are internal variable of Curses, for storing the current terminal's line and column numbers. */
-  if (LINES < 24 || COLS < 80)          /*standard terminal is 24 line by 80 column*/
-  {
-    endwin();
-    fprintf(stderr, "now within 24x80 \n");
-    return EXIT_FAILURE;
+
+  bool check() override {
+    switch (g_key) {
+      case KEY_UP: case 'w': direction_ = kUp; break;
+      case KEY_DOWN: case 's': direction_ = kDown; break;
+      case KEY_LEFT: case 'a': direction_ = kLeft; break;
+      case KEY_RIGHT: case 'd': direction_ = kRight; break;
+      default: return false;
+    }
+    g_key = ERR;
+    return true;
   }
-  if (AutoFlag)
-  {
-    curs_set(0);
-    leaveok(stdscr, TRUE);
+
+  int direction() override {
+    return direction_;
   }
 
-  InitTiles(NTiles);
-  DisplayTiles();
-  if (AutoFlag) {
-    do {
-      noecho();
-      AutoMove(0, 2, NTiles);
-    } while (!Solved(NTiles));
-    sleep(2);
+ private:
+  int direction_ = -1;
+};
+
+// Takes g_key if it is h, j, k or l.
+class ViKeysMove: public Register<ViKeysMove, Move, kViKeysMove> {
+ public:
+  const char* info() override {
+    return "Slides with h, j, k, l.";
   }
-  else {
-    echo();
-    for (;;) {
-      if (GetMove(&FromCol, &ToCol))
-        break;
-      if (InvalidMove(FromCol, ToCol)) {
-        mvaddstr(STATUSLINE, 0, "Movement's not valid !!");
-        refresh();
-        beep();
-        sleep(2);
-        continue;
-      }
-      MakeMove(FromCol, ToCol);
-      if (Solved(NTiles)) {
-        mvprintw(STATUSLINE, 0, "Congratulations!! You win using  %d steps! ", NMoves);
-        refresh();
-        sleep(5);
-        break;
-      }
+
+  bool check() override {
+    switch (g_key) {
+      case 'k': direction_ = kUp; break;
+      case 'j': direction_ = kDown; break;
+      case 'h': direction_ = kLeft; break;
+      case 'l': direction_ = kRight; break;
+      default: return false;
     }
+    g_key = ERR;
+    return true;
   }
-  endwin();
-  return EXIT_SUCCESS;
+
+  int direction() override {
+    return direction_;
+  }
+
+ private:
+  int direction_ = -1;
+};
+
+// Takes g_key if it is u or backspace, to take back the last move.
+class UndoKeyMove: public Register<UndoKeyMove, Move, kUndoKeyMove> {
+ public:
+  const char* info() override {
+    return "Takes back a move with u or backspace.";
+  }
+
+  bool check() override {
+    if (g_key != 'u' && g_key != KEY_BACKSPACE && g_key != 127)
+      return false;
+    g_key = ERR;
+    return true;
+  }
+
+  bool undo() override {
+    return true;
+  }
+};
+
+// The tile value of exponent centered in width columns. Values that do not
+// leave a column of margin are shortened to thousands, e.g. "32k".
+std::string Label(int exponent, int width) {
+  std::string text = exponent ? std::to_string(1 << exponent) : ".";
+  if (int(text.size()) >= width && exponent >= 10)
+    text = std::to_string(1 << (exponent - 10)) + "k";
+  text = text.substr(0, width);
+  int left = (width - int(text.size())) / 2;
+  return std::string(left, ' ') + text +
+         std::string(width - left - int(text.size()), ' ');
 }
 
-  static int
-InvalidMove(int From, int To)
-{
-  if (From >= NPEGS)
-    return TRUE;
-  if (From < 0)
-    return TRUE;
-  if (To >= NPEGS)
-    return TRUE;
-  if (To < 0)
-    return TRUE;
-  if (From == To)
-    return TRUE;
-  if (!Pegs[From].Count)
-    return TRUE;
-  if (Pegs[To].Count &&
-      Pegs[From].Length[Pegs[From].Count - 1] >
-      Pegs[To].Length[Pegs[To].Count - 1])
-    return TRUE;
-  return FALSE;
+// Sets up all color pairs, once for the whole program.
+void InitColors() {
+  if (!has_colors())
+    return;
+  start_color();
+  short background = COLOR_BLACK;
+  if (use_default_colors() == OK)
+    background = -1;
+  for (int exponent = 1; exponent <= GameBoard::kMaxExponent; ++exponent) {
+    short color = kTileColors[(exponent - 1) % kTileColorCount];
+    short text = color == COLOR_WHITE || color == COLOR_YELLOW ||
+                         color == COLOR_GREEN || color == COLOR_CYAN
+                     ? COLOR_BLACK
+                     : COLOR_WHITE;
+    init_pair(exponent, text, color);
+  }
+  init_pair(kStatusPair, COLOR_YELLOW, background);
 }
 
-  static void
-InitTiles(int NTiles)
-{
-  int Size, SlotNo;
+// What is on the terminal, and what has to change on the next frame.
+class BoardView {
+ public:
+  // Fits cells of a board of size into the terminal. Returns false if it is
+  // too small.
+  bool layout(int size);
 
-  for (Size = NTiles * 2 + 1, SlotNo = 0; Size >= 3; Size -= 2)
-    Pegs[0].Length[SlotNo++] = Size;
+  // Redraws everything on the next frame, e.g. for a new game.
+  void invalidate();
 
-  Pegs[0].Count = NTiles;
-  Pegs[1].Count = 0;
-  Pegs[2].Count = 0;
-}
+  // Marks the cells where state differs from the screen. Flashes the tiles
+  // that merged or spawned if state is one move past the screen and keeps
+  // history.
+  void update(const GameState& state);
 
-  static void
-DisplayTiles(void)
-{
-  int Line, peg, SlotNo;
-  char TileBuf[BUFSIZ];
+  // Returns true if the next frame has anything to draw.
+  bool pending() const {
+    return full_ || dirty_.any() || status_ || !flashing_.empty();
+  }
 
-  erase();
+  // Shows help and keys below the board instead of the texts of the game.
+  void set_texts(const char* help, const char* keys) {
+    help_ = help;
+    keys_ = keys;
+    full_ = true;
+  }
 
-  init_pair(20,COLOR_MAGENTA,COLOR_BLACK);
-  attrset(COLOR_PAIR(20)|A_BOLD);
-  mvaddstr(1, 25,"H-A-N-O-I  Game");
-  attrset(A_NORMAL);
+  // Draws one frame of game, touching only what changed.
+  void draw(SquareMergeGame* game, const char* message);
 
-  mvprintw(18, 30, "Current Steps : ");
-  init_pair(21,COLOR_RED,COLOR_BLACK);
-  attrset(COLOR_PAIR(21)|A_BOLD);
-  mvprintw(18,41,"%d",NMoves);
-  attrset(A_NORMAL);
+ private:
+  void draw_cell(int cell, bool flash);
+
+  int size_ = 0;
+  int cell_width_ = 0;
+  int cell_height_ = 0;
+  int top_ = 2;
+  int left_ = 2;
+  std::string labels_[GameBoard::kMaxExponent + 1];
+  std::string blank_;
+  const char* help_ = nullptr;
+  const char* keys_ = nullptr;
 
-  attrset(A_REVERSE);
-  mvaddstr(BASELINE, 8,
-           "                                                               ");
-  for (Line = TOPLINE; Line < BASELINE; Line++) {
-    mvaddch(Line, LEFTPEG, ' ');
-    mvaddch(Line, MIDPEG, ' ');
-    mvaddch(Line, RIGHTPEG, ' ');
+  GameBoard shown_;
+  int shown_score_ = -1;
+  int shown_moves_ = -1;
+  bool shown_over_ = false;
+  // Everything has to be drawn.
+  bool full_ = true;
+  bool status_ = true;
+  std::bitset<GameBoard::kMaxCells> dirty_;
+  // Cells lit up and the frame that turns each off.
+  std::vector<std::pair<int, long long>> flashing_;
+  long long frame_ = 0;
+  std::string message_;
+};
+
+bool BoardView::layout(int size) {
+  int width = std::min(7, (COLS - 2 * left_) / size);
+  int height = std::min(3, (LINES - top_ - 5) / size);
+  if (width < 4 || height < 1)
+    return false;
+  size_ = size;
+  cell_width_ = width;
+  cell_height_ = height;
+  for (int exponent = 0; exponent <= GameBoard::kMaxExponent; ++exponent)
+    labels_[exponent] = Label(exponent, cell_width_ - 1);
+  blank_.assign(cell_width_ - 1, ' ');
+  shown_ = GameBoard(size);
+  invalidate();
+  return true;
+}
+
+void BoardView::invalidate() {
+  full_ = true;
+  status_ = true;
+  flashing_.clear();
+}
+
+void BoardView::update(const GameState& state) {
+  const GameBoard& board = state.board;
+  for (int row = 0; row < size_; ++row) {
+    if (!full_ && shown_.row_bits(row) == board.row_bits(row))
+      continue;
+    for (int col = 0; col < size_; ++col)
+      if (full_ || shown_.get(row, col) != board.get(row, col))
+        dirty_.set(row * size_ + col);
   }
-  mvaddch(BASELINE, LEFTPEG, '1');
-  mvaddch(BASELINE, MIDPEG, '2');
-  mvaddch(BASELINE, RIGHTPEG, '3');
-  attrset(A_NORMAL);
+  MoveDelta delta;
+  if (!full_ && state.moves == shown_moves_ + 1 &&
+      state.history.last(&delta)) {
+    long long until = frame_ + kFlashFrames;
+    for (int cell = 0; cell < size_ * size_; ++cell)
+      if (delta.merged[cell] || cell == delta.spawn) {
+        flashing_.emplace_back(cell, until);
+        dirty_.set(cell);
+      }
+  }
+  shown_ = board;
+  if (state.score != shown_score_ || state.moves != shown_moves_ ||
+      state.over != shown_over_) {
+    shown_score_ = state.score;
+    shown_moves_ = state.moves;
+    shown_over_ = state.over;
+    status_ = true;
+  }
+}
 
+void BoardView::draw(SquareMergeGame* game, const char* message) {
+  int status_line = top_ + size_ * cell_height_ + 1;
+  if (full_) {
+    erase();
+    attrset(COLOR_PAIR(kStatusPair) | A_BOLD);
+    mvaddstr(0, left_, "S Q U A R E   M E R G E");
+    attrset(A_NORMAL);
+    mvaddnstr(status_line + 2, left_, help_ ? help_ : game->help(),
+              COLS - left_);
+    mvaddnstr(status_line + 3, left_, keys_ ? keys_ : game->text(kKeysText),
+              COLS - left_);
+    dirty_.set();
+    full_ = false;
+  }
+  if (message_ != message) {
+    message_ = message;
+    status_ = true;
+  }
+  if (status_) {
+    attrset(A_NORMAL);
+    mvprintw(status_line, left_, "%s %d   %s %d   %s",
+             game->text(kScoreText), shown_score_, game->text(kMovesText),
+             shown_moves_, shown_over_ ? game->text(kGameOverText) : message);
+    clrtoeol();
+    status_ = false;
+  }
 
-  for (peg = 0; peg < NPEGS; peg++) {
-    for (SlotNo = 0; SlotNo < Pegs[peg].Count; SlotNo++) {
-      memset(TileBuf, ' ', Pegs[peg].Length[SlotNo]);
-      TileBuf[Pegs[peg].Length[SlotNo]] = '\0';
-      if (has_colors())
-        attrset(COLOR_PAIR(LENTOIND(Pegs[peg].Length[SlotNo])));
-      else
-        attrset(A_REVERSE);
-      mvaddstr(BASELINE - (SlotNo + 1),
-               (int) (PegPos[peg] - Pegs[peg].Length[SlotNo] / 2),
-               TileBuf);
+  // Turns off flashes that ran out, and draws the rest lit.
+  std::bitset<GameBoard::kMaxCells> lit;
+  size_t kept = 0;
+  for (const auto& flash: flashing_) {
+    if (flash.second > frame_) {
+      lit.set(flash.first);
+      flashing_[kept++] = flash;
+    } else {
+      dirty_.set(flash.first);
     }
   }
+  flashing_.resize(kept);
+  for (int cell = 0; cell < size_ * size_; ++cell)
+    if (dirty_[cell])
+      draw_cell(cell, lit[cell]);
+  dirty_.reset();
   attrset(A_NORMAL);
   refresh();
+  ++frame_;
 }
 
-  static int
-GetMove(int *From, int *To)
-{
+void BoardView::draw_cell(int cell, bool flash) {
+  int row = cell / size_;
+  int col = cell % size_;
+  int exponent = shown_.get(row, col);
+  attr_t attributes = A_NORMAL;
+  if (exponent) {
+    attributes = has_colors() ? COLOR_PAIR(exponent) : A_REVERSE;
+    if (exponent > kTileColorCount)
+      attributes |= A_BOLD;
+  }
+  if (flash)
+    attributes ^= has_colors() ? A_REVERSE : A_BOLD;
+  attrset(attributes);
+  // One blank line under tiles taller than one line keeps rows apart.
+  int height = cell_height_ > 1 ? cell_height_ - 1 : 1;
+  int y = top_ + row * cell_height_;
+  int x = left_ + col * cell_width_;
+  for (int line = 0; line < height; ++line)
+    mvaddstr(y + line, x,
+             (line == (height - 1) / 2 ? labels_[exponent] : blank_).c_str());
+}
 
-  attrset(A_REVERSE);
-  mvaddstr(LINES-1, 20,"<Q>/<q> Quit       <1>-<3> Move  ");
+// Shows the engine counters in columns over the whole screen until a key is
+// pressed.
+void ShowStats() {
+  std::vector<std::string> lines;
+  if (Instrument::kEnabled) {
+    std::string report = Instrument::Snapshot().report();
+    for (size_t start = 0, end; start < report.size(); start = end + 1) {
+      end = report.find('\n', start);
+      lines.push_back(report.substr(start, end - start));
+    }
+  } else {
+    lines.push_back("Built without counters, see make INSTRUMENT=1");
+  }
+  size_t width = 0;
+  for (const std::string& line: lines)
+    width = std::max(width, line.size());
+  int rows = std::max(1, LINES - 2);
+  erase();
   attrset(A_NORMAL);
-
-  mvaddstr(STATUSLINE, 0, "Next step: from ");
-  clrtoeol();
+  for (size_t i = 0; i < lines.size(); ++i)
+    mvaddnstr(int(i) % rows, int(i) / rows * int(width + 3), lines[i].c_str(),
+              std::max(0, COLS - int(i) / rows * int(width + 3)));
+  mvaddstr(LINES - 1, 0, "Press any key");
   refresh();
-  *From = getch();
-  if ((*From == 'q')||(*From == 'Q') )return TRUE;
-  *From -= ('0' + 1);
-  addstr(" to ");
-  clrtoeol();
-  refresh();
-
-  *To = getch();
-  if ((*To == 'q') || (*To == 'Q'))return TRUE;
-  *To -= ('0' + 1);
-  refresh();
-  napms(500);
-
-  move(STATUSLINE, 0);
-  clrtoeol();
-  refresh();
-  return FALSE;
+  timeout(-1);
+  getch();
 }
 
-  static void
-MakeMove(int From, int To)
-{
-  Pegs[From].Count--;
-  Pegs[To].Length[Pegs[To].Count] = Pegs[From].Length[Pegs[From].Count];
-  Pegs[To].Count++;
-  NMoves++;
-  DisplayTiles();
+// Reads game index of the log at path into *game. Returns an error message,
+// or nullptr on success. *reader has to stay open while *game is used.
+const char* OpenReplay(const char* path, long long index, ReplayReader* reader,
+                       ReplayGame* game) {
+  if (!reader->open(path))
+    return "Cannot read the replay log";
+  if (index < 0 || index >= reader->games())
+    return "No such game in the replay log";
+  std::vector<ReplayGame> games;
+  for (int chunk = 0; chunk < reader->chunks(); ++chunk) {
+    if (!reader->read_chunk(chunk, &games))
+      return "The replay log is malformed";
+    if (index < (long long)games.size()) {
+      *game = games[index];
+      if (game->game_size < 2 || game->game_size > GameBoard::kMaxSize)
+        return "The replay log is malformed";
+      return nullptr;
+    }
+    index -= games.size();
+  }
+  return "No such game in the replay log";
 }
 
-  static void
-AutoMove(int From, int To, int Num)
-{
-  if (Num == 1) {
-    MakeMove(From, To);
-    napms(500);
-    return;
+// The move a replay key scrubs to from position, or -1 if it is not one.
+// Pages go 100 steps, a step being the moves between snapshots, so that
+// each seek replays fewer than a step of moves.
+long long ReplayTarget(int key, const ReplayGame& replay, long long position) {
+  long long step = replay.snapshot_interval ? replay.snapshot_interval
+                                            : kReplayStep;
+  long long target;
+  switch (key) {
+    case KEY_RIGHT: case 'l': target = position + 1; break;
+    case KEY_LEFT: case 'h': target = position - 1; break;
+    case KEY_UP: case 'k': target = position + step; break;
+    case KEY_DOWN: case 'j': target = position - step; break;
+    case KEY_NPAGE: target = position + 100 * step; break;
+    case KEY_PPAGE: target = position - 100 * step; break;
+    case KEY_HOME: case 'g': target = 0; break;
+    case KEY_END: case 'G': target = replay.count; break;
+    default: return -1;
   }
-  AutoMove(From, OTHER(From, To), Num - 1);
-  MakeMove(From, To);
-  napms(500);
-  AutoMove(OTHER(From, To), To, Num - 1);
+  return std::max(0LL, std::min(target, (long long)replay.count));
 }
 
-  static int
-Solved(int NumTiles)
-{
-  int i;
+// Milliseconds from now until then, at least 0.
+int MillisecondsUntil(Clock::time_point then) {
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      then - Clock::now()).count();
+  return left > 0 ? int(left) : 0;
+}
 
-  for (i = 1; i < NPEGS; i++)
-    if (Pegs[i].Count == NumTiles)
-      return TRUE;
-  return FALSE;
+void Usage() {
+  fprintf(stderr,
+          "square-merge-game [-s size] [-r seed] [-u max_undo] [-p policy]\n"
+          "                  [-d delay] [-f fps] [-l language]\n"
+          "square-merge-game -R log [-g game] [-d delay] [-f fps]\n"
+          "  -s  cells per side, 4 by default\n"
+          "  -u  moves that can be taken back, 16 by default\n"
+          "  -p  registered policy for auto play, toggled by space\n"
+          "  -d  milliseconds between auto moves, 100 by default\n"
+          "  -f  frames per second at most, 60 by default\n"
+          "  -l  language of the texts in texts.tsv, en by default\n"
+          "  -R  replay log to scrub through, e.g. from simulate -w\n"
+          "  -g  game of the log from 0, 0 by default\n");
 }
 
-  static void
-Usage()
-{
-  fprintf(stderr, "\nhanoi\t[n]Steps -- Play\n\
-          \t[a]Steps -- Demo\n\t[h] \t-- Help \n");
-  printf("\e[0;33mStep number from %d To %d\e[0m\n", MINTILES, MAXTILES);
+}  // namespace
 
+int main(int argc, char** argv) {
+  GameOptions options = GameOptions();
+  options.game_size = 4;
+  options.rand_seed = int(time(nullptr));
+  options.max_undo = 16;
+  MoveMethod::ptr policy;
+  int delay = 100;
+  int fps = 60;
+  const char* replay_path = nullptr;
+  long long replay_index = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:r:u:p:d:f:l:R:g:h")) != -1) {
+    switch (opt) {
+      case 's':
+        options.game_size = atoi(optarg);
+        if (options.game_size < 2 || options.game_size > GameBoard::kMaxSize) {
+          fprintf(stderr, "Size from 2 to %d\n", GameBoard::kMaxSize);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'r':
+        options.rand_seed = atoi(optarg);
+        break;
+      case 'u':
+        options.max_undo = std::max(0, atoi(optarg));
+        break;
+      case 'p':
+        policy = MoveMethod::CreateShared(optarg);
+        if (!policy) {
+          fprintf(stderr, "Unknown policy \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'd':
+        delay = std::max(0, atoi(optarg));
+        break;
+      case 'f':
+        fps = std::max(1, atoi(optarg));
+        break;
+      case 'l': {
+        ResourceText* texts = new ResourceText;
+        texts->set_language(optarg);
+        options.text_method.reset(texts);
+        break;
+      }
+      case 'R':
+        replay_path = optarg;
+        break;
+      case 'g':
+        replay_index = atoll(optarg);
+        break;
+      default:
+        Usage();
+        return EXIT_FAILURE;
+    }
+  }
+  for (const char* name: {kArrowKeysMove, kViKeysMove, kUndoKeyMove})
+    options.move.push_back(Move::CreateShared(name));
+
+  ReplayReader reader;
+  ReplayGame replay;
+  if (replay_path) {
+    if (const char* error =
+            OpenReplay(replay_path, replay_index, &reader, &replay)) {
+      fprintf(stderr, "%s: %s\n", error, replay_path);
+      return EXIT_FAILURE;
+    }
+    options.game_size = replay.game_size;
+  }
+
+  initscr();
+  InitColors();
+  cbreak();
+  noecho();
+  keypad(stdscr, TRUE);
+  curs_set(0);
+  // The cursor is hidden, so curses need not move it back after drawing.
+  leaveok(stdscr, TRUE);
+  BoardView view;
+  if (!view.layout(options.game_size)) {
+    endwin();
+    fprintf(stderr, "The terminal is too small for a %dx%d board\n",
+            options.game_size, options.game_size);
+    return EXIT_FAILURE;
+  }
+
+  RegisterArena arena;
+  SquareMergeGame* game = replay_path ? replay.create(&arena)
+                                      : SquareMergeGame::Create(&arena, options);
+  if (!game) {
+    endwin();
+    fprintf(stderr, "The random source of the replay is not registered\n");
+    return EXIT_FAILURE;
+  }
+  view.update(game->game_state());
+  if (replay_path)
+    view.set_texts(kReplayHelp, kReplayKeys);
+  const char* message = "";
+  // Moves of the replay shown, and the status line that says so.
+  long long position = 0;
+  std::string replay_message;
+  // Moves the replay to move target: one move on by advance(), so that its
+  // tiles flash, and anywhere else by a seek from the snapshot before it.
+  // Returns false if the log does not fit the game.
+  auto scrub = [&](long long target) {
+    if (target == position + 1) {
+      int moves = game->game_state().moves;
+      game->advance(Direction(replay.move(uint32_t(position))));
+      if (game->game_state().moves == moves)
+        return false;
+    } else if (target != position) {
+      arena.clear();
+      game = replay.seek(&arena, uint32_t(target));
+      if (!game)
+        return false;
+    }
+    position = target;
+    replay_message = "Game " + std::to_string(replay_index) + " move " +
+                     std::to_string(position) + " of " +
+                     std::to_string(replay.count);
+    return true;
+  };
+  if (replay_path) {
+    scrub(0);
+    message = replay_message.c_str();
+  }
+  bool failed = false;
+  bool autoplay = false;
+  auto frame = std::chrono::microseconds(1000000 / fps);
+  Clock::time_point next_frame = Clock::now();
+  Clock::time_point next_move = next_frame;
+  for (bool running = true; running; ) {
+    bool playing = autoplay && (replay_path ? position < replay.count
+                                            : !game->game_state().over);
+    int wait = -1;
+    if (view.pending())
+      wait = MillisecondsUntil(next_frame);
+    if (playing)
+      wait = std::min(wait < 0 ? delay : wait, MillisecondsUntil(next_move));
+    timeout(wait);
+    int key = getch();
+    if (key != ERR) {
+      message = replay_path ? replay_message.c_str() : "";
+      switch (key) {
+        case 'q':
+          running = false;
+          break;
+        case 'n':
+          if (replay_path)
+            break;
+          ++options.rand_seed;
+          arena.clear();
+          game = SquareMergeGame::Create(&arena, options);
+          view.invalidate();
+          break;
+        case 'i':
+          ShowStats();
+          view.invalidate();
+          break;
+        case ' ':
+          if (replay_path) {
+            autoplay = !autoplay;
+          } else {
+            autoplay = policy && !autoplay;
+            message = policy ? "" : "No policy given by -p";
+          }
+          next_move = Clock::now();
+          break;
+        case KEY_RESIZE:
+          if (!view.layout(options.game_size))
+            message = "The terminal is too small";
+          break;
+        default:
+          if (replay_path) {
+            long long target = ReplayTarget(key, replay, position);
+            if (target >= 0) {
+              failed = !scrub(target);
+              running = !failed;
+              message = replay_message.c_str();
+            }
+            break;
+          }
+          g_key = key;
+          game->advance();
+          g_key = ERR;
+      }
+      if (!running)
+        break;
+      view.update(game->game_state());
+      // Applies every queued key before drawing the next frame.
+      continue;
+    }
+
+    Clock::time_point now = Clock::now();
+    if (playing && now >= next_move) {
+      if (replay_path) {
+        failed = !scrub(position + 1);
+        if (failed)
+          break;
+        message = replay_message.c_str();
+        autoplay = position < replay.count;
+      } else {
+        int direction = policy->decide(game->game_state());
+        if (direction >= 0)
+          game->advance(Direction(direction));
+        autoplay = direction >= 0;
+      }
+      view.update(game->game_state());
+      next_move = now + std::chrono::milliseconds(delay);
+    }
+    if (view.pending() && now >= next_frame) {
+      view.draw(game, message);
+      next_frame = now + frame;
+    }
+  }
+  endwin();
+  if (failed) {
+    fprintf(stderr, "The replay log does not fit game %lld: %s\n",
+            replay_index, replay_path);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
 }
-/*----------------the end-----------------*/
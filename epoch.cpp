@@ -0,0 +1,90 @@
+// File: epoch.cpp
+//
+// Brief: The global epoch and the guards of all threads.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "epoch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// The epoch a thread pinned, 0 while it holds no guard. Only the thread
+// writes it, and each takes a cache line of its own.
+struct alignas(64) ThreadEpoch {
+  ThreadEpoch();
+
+  ~ThreadEpoch();
+
+  std::atomic<uint64_t> pinned{0};
+  int depth = 0;
+};
+
+struct AllEpochs {
+  std::atomic<uint64_t> epoch{1};
+  std::mutex mutex;
+  std::vector<ThreadEpoch*> threads;
+};
+
+AllEpochs& GetAllEpochs() {
+  static AllEpochs* all = new AllEpochs;
+  return *all;
+}
+
+ThreadEpoch::ThreadEpoch() {
+  AllEpochs& all = GetAllEpochs();
+  std::lock_guard<std::mutex> lock(all.mutex);
+  all.threads.push_back(this);
+}
+
+ThreadEpoch::~ThreadEpoch() {
+  AllEpochs& all = GetAllEpochs();
+  std::lock_guard<std::mutex> lock(all.mutex);
+  all.threads.erase(std::find(all.threads.begin(), all.threads.end(), this));
+}
+
+ThreadEpoch& GetThreadEpoch() {
+  thread_local ThreadEpoch epoch;
+  return epoch;
+}
+
+}  // namespace
+
+Epoch::Guard::Guard() {
+  ThreadEpoch& thread = GetThreadEpoch();
+  // Sequentially consistent, so an owner that does not see the pin made its
+  // unlink visible to every load after it.
+  if (!thread.depth++)
+    thread.pinned.store(GetAllEpochs().epoch.load());
+}
+
+Epoch::Guard::~Guard() {
+  ThreadEpoch& thread = GetThreadEpoch();
+  if (!--thread.depth)
+    thread.pinned.store(0, std::memory_order_release);
+}
+
+uint64_t Epoch::Current() {
+  return GetAllEpochs().epoch.load();
+}
+
+uint64_t Epoch::Reclaimable() {
+  AllEpochs& all = GetAllEpochs();
+  std::lock_guard<std::mutex> lock(all.mutex);
+  uint64_t epoch = all.epoch.load();
+  uint64_t oldest = epoch;
+  for (const ThreadEpoch* thread: all.threads) {
+    uint64_t pinned = thread->pinned.load();
+    if (pinned)
+      oldest = std::min(oldest, pinned);
+  }
+  if (oldest == epoch)
+    all.epoch.compare_exchange_strong(epoch, epoch + 1);
+  return oldest;
+}
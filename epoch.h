@@ -0,0 +1,57 @@
+// File: epoch.h
+//
+// Brief: Epoch-based reclamation, for objects that some threads read
+//        without a lock while their owner may remove them. Readers hold an
+//        Epoch::Guard while they use such objects. The owner unlinks an
+//        object, tags it with Epoch::Current(), and frees it only once
+//        Epoch::Reclaimable() has passed the tag, i.e. once no guard that
+//        could have seen it is left. Guards cost two stores and a load of
+//        per-thread, cache-line padded records, and nest.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: {
+//          Epoch::Guard guard;
+//          const Object* object = table[i].load();
+//          ...
+//        }
+//
+//        table[i].store(nullptr);
+//        retired.push_back({object, Epoch::Current()});
+//        ...
+//        uint64_t reclaimable = Epoch::Reclaimable();
+//        for (auto& entry: retired)
+//          if (entry.epoch < reclaimable)
+//            delete entry.object;
+//
+
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+#include <cstdint>
+
+class Epoch {
+ public:
+  // Keeps every object that is reachable now alive until destroyed.
+  class Guard {
+   public:
+    Guard();
+
+    ~Guard();
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+  };
+
+  // The epoch to tag an object with right after unlinking it.
+  static uint64_t Current();
+
+  // Advances the epoch if every guard has seen the current one. Returns the
+  // epoch that objects tagged before it are no longer seen by any guard
+  // from. Takes a lock, so owners call it now and then, not per object.
+  static uint64_t Reclaimable();
+};
+
+#endif  // EPOCH_H_
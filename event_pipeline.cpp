@@ -0,0 +1,44 @@
+// File: event_pipeline.cpp
+//
+// Brief: The batched event pipeline.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "event_pipeline.h"
+
+#include "instrument.h"
+
+int EventPipeline::add(Event::ptr event) {
+  if (!event || size() >= kMaxEvents)
+    return -1;
+  features_ |= event->features();
+  events_.push_back(std::move(event));
+  return size() - 1;
+}
+
+int EventPipeline::add(const std::string& name) {
+  return add(Event::CreateShared(name));
+}
+
+void EventPipeline::run(const GameState* const* states, int count,
+                        std::vector<uint32_t>* fired) {
+  fired->assign(count, 0);
+  if (events_.empty() || count <= 0)
+    return;
+  if (capacity_ < count) {
+    capacity_ = count;
+    batch_.resize(count);
+    hits_.reset(new bool[count]);
+  }
+
+  Instrument::Count(kEventCheckCounter, uint64_t(count) * size());
+  for (int i = 0; i < count; ++i)
+    batch_[i].compute(*states[i], features_);
+  for (int e = 0; e < size(); ++e) {
+    events_[e]->check_batch(states, batch_.data(), count, hits_.get());
+    for (int i = 0; i < count; ++i)
+      (*fired)[i] |= uint32_t(hits_[i]) << e;
+  }
+}
@@ -0,0 +1,68 @@
+// File: event_pipeline.h
+//
+// Brief: Evaluates many events over many games at once. Every event declares
+//        the board features it reads. The pipeline computes all of them in
+//        one pass per game, then checks each event over the whole batch with
+//        a single virtual call. Adding rules costs one loop over the
+//        features each, not another walk over every state.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: EventPipeline pipeline;
+//        pipeline.add("2048");
+//        pipeline.add("corner");
+//        std::vector<uint32_t> fired;
+//        pipeline.run(states, count, &fired);
+//        >> Bit 1 of fired[i] is set if game i keeps a largest tile in a
+//           corner.
+//
+
+#ifndef EVENT_PIPELINE_H_
+#define EVENT_PIPELINE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "game.h"
+
+class EventPipeline {
+ public:
+  static const int kMaxEvents = 32;
+
+  // Adds event and returns its bit index in the fired masks, or -1 if event
+  // is null or kMaxEvents events are in already.
+  int add(Event::ptr event);
+
+  // Same, creating the registered event name.
+  int add(const std::string& name);
+
+  int size() const {
+    return int(events_.size());
+  }
+
+  const Event::ptr& event(int index) const {
+    return events_[index];
+  }
+
+  // The BoardFeature bits all events read.
+  uint32_t features() const {
+    return features_;
+  }
+
+  // Checks all events on count games. Bit e of (*fired)[i] is set if event e
+  // captured states[i].
+  void run(const GameState* const* states, int count,
+           std::vector<uint32_t>* fired);
+
+ private:
+  std::vector<Event::ptr> events_;
+  uint32_t features_ = 0;
+  std::vector<BoardFeatures> batch_;
+  std::unique_ptr<bool[]> hits_;
+  int capacity_ = 0;
+};
+
+#endif  // EVENT_PIPELINE_H_
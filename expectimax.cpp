@@ -0,0 +1,379 @@
+// File: expectimax.cpp
+//
+// Brief: Expectimax search and its board heuristic.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "expectimax.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "opening_book.h"
+#include "thread_pool.h"
+
+namespace {
+
+const float kLostPenalty = 200000.0f;
+const float kMonotonicityPower = 4.0f;
+const float kMonotonicityWeight = 47.0f;
+const float kSumPower = 3.5f;
+const float kSumWeight = 11.0f;
+const float kMergesWeight = 700.0f;
+const float kEmptyWeight = 270.0f;
+
+// Deepest search under a time budget.
+const int kDeepestSearch = 32;
+
+// Table depth of a value whose subtree never reached the depth limit.
+const int kExactDepth = 255;
+
+// Checks the clock once every kClockInterval + 1 max nodes.
+const long long kClockInterval = 1023;
+
+struct Powers {
+  Powers() {
+    for (int rank = 0; rank <= GameBoard::kMaxExponent; ++rank) {
+      sum[rank] = std::pow(float(rank), kSumPower);
+      monotonicity[rank] = std::pow(float(rank), kMonotonicityPower);
+    }
+  }
+
+  float sum[GameBoard::kMaxExponent + 1];
+  float monotonicity[GameBoard::kMaxExponent + 1];
+};
+
+const Powers& GetPowers() {
+  static const Powers powers;
+  return powers;
+}
+
+// Rewards empty cells, equal neighbours and monotonic lines, and penalizes
+// large tiles away from the ends.
+float LineHeuristic(const uint8_t* line, int length) {
+  const Powers& powers = GetPowers();
+  float sum = 0;
+  int empty = 0;
+  int merges = 0;
+  int previous = 0;
+  int counter = 0;
+  for (int i = 0; i < length; ++i) {
+    int rank = line[i];
+    sum += powers.sum[rank];
+    if (!rank) {
+      ++empty;
+    } else {
+      if (previous == rank) {
+        ++counter;
+      } else if (counter > 0) {
+        merges += 1 + counter;
+        counter = 0;
+      }
+      previous = rank;
+    }
+  }
+  if (counter > 0)
+    merges += 1 + counter;
+
+  float left = 0;
+  float right = 0;
+  for (int i = 1; i < length; ++i) {
+    if (line[i - 1] > line[i])
+      left += powers.monotonicity[line[i - 1]] - powers.monotonicity[line[i]];
+    else
+      right += powers.monotonicity[line[i]] - powers.monotonicity[line[i - 1]];
+  }
+
+  return kLostPenalty + kEmptyWeight * empty + kMergesWeight * merges -
+         kMonotonicityWeight * std::min(left, right) - kSumWeight * sum;
+}
+
+int UnpackRow(uint64_t bits, int length, uint8_t* line) {
+  for (int i = 0; i < length; ++i)
+    line[i] = (bits >> (4 * i)) & 0xf;
+  return length;
+}
+
+// Heuristics of every 16-bit row of a compact board, for one row length.
+struct HeuristicTable {
+  explicit HeuristicTable(int length) {
+    uint8_t line[GameBoard::kCompactSize];
+    for (int row = 0; row < (1 << 16); ++row)
+      value[row] = LineHeuristic(line, UnpackRow(row, length, line));
+  }
+
+  float value[1 << 16];
+};
+
+template <int length>
+const HeuristicTable& GetHeuristicTable() {
+  static const HeuristicTable table(length);
+  return table;
+}
+
+const HeuristicTable& HeuristicTableFor(int length) {
+  switch (length) {
+    case 1: return GetHeuristicTable<1>();
+    case 2: return GetHeuristicTable<2>();
+    case 3: return GetHeuristicTable<3>();
+    default: return GetHeuristicTable<4>();
+  }
+}
+
+}  // namespace
+
+ExpectimaxMoveMethod::ExpectimaxMoveMethod(int table_bits)
+    : table_mask_((size_t(1) << std::max(1, std::min(table_bits, 30))) - 1),
+      table_(new Entry[table_mask_ + 1]()),
+      book_(OpeningBook::Default()) {}
+
+ExpectimaxMoveMethod::~ExpectimaxMoveMethod() {}
+
+void ExpectimaxMoveMethod::set_threads(int threads) {
+  pool_.reset(threads == 1 ? nullptr : new ThreadPool(threads));
+  threads_ = pool_ ? pool_->size() : 1;
+}
+
+int ExpectimaxMoveMethod::decide(const GameState& state) {
+  if (book_) {
+    int direction = book_->find(state.board);
+    if (direction >= 0) {
+      ++book_moves_;
+      searched_depth_ = 0;
+      return direction;
+    }
+  }
+
+  if (++generation_ == 0) {
+    for (size_t i = 0; i <= table_mask_; ++i) {
+      table_[i].check.store(0, std::memory_order_relaxed);
+      table_[i].data.store(0, std::memory_order_relaxed);
+    }
+    generation_ = 1;
+  }
+
+  float values[kDirections];
+  bool horizon = false;
+  if (time_budget_ > 0) {
+    deadline_ = std::chrono::steady_clock::now() +
+                std::chrono::milliseconds(time_budget_);
+    search_root(state.board, 1, false, values, &horizon);
+    searched_depth_ = 1;
+    float deeper[kDirections];
+    for (int depth = 2; horizon && depth <= kDeepestSearch; ++depth) {
+      if (std::chrono::steady_clock::now() >= deadline_ ||
+          !search_root(state.board, depth, true, deeper, &horizon))
+        break;
+      std::copy(deeper, deeper + kDirections, values);
+      searched_depth_ = depth;
+    }
+  } else {
+    searched_depth_ = search_depth(state.board);
+    search_root(state.board, searched_depth_, false, values, &horizon);
+  }
+
+  int best = -1;
+  float best_value = -1;
+  for (int direction = 0; direction < kDirections; ++direction) {
+    if (values[direction] > best_value) {
+      best = direction;
+      best_value = values[direction];
+    }
+  }
+  return best;
+}
+
+float ExpectimaxMoveMethod::Evaluate(const GameBoard& board) {
+  int size = board.size();
+  GameBoard columns = board.transpose();
+  float value = 0;
+  if (board.compact()) {
+    const HeuristicTable& table = HeuristicTableFor(size);
+    for (int row = 0; row < size; ++row)
+      value += table.value[board.row_bits(row)] +
+               table.value[columns.row_bits(row)];
+  } else {
+    uint8_t line[GameBoard::kMaxSize];
+    for (int row = 0; row < size; ++row)
+      value += LineHeuristic(line, UnpackRow(board.row_bits(row), size, line)) +
+               LineHeuristic(line,
+                             UnpackRow(columns.row_bits(row), size, line));
+  }
+  return value;
+}
+
+float ExpectimaxMoveMethod::score_move(const GameBoard& board,
+                                       Direction direction, int depth) {
+  GameBoard next = board;
+  if (!next.slide(direction))
+    return 0;
+  Search search;
+  stopped_ = false;
+  float value = chance_value(next, depth, 1.0f, &search);
+  nodes_ += search.nodes;
+  return value;
+}
+
+bool ExpectimaxMoveMethod::search_root(const GameBoard& board, int depth,
+                                       bool timed, float* values,
+                                       bool* horizon) {
+  // Every spawn under every root slide is one task.
+  struct Spawn {
+    int direction;
+    float probability;
+    GameBoard board;
+  };
+  std::vector<Spawn> spawns;
+  int size = board.size();
+  int legal = board.legal_moves();
+  for (int direction = 0; direction < kDirections; ++direction) {
+    if (!(legal >> direction & 1)) {
+      values[direction] = -1;
+      continue;
+    }
+    GameBoard next = board;
+    next.slide(Direction(direction));
+    values[direction] = 0;
+    float probability = 1.0f / next.empty_cells();
+    for (int row = 0; row < size; ++row) {
+      for (int col = 0; col < size; ++col) {
+        if (next.get(row, col))
+          continue;
+        spawns.push_back({direction, 0.9f * probability, next});
+        spawns.back().board.set(row, col, 1);
+        spawns.push_back({direction, 0.1f * probability, next});
+        spawns.back().board.set(row, col, 2);
+      }
+    }
+  }
+
+  std::vector<Search> searches(spawns.size());
+  std::vector<float> results(spawns.size());
+  stopped_ = false;
+  auto run = [&, depth, timed](size_t i) {
+    searches[i].timed = timed;
+    results[i] = max_value(spawns[i].board, depth - 1, spawns[i].probability,
+                           &searches[i]);
+  };
+  if (pool_) {
+    for (size_t i = 0; i < spawns.size(); ++i)
+      pool_->submit([&run, i] { run(i); });
+    pool_->wait();
+  } else {
+    for (size_t i = 0; i < spawns.size(); ++i)
+      run(i);
+  }
+
+  *horizon = false;
+  for (size_t i = 0; i < spawns.size(); ++i) {
+    values[spawns[i].direction] += spawns[i].probability * results[i];
+    *horizon |= searches[i].horizon;
+    nodes_ += searches[i].nodes;
+  }
+  return !stopped_;
+}
+
+float ExpectimaxMoveMethod::max_value(const GameBoard& board, int depth,
+                                      float probability, Search* search) {
+  if ((++search->nodes & kClockInterval) == 0 && search->timed &&
+      std::chrono::steady_clock::now() >= deadline_)
+    stopped_.store(true, std::memory_order_relaxed);
+  if (stopped_.load(std::memory_order_relaxed))
+    return 0;
+
+  // Only expands the slides that change the board.
+  float best = 0;
+  int legal = board.legal_moves();
+  for (int direction = 0; direction < kDirections; ++direction) {
+    if (!(legal >> direction & 1))
+      continue;
+    GameBoard next = board;
+    next.slide(Direction(direction));
+    best = std::max(best, chance_value(next, depth, probability, search));
+  }
+  return best;
+}
+
+float ExpectimaxMoveMethod::chance_value(const GameBoard& board, int depth,
+                                         float probability, Search* search) {
+  ++search->nodes;
+  int empty = board.empty_cells();
+  if (probability < cutoff_ || !empty)
+    return evaluate(board);
+  if (depth <= 0) {
+    search->horizon = true;
+    return evaluate(board);
+  }
+
+  uint64_t key = board.hash();
+  float value;
+  bool exact;
+  if (lookup(key, depth, &value, &exact)) {
+    search->horizon |= !exact;
+    return value;
+  }
+
+  // Whether this subtree reaches the depth limit, apart from the callers'.
+  bool horizon = search->horizon;
+  search->horizon = false;
+  int size = board.size();
+  float spawn_probability = probability / empty;
+  float total = 0;
+  for (int row = 0; row < size; ++row) {
+    for (int col = 0; col < size; ++col) {
+      if (board.get(row, col))
+        continue;
+      GameBoard next = board;
+      next.set(row, col, 1);
+      total += 0.9f * max_value(next, depth - 1, spawn_probability * 0.9f,
+                                search);
+      next.set(row, col, 2);
+      total += 0.1f * max_value(next, depth - 1, spawn_probability * 0.1f,
+                                search);
+    }
+  }
+
+  value = total / empty;
+  if (!stopped_.load(std::memory_order_relaxed))
+    store(key, search->horizon ? depth : kExactDepth, value);
+  search->horizon |= horizon;
+  return value;
+}
+
+int ExpectimaxMoveMethod::search_depth(const GameBoard& board) const {
+  if (depth_ > 0)
+    return depth_;
+  int size = board.size();
+  int seen = 0;
+  for (int row = 0; row < size; ++row)
+    for (int col = 0; col < size; ++col)
+      seen |= 1 << board.get(row, col);
+  int distinct = __builtin_popcount(seen & ~1);
+  return std::min(std::max(3, distinct - 2), max_depth_);
+}
+
+bool ExpectimaxMoveMethod::lookup(uint64_t key, int depth, float* value,
+                                  bool* exact) const {
+  const Entry& entry = table_[key & table_mask_];
+  uint64_t data = entry.data.load(std::memory_order_relaxed);
+  if ((entry.check.load(std::memory_order_relaxed) ^ data) != key ||
+      uint16_t(data >> 32) != generation_ || int(data >> 48) < depth)
+    return false;
+  uint32_t bits = uint32_t(data);
+  memcpy(value, &bits, sizeof(bits));
+  *exact = int(data >> 48) == kExactDepth;
+  return true;
+}
+
+void ExpectimaxMoveMethod::store(uint64_t key, int depth, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint64_t data = bits | uint64_t(generation_) << 32 | uint64_t(depth) << 48;
+  Entry& entry = table_[key & table_mask_];
+  entry.data.store(data, std::memory_order_relaxed);
+  entry.check.store(key ^ data, std::memory_order_relaxed);
+}
@@ -0,0 +1,215 @@
+// File: expectimax.h
+//
+// Brief: A MoveMethod that plays by expectimax search. Max nodes try the
+//        four slides. Chance nodes average over every spawn: a 2 with
+//        probability 0.9, a 4 with 0.1, at each empty cell. Chance nodes are
+//        cached in a hash-keyed transposition table. Branches are cut once
+//        they become unlikely enough.
+//
+//        With threads, the spawns under every root slide are searched as
+//        separate tasks on a work-stealing pool, sharing one lock-free table.
+//        With a time budget, the search deepens one spawn at a time until the
+//        budget runs out, and plays the deepest finished search.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: Registered as "expectimax", creating one with adaptive depth:
+//
+//            MoveMethod::ptr ai(MoveMethod::Create("expectimax"));
+//
+//        Configure it through the concrete class:
+//
+//            ExpectimaxMoveMethod* ai = new ExpectimaxMoveMethod;
+//            ai->set_depth(3);
+//            options.move_method.reset(ai);
+//
+//        Or search on every core for 100 milliseconds a move:
+//
+//            ai->set_threads(0);
+//            ai->set_time_budget(100);
+//
+//        Or value the leaves with a registered BoardEvaluator instead of the
+//        heuristic, itself registered as "heuristic":
+//
+//            ai->set_evaluator(BoardEvaluator::CreateShared("ntuple"));
+//
+//        Positions in the opening book, OpeningBook::Default() unless set,
+//        are played from it without a search.
+//
+
+#ifndef EXPECTIMAX_H_
+#define EXPECTIMAX_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+#include "game.h"
+
+class OpeningBook;
+class ThreadPool;
+
+inline constexpr char kExpectimaxMoveMethod[] = "expectimax";
+inline constexpr char kHeuristicEvaluator[] = "heuristic";
+
+class ExpectimaxMoveMethod:
+    public Register<ExpectimaxMoveMethod, MoveMethod, kExpectimaxMoveMethod> {
+ public:
+  // A table of 2^table_bits entries.
+  explicit ExpectimaxMoveMethod(int table_bits = 18);
+
+  ~ExpectimaxMoveMethod();
+
+  const char* info() override {
+    return "Plays by expectimax search.";
+  }
+
+  // Plays the book move of state.board if there is one, or searches from
+  // it. Returns -1 if no slide changes the board.
+  int decide(const GameState& state) override;
+
+  // Plays from book before searching, none if nullptr.
+  void set_book(std::shared_ptr<const OpeningBook> book) {
+    book_ = std::move(book);
+  }
+
+  // Searches this many spawns deep. If depth <= 0, the depth grows with the
+  // number of distinct tiles, from 3 up to max_depth().
+  void set_depth(int depth) {
+    depth_ = depth;
+  }
+
+  int depth() const {
+    return depth_;
+  }
+
+  void set_max_depth(int max_depth) {
+    max_depth_ = max_depth;
+  }
+
+  int max_depth() const {
+    return max_depth_;
+  }
+
+  // Stops searching a branch once its probability falls below cutoff.
+  void set_cutoff(float cutoff) {
+    cutoff_ = cutoff;
+  }
+
+  // Searches on this many threads, or one per hardware thread if
+  // threads <= 0. One thread by default, searching on the caller.
+  void set_threads(int threads);
+
+  int threads() const {
+    return threads_;
+  }
+
+  // Deepens each decision until milliseconds have passed, overriding
+  // depth(). No budget if milliseconds <= 0.
+  void set_time_budget(int milliseconds) {
+    time_budget_ = milliseconds;
+  }
+
+  int time_budget() const {
+    return time_budget_;
+  }
+
+  // Depth of the last finished search, 0 if the book had the move.
+  int searched_depth() const {
+    return searched_depth_;
+  }
+
+  // Search nodes visited so far, over all decisions.
+  long long nodes() const {
+    return nodes_;
+  }
+
+  // Decisions played from the book so far.
+  long long book_moves() const {
+    return book_moves_;
+  }
+
+  // Values the leaves with evaluator, or with Evaluate() if nullptr, the
+  // default. Called from every search thread at once.
+  void set_evaluator(BoardEvaluator::ptr evaluator) {
+    evaluator_ = std::move(evaluator);
+  }
+
+  // Heuristic value of a board, higher is better.
+  static float Evaluate(const GameBoard& board);
+
+  // Expected value of sliding board toward direction and searching depth
+  // spawns deep. Returns 0 if the slide does not change the board.
+  float score_move(const GameBoard& board, Direction direction, int depth);
+
+ private:
+  // One table slot. data packs value, generation and depth, and check holds
+  // key ^ data, so a slot torn by racing writers fails the key test.
+  struct Entry {
+    std::atomic<uint64_t> check;
+    std::atomic<uint64_t> data;
+  };
+
+  // State of one search task, kept apart from the others' cache lines.
+  struct alignas(64) Search {
+    long long nodes = 0;
+    bool horizon = false;  // A leaf was cut by depth, not by probability.
+    bool timed = false;
+  };
+
+  // Values of the root slides searched depth spawns deep, in *values, or
+  // false if the search ran out of time.
+  bool search_root(const GameBoard& board, int depth, bool timed,
+                   float* values, bool* horizon);
+
+  float max_value(const GameBoard& board, int depth, float probability,
+                  Search* search);
+
+  float chance_value(const GameBoard& board, int depth, float probability,
+                     Search* search);
+
+  int search_depth(const GameBoard& board) const;
+
+  float evaluate(const GameBoard& board) {
+    return evaluator_ ? evaluator_->evaluate(board) : Evaluate(board);
+  }
+
+  // Finds the value of key searched at least depth deep. *exact is true if
+  // that search never reached its depth limit.
+  bool lookup(uint64_t key, int depth, float* value, bool* exact) const;
+
+  void store(uint64_t key, int depth, float value);
+
+  int depth_ = 0;
+  int max_depth_ = 6;
+  float cutoff_ = 0.0001f;
+  int threads_ = 1;
+  int time_budget_ = 0;
+  int searched_depth_ = 0;
+  std::chrono::steady_clock::time_point deadline_;
+  std::atomic<bool> stopped_{false};
+  std::atomic<long long> nodes_{0};
+  uint16_t generation_ = 0;
+  size_t table_mask_;
+  std::unique_ptr<Entry[]> table_;
+  std::unique_ptr<ThreadPool> pool_;
+  BoardEvaluator::ptr evaluator_;
+  std::shared_ptr<const OpeningBook> book_;
+  long long book_moves_ = 0;
+};
+
+class HeuristicEvaluator:
+    public Register<HeuristicEvaluator, BoardEvaluator, kHeuristicEvaluator> {
+ public:
+  const char* info() override {
+    return "Values boards with the expectimax heuristic.";
+  }
+
+  float evaluate(const GameBoard& board) override {
+    return ExpectimaxMoveMethod::Evaluate(board);
+  }
+};
+
+#endif  // EXPECTIMAX_H_
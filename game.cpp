@@ -0,0 +1,1240 @@
+// File: game.cpp
+//
+// Brief: The square merge game engine and the packed board it plays on.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "game.h"
+#include "instrument.h"
+#include "sized_game.h"
+#include "slide_kernel.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Slide results of every 16-bit row of a compact board, for one row length.
+struct RowTable {
+  explicit RowTable(int length) {
+    uint8_t line[GameBoard::kCompactSize];
+    for (int row = 0; row < (1 << 16); ++row) {
+      for (int i = 0; i < length; ++i)
+        line[i] = (row >> (4 * i)) & 0xf;
+      score[row] = GameBoard::slide_line(line, length);
+      left[row] = 0;
+      for (int i = 0; i < length; ++i)
+        left[row] |= line[i] << (4 * i);
+
+      for (int i = 0; i < length; ++i)
+        line[i] = (row >> (4 * (length - 1 - i))) & 0xf;
+      GameBoard::slide_line(line, length);
+      right[row] = 0;
+      for (int i = 0; i < length; ++i)
+        right[row] |= line[i] << (4 * (length - 1 - i));
+    }
+  }
+
+  uint16_t left[1 << 16];
+  uint16_t right[1 << 16];
+  int score[1 << 16];
+};
+
+template <int length>
+const RowTable& GetRowTable() {
+  static const RowTable table(length);
+  return table;
+}
+
+const RowTable& RowTableFor(int length) {
+  switch (length) {
+    case 1: return GetRowTable<1>();
+    case 2: return GetRowTable<2>();
+    case 3: return GetRowTable<3>();
+    default: return GetRowTable<4>();
+  }
+}
+
+// Transposes a compact board, as a 4x4 matrix of nibbles in one word.
+uint64_t Transpose(uint64_t x) {
+  uint64_t a1 = x & 0xf0f00f0ff0f00f0fULL;
+  uint64_t a2 = x & 0x0000f0f00000f0f0ULL;
+  uint64_t a3 = x & 0x0f0f00000f0f0000ULL;
+  uint64_t a = a1 | (a2 << 12) | (a3 >> 12);
+  uint64_t b1 = a & 0xff00ff0000ff00ffULL;
+  uint64_t b2 = a & 0x00ff00ff00000000ULL;
+  uint64_t b3 = a & 0x00000000ff00ff00ULL;
+  return b1 | (b2 >> 24) | (b3 << 24);
+}
+
+// Transposes the first rows words of a wide board, as a rows x rows matrix
+// of nibbles with one row per word, by swapping blocks of rows / 2, ...,
+// 2 and 1 columns in turn.
+template <int rows>
+void TransposeRows(uint64_t* words) {
+  for (int block = rows / 2; block > 0; block >>= 1) {
+    int shift = 4 * block;
+    uint64_t mask = block == 8 ? 0x00000000ffffffffULL :
+                    block == 4 ? 0x0000ffff0000ffffULL :
+                    block == 2 ? 0x00ff00ff00ff00ffULL : 0x0f0f0f0f0f0f0f0fULL;
+    for (int row = 0; row < rows; ++row) {
+      if (row & block)
+        continue;
+      uint64_t t = ((words[row] >> shift) ^ words[row + block]) & mask;
+      words[row + block] ^= t;
+      words[row] ^= t << shift;
+    }
+  }
+}
+
+// Transposes a wide board of size rows. Boards of up to 8 rows fill only the
+// top left 8x8 block of nibbles, so they skip the rest.
+void Transpose(uint64_t* words, int size) {
+  if (size <= 8)
+    TransposeRows<8>(words);
+  else
+    TransposeRows<GameBoard::kMaxSize>(words);
+}
+
+// SplitMix64 finalizer, a bijection on 64-bit words.
+uint64_t Mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// The word of a 4x4 board with its columns mirrored.
+uint64_t MirrorColumns(uint64_t x) {
+  x = (x & 0x0f0f0f0f0f0f0f0fULL) << 4 | ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL);
+  return (x & 0x00ff00ff00ff00ffULL) << 8 | ((x >> 8) & 0x00ff00ff00ff00ffULL);
+}
+
+// The word of a 4x4 board with its rows mirrored.
+uint64_t MirrorRows(uint64_t x) {
+  x = (x & 0x0000ffff0000ffffULL) << 16 | ((x >> 16) & 0x0000ffff0000ffffULL);
+  return x << 32 | x >> 32;
+}
+
+// XOR of the Zobrist keys of the nibbles that differ between before and
+// after, the words at nibble first.
+uint64_t ZobristChange(uint64_t before, uint64_t after, int first) {
+  uint64_t result = 0;
+  for (uint64_t changed = before ^ after; changed; ) {
+    int shift = __builtin_ctzll(changed) & ~3;
+    const uint64_t* keys = kZobristKeys.keys[first + shift / 4];
+    result ^= keys[(before >> shift) & 0xf] ^ keys[(after >> shift) & 0xf];
+    changed &= ~(uint64_t(0xf) << shift);
+  }
+  return result;
+}
+
+void PutBytes(std::string* out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    out->push_back(char(value >> (8 * i)));
+}
+
+uint64_t GetBytes(const char* data, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i)
+    value |= uint64_t(uint8_t(data[i])) << (8 * i);
+  return value;
+}
+
+// Cell index of the i-th cell of line k, counted from the side the tiles
+// slide toward.
+int LineCell(int size, Direction direction, int k, int i) {
+  switch (direction) {
+    case kLeft: return k * size + i;
+    case kRight: return k * size + size - 1 - i;
+    case kUp: return i * size + k;
+    default: return (size - 1 - i) * size + k;
+  }
+}
+
+const uint64_t kNibbleLowBits = 0x1111111111111111ULL;
+
+// Nibble mask of the first length cells of a row.
+uint64_t CellMask(int length) {
+  return length >= 16 ? ~uint64_t(0) : (uint64_t(1) << (4 * length)) - 1;
+}
+
+// The low bit of every nibble of bits that is not zero.
+uint64_t NonzeroNibbles(uint64_t bits) {
+  bits |= bits >> 1;
+  bits |= bits >> 2;
+  return bits & kNibbleLowBits;
+}
+
+// Counts the nibbles of low_bits set, given only their low bits may be.
+int CountNibbles(uint64_t low_bits) {
+  uint64_t bytes = (low_bits + (low_bits >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return int(bytes * 0x0101010101010101ULL >> 56);
+}
+
+// The low bit of every nibble in mask where the tile in a would merge with
+// the tile in b.
+uint64_t MergeableNibbles(uint64_t a, uint64_t b, uint64_t mask) {
+  uint64_t full = a & a >> 1;
+  full &= full >> 2;
+  return ~NonzeroNibbles(a ^ b) & NonzeroNibbles(a) & ~full & mask &
+         kNibbleLowBits;
+}
+
+// Number of cells in mask where the tile in a would merge with the tile in
+// b, comparing nibble by nibble.
+int MergeablePairs(uint64_t a, uint64_t b, uint64_t mask) {
+  return CountNibbles(MergeableNibbles(a, b, mask));
+}
+
+// The legal slides between the tiles of a and their neighbours in b, which
+// are the next cells toward the right or down, within mask. Bit 0 is set if
+// tiles of b can move toward a, bit 1 if tiles of a can move toward b.
+int NeighbourMoves(uint64_t a, uint64_t b, uint64_t mask) {
+  uint64_t tiles_a = NonzeroNibbles(a);
+  uint64_t tiles_b = NonzeroNibbles(b);
+  uint64_t pairs = MergeableNibbles(a, b, mask);
+  uint64_t mask_bits = mask & kNibbleLowBits;
+  bool to_a = pairs | (~tiles_a & tiles_b & mask_bits);
+  bool to_b = pairs | (tiles_a & ~tiles_b & mask_bits);
+  return to_a | to_b << 1;
+}
+
+int EmptyCells(uint64_t bits, uint64_t mask) {
+  return CountNibbles(~NonzeroNibbles(bits) & kNibbleLowBits & mask);
+}
+
+// The cells of a compact board of size in one word, 16 bits per row, and
+// the cells of them that have a right or lower neighbour.
+struct CompactMasks {
+  uint64_t cells = 0;
+  uint64_t right = 0;
+  uint64_t lower = 0;
+};
+
+CompactMasks CompactMasksFor(int size) {
+  CompactMasks masks;
+  for (int row = 0; row < size; ++row) {
+    masks.cells |= CellMask(size) << (16 * row);
+    masks.right |= CellMask(size - 1) << (16 * row);
+    if (row + 1 < size)
+      masks.lower |= CellMask(size) << (16 * row);
+  }
+  return masks;
+}
+
+// Whether any cell of bits in mask holds exponent.
+bool HasExponent(uint64_t bits, int exponent, uint64_t mask) {
+  return ~NonzeroNibbles(bits ^ (kNibbleLowBits * exponent)) & kNibbleLowBits &
+         mask;
+}
+
+}  // namespace
+
+GameBoard::GameBoard(int size)
+    : size_(std::max(1, std::min(size, kMaxSize))) {
+  clear();
+}
+
+void GameBoard::clear() {
+  std::fill(words_, words_ + kMaxSize, 0);
+  legal_moves_ = -1;
+  zobrist_ = 0;
+}
+
+int GameBoard::empty_cells() const {
+  int count = 0;
+  for (int row = 0; row < size_; ++row)
+    for (int col = 0; col < size_; ++col)
+      count += !get(row, col);
+  return count;
+}
+
+int GameBoard::max_exponent() const {
+  int result = 0;
+  for (int row = 0; row < size_; ++row)
+    for (int col = 0; col < size_; ++col)
+      result = std::max(result, get(row, col));
+  return result;
+}
+
+bool GameBoard::slide(Direction direction, int* score) {
+  bool columns = direction == kUp || direction == kDown;
+  bool reverse = direction == kDown || direction == kRight;
+  int gained = 0;
+
+  if (compact()) {
+    const RowTable& table = RowTableFor(size_);
+    const uint16_t* lookup = reverse ? table.right : table.left;
+    uint64_t word = columns ? Transpose(words_[0]) : words_[0];
+    uint64_t result = 0;
+    for (int row = 0; row < size_; ++row) {
+      uint16_t bits = (word >> (16 * row)) & 0xffff;
+      result |= uint64_t(lookup[bits]) << (16 * row);
+      gained += table.score[bits];
+    }
+    if (columns)
+      result = Transpose(result);
+    if (result == words_[0])
+      return false;
+    zobrist_ = kZobristKeys.hash_compact(result);
+    words_[0] = result;
+    legal_moves_ = -1;
+  } else {
+    uint64_t rows[kMaxSize];
+    std::memcpy(rows, words_, sizeof(rows));
+    if (columns)
+      Transpose(rows, size_);
+    gained = SlideKernel::Best()->slide_rows(rows, size_, size_, reverse);
+    if (columns)
+      Transpose(rows, size_);
+    if (std::equal(rows, rows + kMaxSize, words_))
+      return false;
+    for (int row = 0; row < size_; ++row)
+      zobrist_ ^= ZobristChange(words_[row], rows[row], kMaxSize * row);
+    std::memcpy(words_, rows, sizeof(rows));
+    legal_moves_ = -1;
+  }
+
+  if (score)
+    *score += gained;
+  return true;
+}
+
+int GameBoard::find_legal_moves() const {
+  int across = 0;
+  int along = 0;
+  if (compact()) {
+    static const CompactMasks kMasks[kCompactSize + 1] = {
+        CompactMasksFor(0), CompactMasksFor(1), CompactMasksFor(2),
+        CompactMasksFor(3), CompactMasksFor(4)};
+    const CompactMasks& masks = kMasks[size_];
+    along = NeighbourMoves(words_[0], words_[0] >> 4, masks.right);
+    across = NeighbourMoves(words_[0], words_[0] >> 16, masks.lower);
+  } else {
+    uint64_t cells = CellMask(size_);
+    uint64_t right = CellMask(size_ - 1);
+    for (int row = 0; row < size_; ++row) {
+      along |= NeighbourMoves(words_[row], words_[row] >> 4, right);
+      if (row + 1 < size_)
+        across |= NeighbourMoves(words_[row], words_[row + 1], cells);
+    }
+  }
+  return (across & 1) << kUp | (across >> 1) << kDown |
+         (along & 1) << kLeft | (along >> 1) << kRight;
+}
+
+void GameBoard::diff(const GameBoard& before, Direction direction,
+                     MoveDelta* delta) const {
+  delta->direction = direction;
+  delta->occupied.reset();
+  delta->merged.reset();
+  for (int k = 0; k < size_; ++k) {
+    uint8_t tiles[kMaxSize];
+    int count = 0;
+    for (int i = 0; i < size_; ++i) {
+      int cell = LineCell(size_, direction, k, i);
+      int exponent = before.get(cell / size_, cell % size_);
+      if (exponent) {
+        delta->occupied.set(cell);
+        tiles[count++] = exponent;
+      }
+    }
+    // A tile that differs from the next one before the slide took two.
+    for (int i = 0, j = 0; i < count; ++j) {
+      int cell = LineCell(size_, direction, k, j);
+      if (get(cell / size_, cell % size_) != tiles[i]) {
+        delta->merged.set(cell);
+        i += 2;
+      } else {
+        ++i;
+      }
+    }
+  }
+}
+
+int GameBoard::revert(const MoveDelta& delta) {
+  if (delta.spawn >= 0)
+    set(delta.spawn / size_, delta.spawn % size_, 0);
+  Direction direction = Direction(delta.direction);
+  int score = 0;
+  for (int k = 0; k < size_; ++k) {
+    uint8_t tiles[kMaxSize];
+    int count = 0;
+    for (int i = 0; i < size_; ++i) {
+      int cell = LineCell(size_, direction, k, i);
+      int exponent = get(cell / size_, cell % size_);
+      if (!exponent)
+        continue;
+      set(cell / size_, cell % size_, 0);
+      if (delta.merged[cell]) {
+        tiles[count++] = exponent - 1;
+        tiles[count++] = exponent - 1;
+        score += 1 << exponent;
+      } else {
+        tiles[count++] = exponent;
+      }
+    }
+    for (int i = 0, t = 0; i < size_ && t < count; ++i) {
+      int cell = LineCell(size_, direction, k, i);
+      if (delta.occupied[cell])
+        set(cell / size_, cell % size_, tiles[t++]);
+    }
+  }
+  return score;
+}
+
+bool GameBoard::can_revert(const MoveDelta& delta) const {
+  int cells = size_ * size_;
+  if (delta.direction < 0 || delta.direction >= kDirections ||
+      delta.spawn >= cells || (delta.occupied >> cells).any() ||
+      (delta.merged >> cells).any())
+    return false;
+  GameBoard board = *this;
+  if (delta.spawn >= 0) {
+    int exponent = get(delta.spawn / size_, delta.spawn % size_);
+    if (!exponent || exponent != delta.spawn_exponent)
+      return false;
+    board.set(delta.spawn / size_, delta.spawn % size_, 0);
+  }
+  Direction direction = Direction(delta.direction);
+  for (int k = 0; k < size_; ++k) {
+    int tiles = 0;
+    int occupied = 0;
+    for (int i = 0; i < size_; ++i) {
+      int cell = LineCell(size_, direction, k, i);
+      int exponent = board.get(cell / size_, cell % size_);
+      occupied += delta.occupied[cell];
+      if (delta.merged[cell] && exponent < 2)
+        return false;
+      tiles += exponent ? 1 + delta.merged[cell] : 0;
+    }
+    if (tiles != occupied)
+      return false;
+  }
+  return true;
+}
+
+GameBoard GameBoard::transpose() const {
+  GameBoard result = *this;
+  if (compact())
+    result.words_[0] = Transpose(words_[0]);
+  else
+    Transpose(result.words_, size_);
+  result.legal_moves_ = -1;
+  result.zobrist_ = result.find_zobrist();
+  return result;
+}
+
+uint64_t GameBoard::hash() const {
+  if (compact())
+    return Mix(words_[0] ^ uint64_t(size_) << 60);
+  return zobrist_;
+}
+
+uint64_t GameBoard::find_zobrist() const {
+  if (compact())
+    return kZobristKeys.hash_compact(words_[0]);
+  uint64_t result = 0;
+  for (int row = 0; row < size_; ++row)
+    result ^= ZobristChange(0, words_[row], kMaxSize * row);
+  return result;
+}
+
+void GameBoard::SymmetricCell(int size, int symmetry, int* row, int* col) {
+  if (symmetry & 4)
+    std::swap(*row, *col);
+  if (symmetry & 1)
+    *col = size - 1 - *col;
+  if (symmetry & 2)
+    *row = size - 1 - *row;
+}
+
+uint64_t GameBoard::SymmetricBits(uint64_t bits, int symmetry) {
+  if (symmetry & 4)
+    bits = Transpose(bits);
+  if (symmetry & 1)
+    bits = MirrorColumns(bits);
+  if (symmetry & 2)
+    bits = MirrorRows(bits);
+  return bits;
+}
+
+Direction GameBoard::SymmetricDirection(Direction direction, int symmetry) {
+  // Transposing swaps kUp with kLeft and kDown with kRight, and mirroring
+  // swaps the two ends of one axis.
+  int result = direction;
+  if (symmetry & 4)
+    result ^= 2;
+  if (symmetry & 1 && result >= kLeft)
+    result ^= 1;
+  if (symmetry & 2 && result < kLeft)
+    result ^= 1;
+  return Direction(result);
+}
+
+uint64_t GameBoard::symmetric_zobrist(int symmetry) const {
+  if (size_ == kCompactSize)
+    return kZobristKeys.hash_compact(SymmetricBits(words_[0], symmetry));
+  uint64_t result = 0;
+  for (int row = 0; row < size_; ++row) {
+    for (int col = 0; col < size_; ++col) {
+      int exponent = get(row, col);
+      if (!exponent)
+        continue;
+      int moved_row = row;
+      int moved_col = col;
+      SymmetricCell(size_, symmetry, &moved_row, &moved_col);
+      result ^= kZobristKeys.keys[nibble(moved_row, moved_col)][exponent];
+    }
+  }
+  return result;
+}
+
+uint64_t GameBoard::canonical_zobrist(int* symmetry) const {
+  uint64_t hashes[kSymmetries];
+  symmetric_zobrists(hashes);
+  int best = 0;
+  for (int i = 1; i < kSymmetries; ++i)
+    if (hashes[i] < hashes[best])
+      best = i;
+  if (symmetry)
+    *symmetry = best;
+  return hashes[best];
+}
+
+void GameBoard::symmetric_zobrists(uint64_t* hashes) const {
+  if (size_ == kCompactSize) {
+    // Moves the whole word instead.
+    uint64_t words[kSymmetries] = {words_[0]};
+    words[4] = Transpose(words_[0]);
+    for (int symmetry = 0; symmetry < kSymmetries; symmetry += 4) {
+      words[symmetry + 1] = MirrorColumns(words[symmetry]);
+      words[symmetry + 2] = MirrorRows(words[symmetry]);
+      words[symmetry + 3] = MirrorRows(words[symmetry + 1]);
+    }
+    for (int symmetry = 0; symmetry < kSymmetries; ++symmetry)
+      hashes[symmetry] = kZobristKeys.hash_compact(words[symmetry]);
+    return;
+  }
+  std::fill(hashes, hashes + kSymmetries, 0);
+  // The eight images of (row, col) are its row and column, mirrored or not,
+  // in either order.
+  int last = size_ - 1;
+  for (int row = 0; row < size_; ++row) {
+    for (int col = 0; col < size_; ++col) {
+      int exponent = get(row, col);
+      if (!exponent)
+        continue;
+      const uint64_t(*keys)[ZobristKeys::kExponents] = kZobristKeys.keys;
+      hashes[0] ^= keys[nibble(row, col)][exponent];
+      hashes[1] ^= keys[nibble(row, last - col)][exponent];
+      hashes[2] ^= keys[nibble(last - row, col)][exponent];
+      hashes[3] ^= keys[nibble(last - row, last - col)][exponent];
+      hashes[4] ^= keys[nibble(col, row)][exponent];
+      hashes[5] ^= keys[nibble(col, last - row)][exponent];
+      hashes[6] ^= keys[nibble(last - col, row)][exponent];
+      hashes[7] ^= keys[nibble(last - col, last - row)][exponent];
+    }
+  }
+}
+
+bool GameBoard::operator==(const GameBoard& other) const {
+  return size_ == other.size_ &&
+         std::equal(words_, words_ + kMaxSize, other.words_);
+}
+
+int GameBoard::slide_line(uint8_t* line, int length) {
+  int score = 0;
+  int target = 0;
+  bool mergeable = false;
+  for (int i = 0; i < length; ++i) {
+    uint8_t tile = line[i];
+    if (!tile)
+      continue;
+    line[i] = 0;
+    if (mergeable && line[target - 1] == tile && tile < kMaxExponent) {
+      ++line[target - 1];
+      score += 1 << (tile + 1);
+      mergeable = false;
+    } else {
+      line[target++] = tile;
+      mergeable = true;
+    }
+  }
+  return score;
+}
+
+void BoardStats::reset(const GameBoard& board) {
+  size_ = board.size();
+  empty_cells_ = board.empty_cells();
+  max_exponent_ = board.max_exponent();
+  equal_pairs_ = 0;
+  for (int row = 0; row < size_; ++row) {
+    uint64_t bits = board.row_bits(row);
+    equal_pairs_ += MergeablePairs(bits, bits >> 4, CellMask(size_ - 1));
+    if (row + 1 < size_)
+      equal_pairs_ += MergeablePairs(bits, board.row_bits(row + 1),
+                                     CellMask(size_));
+  }
+}
+
+void BoardStats::update(const GameBoard& before, const GameBoard& after,
+                        BoardChange* change) {
+  if (after.compact()) {
+    // Recounting the one word is as cheap as following the changes.
+    static const CompactMasks kMasks[GameBoard::kCompactSize + 1] = {
+        CompactMasksFor(0), CompactMasksFor(1), CompactMasksFor(2),
+        CompactMasksFor(3), CompactMasksFor(4)};
+    const CompactMasks& masks = kMasks[size_];
+    uint64_t bits = after.compact_bits();
+    empty_cells_ = EmptyCells(bits, masks.cells);
+    equal_pairs_ = MergeablePairs(bits, bits >> 4, masks.right) +
+                   MergeablePairs(bits, bits >> 16, masks.lower);
+    while (max_exponent_ < GameBoard::kMaxExponent &&
+           HasExponent(bits, max_exponent_ + 1, masks.cells))
+      ++max_exponent_;
+    if (change) {
+      uint64_t changed = NonzeroNibbles(bits ^ before.compact_bits());
+      change->before = &before;
+      change->rows = 0;
+      for (int row = 0; row < size_; ++row)
+        if (changed >> (16 * row) & 0xffff)
+          change->rows |= 1u << row;
+    }
+    return;
+  }
+
+  uint64_t cells = CellMask(size_);
+  uint64_t pairs = CellMask(size_ - 1);
+  uint32_t rows = 0;
+  for (int row = 0; row < size_; ++row) {
+    uint64_t old_bits = before.row_bits(row);
+    uint64_t new_bits = after.row_bits(row);
+    if (old_bits == new_bits)
+      continue;
+    rows |= 1u << row;
+    empty_cells_ += EmptyCells(new_bits, cells) - EmptyCells(old_bits, cells);
+    equal_pairs_ += MergeablePairs(new_bits, new_bits >> 4, pairs) -
+                    MergeablePairs(old_bits, old_bits >> 4, pairs);
+    // A move makes tiles at most one above the largest one.
+    while (max_exponent_ < GameBoard::kMaxExponent &&
+           HasExponent(new_bits, max_exponent_ + 1, cells))
+      ++max_exponent_;
+  }
+
+  // Recounts the column pairs between rows where either row changed.
+  for (int row = 0; row + 1 < size_; ++row) {
+    if (rows >> row & 3)
+      equal_pairs_ +=
+          MergeablePairs(after.row_bits(row), after.row_bits(row + 1),
+                         cells) -
+          MergeablePairs(before.row_bits(row), before.row_bits(row + 1),
+                         cells);
+  }
+
+  if (change) {
+    change->before = &before;
+    change->rows = rows;
+  }
+}
+
+void MoveHistory::reset(int size, int capacity) {
+  cells_ = size * size;
+  record_ = RecordSize(size);
+  capacity_ = std::max(0, capacity);
+  head_ = 0;
+  count_ = 0;
+  bytes_.clear();
+}
+
+void MoveHistory::grow(int slots) {
+  size_t size = size_t(slots) * record_;
+  if (size <= bytes_.size())
+    return;
+  if (size > bytes_.capacity())
+    bytes_.reserve(std::min(std::max(2 * bytes_.capacity(), size),
+                            size_t(capacity_) * record_));
+  bytes_.resize(size);
+}
+
+void MoveHistory::push(const MoveDelta& delta) {
+  if (!capacity_)
+    return;
+  // Until the ring is full, head_ is at most one past the slots it has.
+  grow(head_ + 1);
+  uint8_t* record = &bytes_[size_t(head_) * record_];
+  uint8_t* occupied = record + 2;
+  uint8_t* merged = occupied + (cells_ + 7) / 8;
+  record[0] = (delta.direction & 3) | (delta.spawn >= 0) << 2 |
+              (delta.spawn_exponent & 0xf) << 3;
+  record[1] = delta.spawn >= 0 ? delta.spawn : 0;
+  std::fill(occupied, record + record_, 0);
+  for (int cell = 0; cell < cells_; ++cell) {
+    occupied[cell >> 3] |= delta.occupied[cell] << (cell & 7);
+    merged[cell >> 3] |= delta.merged[cell] << (cell & 7);
+  }
+  head_ = (head_ + 1) % capacity_;
+  count_ = std::min(count_ + 1, capacity_);
+}
+
+bool MoveHistory::pop(MoveDelta* delta) {
+  if (!count_)
+    return false;
+  head_ = (head_ + capacity_ - 1) % capacity_;
+  --count_;
+  read(head_, delta);
+  return true;
+}
+
+bool MoveHistory::at(int age, MoveDelta* delta) const {
+  if (age < 0 || age >= count_)
+    return false;
+  read((head_ + capacity_ - 1 - age) % capacity_, delta);
+  return true;
+}
+
+void MoveHistory::read(int slot, MoveDelta* delta) const {
+  const uint8_t* record = &bytes_[size_t(slot) * record_];
+  const uint8_t* occupied = record + 2;
+  const uint8_t* merged = occupied + (cells_ + 7) / 8;
+  delta->direction = record[0] & 3;
+  delta->spawn = record[0] >> 2 & 1 ? record[1] : -1;
+  delta->spawn_exponent = record[0] >> 3 & 0xf;
+  delta->occupied.reset();
+  delta->merged.reset();
+  for (int cell = 0; cell < cells_; ++cell) {
+    delta->occupied[cell] = occupied[cell >> 3] >> (cell & 7) & 1;
+    delta->merged[cell] = merged[cell >> 3] >> (cell & 7) & 1;
+  }
+}
+
+void MoveHistory::save(std::string* out) const {
+  int oldest = (head_ + capacity_ - count_) % std::max(capacity_, 1);
+  for (int i = 0; i < count_; ++i) {
+    const uint8_t* record =
+        &bytes_[size_t((oldest + i) % capacity_) * record_];
+    out->append(reinterpret_cast<const char*>(record), record_);
+  }
+}
+
+bool MoveHistory::load(const char* records, int count) {
+  head_ = 0;
+  count_ = 0;
+  int bitmap = (cells_ + 7) / 8;
+  // Bits of the last byte of a bitmap past the cells.
+  uint8_t padding = uint8_t(0xff << (cells_ - 8 * (bitmap - 1)));
+  for (int i = 0; i < count; ++i) {
+    const uint8_t* record =
+        reinterpret_cast<const uint8_t*>(records) + size_t(i) * record_;
+    bool spawned = record[0] >> 2 & 1;
+    if (record[0] >> 7 || (spawned ? record[1] >= cells_ : record[1] != 0) ||
+        record[1 + bitmap] & padding || record[1 + 2 * bitmap] & padding)
+      return false;
+  }
+  grow(count);
+  if (count)
+    std::memcpy(bytes_.data(), records, size_t(count) * record_);
+  head_ = capacity_ ? count % capacity_ : 0;
+  count_ = count;
+  return true;
+}
+
+std::string GameState::save_state() const {
+  std::string result;
+  save_state(&result);
+  return result;
+}
+
+void GameState::save_state(std::string* out) const {
+  InstrumentTimer timer(kSaveStateLatency);
+  int size = board.size();
+  out->clear();
+  out->append("SMGS", 4);
+  PutBytes(out, kStateVersion, 1);
+  PutBytes(out, size, 1);
+  PutBytes(out, over, 1);
+  PutBytes(out, 0, 1);
+  PutBytes(out, uint32_t(options.rand_seed), 4);
+  PutBytes(out, options.max_undo, 4);
+  PutBytes(out, score, 4);
+  PutBytes(out, moves, 4);
+  PutBytes(out, history.count(), 4);
+  PutBytes(out, 0, 4);
+  PutBytes(out, draws, 8);
+  for (int cell = 0; cell < size * size; cell += 2) {
+    int low = board.get(cell / size, cell % size);
+    int high = cell + 1 < size * size ?
+        board.get((cell + 1) / size, (cell + 1) % size) : 0;
+    out->push_back(char(low | high << 4));
+  }
+  history.save(out);
+}
+
+bool GameState::read_options(std::string_view state_string,
+                             GameOptions* options) {
+  const char* data = state_string.data();
+  if (state_string.size() < size_t(kStateHeaderSize) ||
+      state_string.substr(0, 4) != "SMGS" ||
+      GetBytes(data + 4, 1) != kStateVersion)
+    return false;
+  options->game_size = int(GetBytes(data + 5, 1));
+  options->rand_seed = int(uint32_t(GetBytes(data + 8, 4)));
+  options->max_undo = int(GetBytes(data + 12, 4));
+  return true;
+}
+
+bool GameState::load_state(std::string_view state_string) {
+  InstrumentTimer timer(kLoadStateLatency);
+  GameOptions saved = options;
+  if (!read_options(state_string, &saved) || saved.game_size < 1 ||
+      saved.game_size > GameBoard::kMaxSize || saved.max_undo < 0 ||
+      saved.max_undo > kMaxUndo)
+    return false;
+  const char* data = state_string.data();
+  int size = saved.game_size;
+  // Checks the length before the history takes any memory.
+  uint32_t records = uint32_t(GetBytes(data + 24, 4));
+  size_t board_bytes = (size * size + 1) / 2;
+  if (records > uint32_t(saved.max_undo) ||
+      state_string.size() != kStateHeaderSize + board_bytes +
+                             records * size_t(MoveHistory::RecordSize(size)))
+    return false;
+  MoveHistory loaded;
+  loaded.reset(size, saved.max_undo);
+
+  GameBoard loaded_board(size);
+  const char* nibbles = data + kStateHeaderSize;
+  for (int cell = 0; cell < size * size; ++cell) {
+    int exponent = uint8_t(nibbles[cell / 2]) >> (cell % 2 * 4) & 0xf;
+    loaded_board.set(cell / size, cell % size, exponent);
+  }
+  if (!loaded.load(nibbles + board_bytes, int(records)))
+    return false;
+  // Takes back every move on a copy, so undo() only ever sees records that
+  // fit the board.
+  GameBoard undone = loaded_board;
+  MoveDelta delta;
+  for (int age = 0; loaded.at(age, &delta); ++age) {
+    if (!undone.can_revert(delta))
+      return false;
+    undone.revert(delta);
+  }
+
+  options = saved;
+  board = loaded_board;
+  stats.reset(board);
+  history = std::move(loaded);
+  over = GetBytes(data + 6, 1) & 1;
+  score = int(GetBytes(data + 16, 4));
+  moves = int(GetBytes(data + 20, 4));
+  draws = GetBytes(data + 32, 8);
+  return true;
+}
+
+void BoardFeatures::compute(const GameState& state, uint32_t mask) {
+  score = state.score;
+  moves = state.moves;
+  over = state.over;
+  max_exponent = state.stats.max_exponent();
+  empty_cells = state.stats.empty_cells();
+  equal_pairs = state.stats.equal_pairs();
+  if (mask & kTileCountsFeature) {
+    std::fill(tiles, tiles + GameBoard::kMaxExponent + 1, 0);
+    int size = state.board.size();
+    for (int row = 0; row < size; ++row) {
+      uint64_t bits = state.board.row_bits(row);
+      for (int col = 0; col < size; ++col)
+        ++tiles[bits >> (4 * col) & 0xf];
+    }
+  }
+  if (mask & kCornerFeature) {
+    const GameBoard& board = state.board;
+    int last = board.size() - 1;
+    max_in_corner = board.get(0, 0) == max_exponent ||
+                    board.get(0, last) == max_exponent ||
+                    board.get(last, 0) == max_exponent ||
+                    board.get(last, last) == max_exponent;
+  }
+}
+
+void Event::check_batch(const GameState* const* states,
+                        const BoardFeatures* /*features*/, int count,
+                        bool* fired) {
+  for (int i = 0; i < count; ++i)
+    fired[i] = check(*states[i]);
+}
+
+bool MoveMethod::perform(GameBoard* board, Direction direction, int* score) {
+  return board->slide(direction, score);
+}
+
+namespace {
+
+constexpr char kRandomMoveMethod[] = "random";
+constexpr char kGreedyMoveMethod[] = "greedy";
+constexpr char k2048WinEvent[] = "2048";
+constexpr char k4096WinEvent[] = "4096";
+constexpr char k8192WinEvent[] = "8192";
+constexpr char kCornerEvent[] = "corner";
+constexpr char kSplitMixRandomSource[] = "splitmix";
+constexpr char kPhiloxRandomSource[] = "philox";
+
+// Slides toward a random direction that changes the board.
+class RandomMoveMethod:
+    public Register<RandomMoveMethod, MoveMethod, kRandomMoveMethod> {
+ public:
+  const char* info() override {
+    return "Plays a random legal move.";
+  }
+
+  int decide(const GameState& state) override {
+    int legal[kDirections];
+    int count = 0;
+    int moves = state.board.legal_moves();
+    for (int direction = 0; direction < kDirections; ++direction)
+      if (moves >> direction & 1)
+        legal[count++] = direction;
+    if (!count)
+      return -1;
+    uint64_t key = uint64_t(uint32_t(state.options.rand_seed)) << 32 |
+                   uint32_t(state.moves);
+    return legal[Mix(key) % count];
+  }
+};
+
+// Slides toward the direction that scores the most right now.
+class GreedyMoveMethod:
+    public Register<GreedyMoveMethod, MoveMethod, kGreedyMoveMethod> {
+ public:
+  const char* info() override {
+    return "Plays the legal move that merges the most.";
+  }
+
+  int decide(const GameState& state) override {
+    int best = -1;
+    int best_score = -1;
+    for (int direction = 0; direction < kDirections; ++direction) {
+      GameBoard board = state.board;
+      int score = 0;
+      if (board.slide(Direction(direction), &score) && score > best_score) {
+        best = direction;
+        best_score = score;
+      }
+    }
+    return best;
+  }
+};
+
+// Wins once a 2^exponent tile shows up.
+template <int exponent, const char* name>
+class TileWinEvent:
+    public Register<TileWinEvent<exponent, name>, WinEvent, name> {
+ public:
+  const char* info() override {
+    return "Wins on reaching a tile.";
+  }
+
+  bool check(const GameState& state) override {
+    return state.board.max_exponent() >= exponent;
+  }
+
+  bool check_move(const GameState& state, const BoardChange&) override {
+    return state.stats.max_exponent() >= exponent;
+  }
+
+  uint32_t features() override {
+    return kMaxExponentFeature;
+  }
+
+  void check_batch(const GameState* const*, const BoardFeatures* features,
+                   int count, bool* fired) override {
+    for (int i = 0; i < count; ++i)
+      fired[i] = features[i].max_exponent >= exponent;
+  }
+};
+
+template class TileWinEvent<11, k2048WinEvent>;
+template class TileWinEvent<12, k4096WinEvent>;
+template class TileWinEvent<13, k8192WinEvent>;
+
+// Captures boards that keep a largest tile in a corner.
+class CornerEvent: public Register<CornerEvent, Event, kCornerEvent> {
+ public:
+  const char* info() override {
+    return "Captures a largest tile in a corner.";
+  }
+
+  bool check(const GameState& state) override {
+    BoardFeatures features;
+    features.compute(state, kCornerFeature);
+    return features.max_in_corner;
+  }
+
+  uint32_t features() override {
+    return kCornerFeature;
+  }
+
+  void check_batch(const GameState* const*, const BoardFeatures* features,
+                   int count, bool* fired) override {
+    for (int i = 0; i < count; ++i)
+      fired[i] = features[i].max_in_corner;
+  }
+};
+
+// The streams games use by default.
+class SplitMixRandomSource: public Register<SplitMixRandomSource, RandomSource,
+                                            kSplitMixRandomSource> {
+ public:
+  const char* info() override {
+    return "SplitMix64 of seed plus a multiple of the golden ratio.";
+  }
+
+  uint32_t draw(uint64_t seed, uint64_t index) override {
+    return SplitMix(seed, index);
+  }
+};
+
+// Philox4x32-10 with seed as the key and index as the counter. Slower than
+// SplitMix, but passes the strictest statistical tests.
+class PhiloxRandomSource:
+    public Register<PhiloxRandomSource, RandomSource, kPhiloxRandomSource> {
+ public:
+  const char* info() override {
+    return "Philox4x32-10 keyed by seed.";
+  }
+
+  uint32_t draw(uint64_t seed, uint64_t index) override {
+    uint32_t counter[4] = {uint32_t(index), uint32_t(index >> 32), 0, 0};
+    uint32_t key[2] = {uint32_t(seed), uint32_t(seed >> 32)};
+    for (int round = 0; round < 10; ++round) {
+      uint64_t a = uint64_t(0xd2511f53) * counter[0];
+      uint64_t b = uint64_t(0xcd9e8d57) * counter[2];
+      uint32_t next[4] = {uint32_t(b >> 32) ^ counter[1] ^ key[0], uint32_t(b),
+                          uint32_t(a >> 32) ^ counter[3] ^ key[1], uint32_t(a)};
+      std::memcpy(counter, next, sizeof(counter));
+      key[0] += 0x9e3779b9;
+      key[1] += 0xbb67ae85;
+    }
+    return counter[0];
+  }
+};
+
+}  // namespace
+
+namespace {
+
+template <int N>
+bool RegisterSizedGame() {
+  return SizedSquareMergeGame<N>::SetName(SizedSquareMergeGame<N>::Name());
+}
+
+bool RegisterSizedGames() {
+  return RegisterSizedGame<5>() & RegisterSizedGame<6>();
+}
+
+// The handles of the "NxN" games, by N.
+struct SizedGameHandles {
+  SizedGameHandles() {
+    RegisterSizedGames();
+    for (int size = 1; size <= GameBoard::kMaxSize; ++size)
+      handles[size] = SquareMergeGame::Find(std::to_string(size) + "x" +
+                                            std::to_string(size));
+  }
+
+  SquareMergeGame::Handle handles[GameBoard::kMaxSize + 1];
+};
+
+const SizedGameHandles& GetSizedGameHandles() {
+  static const SizedGameHandles sized;
+  return sized;
+}
+
+}  // namespace
+
+SquareMergeGame* SquareMergeGame::Create(const GameOptions& options) {
+  const SizedGameHandles& sized = GetSizedGameHandles();
+  SquareMergeGame* game = nullptr;
+  if (options.game_size >= 1 && options.game_size <= GameBoard::kMaxSize)
+    game = Create(sized.handles[options.game_size], options);
+  return game ? game : new SquareMergeGame(options);
+}
+
+SquareMergeGame* SquareMergeGame::Create(RegisterArena* arena,
+                                         const GameOptions& options) {
+  const SizedGameHandles& sized = GetSizedGameHandles();
+  SquareMergeGame* game = nullptr;
+  if (options.game_size >= 1 && options.game_size <= GameBoard::kMaxSize)
+    game = Create(arena, sized.handles[options.game_size], options);
+  return game ? game : arena->make<SquareMergeGame>(options);
+}
+
+void SquareMergeGame::init(const GameOptions& options) {
+  state.options = options;
+  state.options.max_undo = std::min(options.max_undo, GameState::kMaxUndo);
+  state.board = GameBoard(options.game_size);
+  state.history.reset(state.board.size(), state.options.max_undo);
+  state.draws = 0;
+  spawn();
+  spawn();
+  state.stats.reset(state.board);
+}
+
+bool SquareMergeGame::advance() {
+  if (state.options.move_method) {
+    int direction = state.options.move_method->decide(state);
+    if (direction >= 0 && direction < kDirections)
+      return advance(Direction(direction));
+  }
+  for (const auto& move: state.options.move) {
+    if (move->check()) {
+      if (move->undo()) {
+        undo();
+        break;
+      }
+      int direction = move->direction();
+      if (direction >= 0 && direction < kDirections)
+        return advance(Direction(direction));
+      break;
+    }
+  }
+  return !state.over;
+}
+
+bool SquareMergeGame::advance(Direction direction) {
+  apply(direction);
+  return !state.over;
+}
+
+bool SquareMergeGame::apply(Direction direction, MoveDelta* delta) {
+  InstrumentTimer timer(kAdvanceLatency);
+  if (state.over)
+    return false;
+
+  GameBoard before = state.board;
+  BoardChange change;
+  bool moved = slide(&state.board, direction, &state.score);
+  if (moved) {
+    ++state.moves;
+    bool keep = state.options.max_undo > 0;
+    MoveDelta kept;
+    MoveDelta* record = delta ? delta : keep ? &kept : nullptr;
+    if (record) {
+      state.board.diff(before, direction, record);
+      record->spawn = -1;
+      record->spawn_exponent = 0;
+    }
+    spawn(record);
+    if (Instrument::kEnabled) {
+      // Every merge frees a cell, and the spawn takes one back.
+      Instrument::Count(kMoveCounter);
+      Instrument::Count(kMergeCounter, state.board.empty_cells() + 1 -
+                                           state.stats.empty_cells());
+    }
+    if (keep)
+      state.history.push(*record);
+    bool events = state.options.win_event || state.options.lose_event;
+    state.stats.update(before, state.board, events ? &change : nullptr);
+  } else if (delta) {
+    *delta = MoveDelta();
+  }
+  change.before = &before;
+
+  if (Instrument::kEnabled)
+    Instrument::Count(kEventCheckCounter, bool(state.options.win_event) +
+                                              bool(state.options.lose_event));
+  if (state.options.win_event &&
+      state.options.win_event->check_move(state, change))
+    state.over = true;
+  if (!state.stats.can_slide() ||
+      (state.options.lose_event &&
+       state.options.lose_event->check_move(state, change)))
+    state.over = true;
+  return moved;
+}
+
+bool SquareMergeGame::try_move(Direction direction, int* score) const {
+  if (state.over)
+    return false;
+  // Without a move method the legal slides are known, and cached.
+  if (!score && !state.options.move_method)
+    return state.board.can_slide(direction);
+  GameBoard board = state.board;
+  int gained = 0;
+  bool moved = slide(&board, direction, &gained);
+  if (score)
+    *score = gained;
+  return moved;
+}
+
+bool SquareMergeGame::slide(GameBoard* board, Direction direction,
+                            int* score) const {
+  if (state.options.move_method)
+    return state.options.move_method->perform(board, direction, score);
+  return board->slide(direction, score);
+}
+
+bool SquareMergeGame::undo() {
+  MoveDelta delta;
+  if (!state.history.pop(&delta))
+    return false;
+  Instrument::Count(kUndoCounter);
+  state.score -= state.board.revert(delta);
+  // Taking back a merge can lower the largest tile, so recount.
+  state.stats.reset(state.board);
+  --state.moves;
+  state.over = false;
+  return true;
+}
+
+bool SquareMergeGame::load_state(std::string_view state_string) {
+  GameOptions saved;
+  if (!GameState::read_options(state_string, &saved) ||
+      saved.game_size != state.board.size())
+    return false;
+  return state.load_state(state_string);
+}
+
+const char* SquareMergeGame::text(TextId id) {
+  static const char* const kDefaultTexts[kTextIds] = {
+      "Slide the tiles with the arrow keys. Equal tiles merge into one.",
+      "u undo   n new game   space auto play   i stats   q quit",
+      "Score",
+      "Moves",
+      "Game over!"};
+  const char* text = state.options.text_method
+                         ? state.options.text_method->get_text(id)
+                         : "";
+  return *text ? text : kDefaultTexts[id];
+}
+
+bool SquareMergeGame::spawn(MoveDelta* delta) {
+  int empty = state.board.empty_cells();
+  if (!empty)
+    return false;
+  // One draw per spawn, so a loaded game can resume the stream.
+  uint64_t seed = uint32_t(state.options.rand_seed);
+  uint32_t draw = state.options.random_source
+                      ? state.options.random_source->draw(seed, state.draws)
+                      : RandomSource::SplitMix(seed, state.draws);
+  ++state.draws;
+  int exponent = draw % 10 ? 1 : 2;
+  int target = draw / 10 % empty;
+  int size = state.board.size();
+  for (int row = 0; row < size; ++row) {
+    for (int col = 0; col < size; ++col) {
+      if (!state.board.get(row, col) && !target--) {
+        state.board.set(row, col, exponent);
+        if (delta) {
+          delta->spawn = row * size + col;
+          delta->spawn_exponent = exponent;
+        }
+        Instrument::Count(kSpawnCounter);
+        return true;
+      }
+    }
+  }
+  return false;
+}
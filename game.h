@@ -1,7 +1,11 @@
 #ifndef GAME_H_
 #define GAME_H_
 
+#include <bitset>
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <memory>
@@ -10,8 +14,19 @@
 
 class GameBoard;
 class GameState;
+struct BoardChange;
+struct MoveDelta;
 
-class Move: RegisterBase<Move> {
+// Directions to slide the tiles toward.
+enum Direction {
+  kUp = 0,
+  kDown = 1,
+  kLeft = 2,
+  kRight = 3,
+  kDirections = 4
+};
+
+class Move: public RegisterBase<Move> {
  public:
   virtual const char* info() override {
     return "Type of possible interractions for the game.";
@@ -21,28 +36,111 @@ class Move: RegisterBase<Move> {
   virtual bool check() {
     return false;
   }
+
+  // Returns the direction to slide if this move is a slide, or -1.
+  virtual int direction() {
+    return -1;
+  }
+
+  // Returns true if this move takes back the last move instead.
+  virtual bool undo() {
+    return false;
+  }
 };
 
-class MoveMethod: RegisterBase<MoveMethod> {
+class MoveMethod: public RegisterBase<MoveMethod> {
  public:
   virtual const char* info() override {
     return "The method to perform different moves.";
   }
+
+  // Slides the board toward direction and adds merged values to *score.
+  // Returns false if nothing moved.
+  virtual bool perform(GameBoard* board, Direction direction, int* score);
+
+  // Picks the direction to slide next, or -1 to leave it to the moves.
+  virtual int decide(const GameState&) {
+    return -1;
+  }
 };
 
-class TextMethod: RegisterBase<TextMethod> {
+class BoardEvaluator: public RegisterBase<BoardEvaluator> {
+ public:
+  virtual const char* info() override {
+    return "Values of boards for search-based move methods.";
+  }
+
+  // Value of a board about to spawn its next tile, higher is better.
+  virtual float evaluate(const GameBoard&) {
+    return 0;
+  }
+};
+
+// Texts the game shows, looked up by index instead of by name.
+enum TextId {
+  kHelpText = 0,
+  kKeysText = 1,
+  kScoreText = 2,
+  kMovesText = 3,
+  kGameOverText = 4,
+  kTextIds = 5
+};
+
+// The entries of TextId, e.g. in resource files.
+inline constexpr std::string_view kTextEntries[kTextIds] = {
+    "help", "keys", "score", "moves", "over"};
+
+class TextMethod: public RegisterBase<TextMethod> {
  public:
   virtual const char* info() override {
     return "Versions of all text contents in the game.";
   }
 
-  // Use own texts by a set of custom entries in the game.
-  virtual const char* get_text(std::string entry) {
+  // Use own texts by a set of custom entries in the game. Returns "" for
+  // entries it has no text of.
+  virtual const char* get_text(std::string_view /*entry*/) {
     return "";
   }
+
+  // Same for the texts of the game. Children with a table of them override
+  // it to skip the name.
+  virtual const char* get_text(TextId id) {
+    return get_text(kTextEntries[id]);
+  }
+};
+
+// Features of a game after a move, which events compute once per move
+// together instead of each walking the state. Bits of Event::features().
+enum BoardFeature {
+  kMaxExponentFeature = 1 << 0,
+  kEmptyCellsFeature = 1 << 1,
+  kEqualPairsFeature = 1 << 2,
+  // Needs a pass over the board.
+  kTileCountsFeature = 1 << 3,
+  // Needs a pass over the board.
+  kCornerFeature = 1 << 4
+};
+
+// The features of one game. score, moves and over are always filled, the
+// others only if asked for.
+struct BoardFeatures {
+  int score = 0;
+  int moves = 0;
+  bool over = false;
+  int max_exponent = 0;
+  int empty_cells = 0;
+  int equal_pairs = 0;
+  // Cells by exponent, 0 for empty ones.
+  int tiles[16] = {};
+  // Whether a largest tile sits in a corner.
+  bool max_in_corner = false;
+
+  // Fills the features in mask from state, in at most one pass over the
+  // board.
+  void compute(const GameState& state, uint32_t mask);
 };
 
-class Event: RegisterBase<Event> {
+class Event: public RegisterBase<Event> {
  public:
   virtual const char* info() override {
     return "Different events in the game.";
@@ -50,9 +148,30 @@ class Event: RegisterBase<Event> {
 
   // Returns true if event captured.
   virtual bool check(const GameState&) = 0;
+
+  // The BoardFeature bits that check_batch() reads.
+  virtual uint32_t features() {
+    return 0;
+  }
+
+  // Checks count games at once, setting fired[i] if the event captured game
+  // i. features[i] holds at least features() of states[i]. Events that only
+  // need their features override this with one loop over them. Calls
+  // check(*states[i]) for each game by default.
+  virtual void check_batch(const GameState* const* states,
+                           const BoardFeatures* features, int count,
+                           bool* fired);
+
+  // Same, right after a move that changed the rows in change. Events that
+  // keep running aggregates update them here, or read state.stats, instead
+  // of rescanning the board. Calls check(state) by default.
+  virtual bool check_move(const GameState& state,
+                          const BoardChange& /*change*/) {
+    return check(state);
+  }
 };
 
-class WinEvent: Event {
+class WinEvent: public Event {
  public:
   virtual const char* info() override {
     return "Game winning conditions.";
@@ -64,7 +183,7 @@ class WinEvent: Event {
   }
 };
 
-class LoseEvent: Event {
+class LoseEvent: public Event {
  public:
   virtual const char* info() override {
     return "Game losing conditions.";
@@ -76,7 +195,7 @@ class LoseEvent: Event {
   }
 };
 
-class ScoreEvent: Event {
+class ScoreEvent: public Event {
  public:
   virtual const char* info() override {
     return "Methods to score the game.";
@@ -88,6 +207,29 @@ class ScoreEvent: Event {
   }
 };
 
+// A stream of random 32-bit values per seed, where any value is O(1) to
+// reach from its index alone. Games draw value n of their rand_seed for their
+// n-th spawn, so they need no shared or saved generator state, and a loaded
+// game resumes its stream right where it stopped.
+class RandomSource: public RegisterBase<RandomSource> {
+ public:
+  virtual const char* info() override {
+    return "Counter-based random streams for tile spawns.";
+  }
+
+  // Value index of the stream of seed.
+  virtual uint32_t draw(uint64_t seed, uint64_t index) = 0;
+
+  // The stream used when GameOptions::random_source is not set: SplitMix64
+  // at counter index + 1.
+  static uint32_t SplitMix(uint64_t seed, uint64_t index) {
+    uint64_t x = seed + (index + 1) * 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return uint32_t(x ^ (x >> 31));
+  }
+};
+
 struct GameOptions {
   int rand_seed;
   int game_size;
@@ -97,40 +239,490 @@ struct GameOptions {
   WinEvent::ptr win_event;
   LoseEvent::ptr lose_event;
   std::vector<Move::ptr> move;
+  // SplitMix streams if not set.
+  RandomSource::ptr random_source;
+};
+
+// Zobrist keys of GameBoard tiles, one per nibble of its words and exponent,
+// drawn from SplitMix64 at compile time. Empty cells have key 0. The keys of
+// the 16 nibbles of a compact board are also combined per byte of its word,
+// so its whole hash takes 8 lookups.
+struct ZobristKeys {
+  static constexpr int kNibbles = 256;
+  static constexpr int kExponents = 16;
+  static constexpr int kCompactBytes = 8;
+
+  constexpr ZobristKeys() {
+    for (int nibble = 0; nibble < kNibbles; ++nibble) {
+      for (int exponent = 1; exponent < kExponents; ++exponent) {
+        uint64_t x = uint64_t(nibble * kExponents + exponent) *
+                     0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        keys[nibble][exponent] = x ^ (x >> 31);
+      }
+    }
+    for (int byte = 0; byte < kCompactBytes; ++byte)
+      for (int bits = 0; bits < 256; ++bits)
+        compact[byte][bits] = keys[2 * byte][bits & 0xf] ^
+                              keys[2 * byte + 1][bits >> 4];
+  }
+
+  // Hash of the word of a compact board.
+  constexpr uint64_t hash_compact(uint64_t word) const {
+    uint64_t result = 0;
+    for (int byte = 0; byte < kCompactBytes; ++byte)
+      result ^= compact[byte][(word >> (8 * byte)) & 0xff];
+    return result;
+  }
+
+  uint64_t keys[kNibbles][kExponents] = {};
+  uint64_t compact[kCompactBytes][256] = {};
 };
 
+inline constexpr ZobristKeys kZobristKeys;
+
+// A square board packed as 4-bit tile exponents: 0 is empty, 1 is a "2", 2 is
+// a "4", and so on. Boards up to 4x4 (compact boards) keep all rows in one
+// 64-bit word, 16 bits per row, and slide rows by table lookup. Larger boards
+// keep one row per word. Column slides transpose the words with bit tricks and
+// slide rows instead. Exponents stop at kMaxExponent, and two such tiles do
+// not merge. The legal slides are worked out from the packed words on first
+// use, and cached until the board changes. A Zobrist hash of the tiles is
+// kept up to date by XOR for just the cells that each change touches, or on
+// compact boards from their one word.
 class GameBoard {
  public:
-  std::vector<int> board;
+  static constexpr int kMaxSize = 16;
+  static constexpr int kMaxCells = kMaxSize * kMaxSize;
+  static constexpr int kMaxExponent = 15;
+  static constexpr int kCompactSize = 4;
+  // Rotations and reflections of a square board.
+  static constexpr int kSymmetries = 8;
+
+  explicit GameBoard(int size = kCompactSize);
+
+  int size() const {
+    return size_;
+  }
+
+  bool compact() const {
+    return size_ <= kCompactSize;
+  }
+
+  // Exponent of the tile at (row, col). 0 if empty.
+  int get(int row, int col) const {
+    return (words_[compact() ? 0 : row] >> shift(row, col)) & 0xf;
+  }
+
+  void set(int row, int col, int exponent) {
+    uint64_t& word = words_[compact() ? 0 : row];
+    const uint64_t* keys = kZobristKeys.keys[nibble(row, col)];
+    zobrist_ ^= keys[(word >> shift(row, col)) & 0xf] ^ keys[exponent & 0xf];
+    word &= ~(uint64_t(0xf) << shift(row, col));
+    word |= uint64_t(exponent & 0xf) << shift(row, col);
+    legal_moves_ = -1;
+  }
+
+  // Tile value at (row, col), i.e. 2^exponent, or 0 if empty.
+  int value(int row, int col) const {
+    int exponent = get(row, col);
+    return exponent ? 1 << exponent : 0;
+  }
+
+  // The packed nibbles of a row, column col at bits [4 * col, 4 * col + 4).
+  uint64_t row_bits(int row) const {
+    return compact() ? (words_[0] >> (16 * row)) & 0xffff : words_[row];
+  }
+
+  // All rows of a compact board, 16 bits per row.
+  uint64_t compact_bits() const {
+    return words_[0];
+  }
+
+  void clear();
+
+  int empty_cells() const;
+
+  int max_exponent() const;
+
+  // Slides all tiles toward direction, merging equal neighbours once. Adds
+  // the values of merged tiles to *score if given. Returns false if the board
+  // did not change.
+  bool slide(Direction direction, int* score = nullptr);
+
+  // Bit d is set if sliding toward Direction d would change the board.
+  int legal_moves() const {
+    if (legal_moves_ < 0)
+      legal_moves_ = int8_t(find_legal_moves());
+    return legal_moves_;
+  }
+
+  // Returns true if sliding toward direction would change the board.
+  bool can_slide(Direction direction) const {
+    return legal_moves() >> direction & 1;
+  }
+
+  bool can_slide() const {
+    return legal_moves() != 0;
+  }
+
+  // The board mirrored along its main diagonal.
+  GameBoard transpose() const;
+
+  // A 64-bit hash of the tiles. Distinct compact boards of one size never
+  // collide. Larger boards return zobrist().
+  uint64_t hash() const;
+
+  // Zobrist hash of the tiles, the XOR of kZobristKeys of every tile, so
+  // equal boards of one size hash equal.
+  uint64_t zobrist() const {
+    return zobrist_;
+  }
+
+  // Moves (*row, *col) of a board of size by symmetry: bit 2 transposes,
+  // then bit 0 mirrors the columns and bit 1 the rows. Symmetry 0 keeps it.
+  static void SymmetricCell(int size, int symmetry, int* row, int* col);
+
+  // compact_bits() of a 4x4 board moved by symmetry.
+  static uint64_t SymmetricBits(uint64_t bits, int symmetry);
+
+  // The slide on the moved board that matches sliding toward direction.
+  static Direction SymmetricDirection(Direction direction, int symmetry);
+
+  // The symmetry that moves a board back.
+  static int InverseSymmetry(int symmetry) {
+    return symmetry & 4 ? 4 | (symmetry & 1) << 1 | (symmetry & 2) >> 1
+                        : symmetry;
+  }
+
+  // zobrist() of the board moved by symmetry, in one pass over the tiles
+  // without moving them.
+  uint64_t symmetric_zobrist(int symmetry) const;
+
+  // The least symmetric_zobrist() of all symmetries, the same for boards
+  // that are symmetric to each other. Sets *symmetry, if given, to the one
+  // that gave it. One pass over the tiles as well.
+  uint64_t canonical_zobrist(int* symmetry = nullptr) const;
+
+  // Fills the slide part of *delta, given that sliding before toward
+  // direction gave this board.
+  void diff(const GameBoard& before, Direction direction,
+            MoveDelta* delta) const;
+
+  // Takes back the move described by delta. Returns the score it gained.
+  // delta must pass can_revert().
+  int revert(const MoveDelta& delta);
+
+  // Whether delta fits this board as its last move: its cells are on the
+  // board, its spawn holds the spawned tile, its merged cells hold merged
+  // tiles, and each line had as many tiles before the move as revert()
+  // would put back.
+  bool can_revert(const MoveDelta& delta) const;
+
+  bool operator==(const GameBoard& other) const;
+
+  bool operator!=(const GameBoard& other) const {
+    return !(*this == other);
+  }
+
+  // Reference slide of a line toward line[0]. Returns the merged score.
+  static int slide_line(uint8_t* line, int length);
+
+ private:
+  int shift(int row, int col) const {
+    return compact() ? 16 * row + 4 * col : 4 * col;
+  }
+
+  // Index of the nibble of (row, col) in words_, which keys its tiles in
+  // kZobristKeys.
+  int nibble(int row, int col) const {
+    return compact() ? 4 * row + col : kMaxSize * row + col;
+  }
+
+  // Works out legal_moves() with a few word operations per row.
+  int find_legal_moves() const;
+
+  // Works out zobrist() from all tiles.
+  uint64_t find_zobrist() const;
+
+  // symmetric_zobrist() of every symmetry in *hashes.
+  void symmetric_zobrists(uint64_t* hashes) const;
+
+  int size_;
+  // legal_moves(), or -1 until it is asked for after a change.
+  mutable int8_t legal_moves_ = -1;
+  uint64_t zobrist_ = 0;
+  uint64_t words_[kMaxSize];
+};
+
+namespace std {
+
+template <>
+struct hash<GameBoard> {
+  size_t operator()(const GameBoard& board) const noexcept {
+    return size_t(board.zobrist());
+  }
+};
+
+}  // namespace std
+
+// What one move changed. This is enough to take the move back: the cells
+// that held tiles before the slide, the tiles that came from a merge after
+// it, and the spawned tile. Cells are numbered row * size + col.
+struct MoveDelta {
+  int direction = -1;
+  int spawn = -1;
+  int spawn_exponent = 0;
+  std::bitset<GameBoard::kMaxCells> occupied;
+  std::bitset<GameBoard::kMaxCells> merged;
+};
+
+// What one move changed, for events to look at without rescanning the
+// board.
+struct BoardChange {
+  // The board before the move.
+  const GameBoard* before = nullptr;
+  // Bit row is set if the move changed any tile in that row.
+  uint32_t rows = 0;
+};
+
+// Running aggregates of a board. Moves update them from the rows they
+// changed, so checking whether any slide is left costs a few word operations
+// per changed row instead of trying all four slides.
+class BoardStats {
+ public:
+  // Recounts everything on board.
+  void reset(const GameBoard& board);
+
+  // Goes from before to after by a move, i.e. a slide and spawns, on a board
+  // of the same size. Lists the changed rows in *change if given.
+  void update(const GameBoard& before, const GameBoard& after,
+              BoardChange* change = nullptr);
+
+  int max_exponent() const {
+    return max_exponent_;
+  }
+
+  int empty_cells() const {
+    return empty_cells_;
+  }
+
+  // Adjacent tiles along rows and columns that would merge.
+  int equal_pairs() const {
+    return equal_pairs_;
+  }
+
+  // Same as GameBoard::can_slide().
+  bool can_slide() const {
+    return equal_pairs_ > 0 ||
+           (empty_cells_ > 0 && empty_cells_ < size_ * size_);
+  }
+
+ private:
+  int size_ = 0;
+  int empty_cells_ = 0;
+  int max_exponent_ = 0;
+  int equal_pairs_ = 0;
+};
+
+// The last few moves as a ring buffer of fixed-size records. A record holds
+// the direction and spawn, then one occupied bit and one merged bit per
+// cell, since one slide can move every tile of every line. That is 6 bytes
+// on 4x4 and 66 on 16x16. The ring takes memory as moves come, so a game
+// that made few moves holds few records whatever its capacity.
+class MoveHistory {
+ public:
+  // Bytes of one record on a board of size.
+  static int RecordSize(int size) {
+    return 2 + 2 * ((size * size + 7) / 8);
+  }
+
+  // Drops all moves, and keeps up to capacity moves on a board of size from
+  // now on.
+  void reset(int size, int capacity);
+
+  int count() const {
+    return count_;
+  }
+
+  // Records delta, dropping the oldest move when full.
+  void push(const MoveDelta& delta);
+
+  // Takes out the latest move. Returns false if there is none.
+  bool pop(MoveDelta* delta);
+
+  // Reads the latest move and keeps it. Returns false if there is none.
+  bool last(MoveDelta* delta) const {
+    return at(0, delta);
+  }
+
+  // Reads the move age moves before the latest one. Returns false if there
+  // is none.
+  bool at(int age, MoveDelta* delta) const;
+
+  int record_size() const {
+    return record_;
+  }
+
+  // Appends the raw records to *out, oldest first.
+  void save(std::string* out) const;
+
+  // Replaces the moves by count raw records, oldest first. count must not
+  // exceed the capacity. Returns false and drops all moves if a record has
+  // bits past the cells of the board or a spawn outside them.
+  bool load(const char* records, int count);
+
+ private:
+  // Reads the record at slot into *delta.
+  void read(int slot, MoveDelta* delta) const;
+
+  // Makes bytes_ hold slots records, by doubling up to the whole ring.
+  void grow(int slots);
+
+  int cells_ = 0;
+  int record_ = 0;
+  int capacity_ = 0;
+  int head_ = 0;
+  int count_ = 0;
+  std::vector<uint8_t> bytes_;
 };
 
 class GameState {
  public:
   GameOptions options;
-  std::vector<GameBoard> history;
+  GameBoard board;
+  // Aggregates of board, kept up to date by the game.
+  BoardStats stats;
+  MoveHistory history;
+  int score = 0;
+  int moves = 0;
+  bool over = false;
+  // Values taken from the random stream of options.rand_seed so far.
+  uint64_t draws = 0;
+
+  // Version 2 of the binary state, all little-endian:
+  //   [0, 4)   "SMGS"
+  //   [4]      version
+  //   [5]      game_size
+  //   [6]      1 if over
+  //   [8, 12)  rand_seed
+  //   [12, 16) max_undo
+  //   [16, 20) score
+  //   [20, 24) moves
+  //   [24, 28) number of history records
+  //   [32, 40) draws
+  // then the board as one nibble per cell, two cells per byte, and then the
+  // history records, oldest first.
+  static const int kStateVersion = 2;
+  static const int kStateHeaderSize = 40;
+  // Games keep at most this many moves to undo, whatever their max_undo,
+  // and states that claim more do not load.
+  static constexpr int kMaxUndo = 1 << 16;
+
+  // Returns the binary state. Options other than the numbers above are not
+  // saved, since they belong to the running program.
+  std::string save_state() const;
 
-  const char* save_state();
+  // Same, but reuses the buffer of *out.
+  void save_state(std::string* out) const;
 
-  bool load_state(std::string state_string);
+  // Loads a binary state in place, e.g. straight from a memory mapped file,
+  // without copying it first. Keeps the registered objects of options.
+  // Returns false and keeps the current state if the data is invalid.
+  bool load_state(std::string_view state_string);
+
+  // Reads the numeric options saved in a binary state into *options.
+  static bool read_options(std::string_view state_string,
+                           GameOptions* options);
 };
 
-class SquareMergeGame {
+class SquareMergeGame: public RegisterBase<SquareMergeGame, const GameOptions&> {
  public:
+  using RegisterBase<SquareMergeGame, const GameOptions&>::Create;
+
   SquareMergeGame(const GameOptions& options) {
-    state.options = options;
+    init(options);
   }
+
+  // Creates the game specialized for options.game_size (see sized_game.h) if
+  // one is registered under "<size>x<size>", or a generic game otherwise.
+  // Either slides through options.move_method, if set. Caller takes
+  // ownership.
+  static SquareMergeGame* Create(const GameOptions& options);
+
+  // Same, but creates the game inside arena, which owns it.
+  static SquareMergeGame* Create(RegisterArena* arena,
+                                 const GameOptions& options);
+
+  virtual const char* info() override {
+    return "The square merge game.";
+  }
+
   const GameOptions& options() {
     return state.options;
   }
 
+  const GameState& game_state() const {
+    return state;
+  }
+
+  // Slides toward the direction options.move_method decides, if any.
+  // Otherwise polls the moves once and slides toward the direction of the
+  // first move that captured input. Returns false once the game is over.
   bool advance();
 
-  const char* help();
+  // Slides toward direction and spawns a tile if anything moved. Returns
+  // false once the game is over.
+  bool advance(Direction direction);
+
+  // Same as advance(direction), in place, and fills *delta, if given, with
+  // what the move changed, e.g. on the caller's stack to take it back with
+  // GameBoard::revert(). Returns false if nothing moved, or the game was
+  // already over. Touches no heap: the slide part of the delta is only
+  // worked out if delta is given or options.max_undo > 0, and history only
+  // kept in the latter case.
+  bool apply(Direction direction, MoveDelta* delta = nullptr);
+
+  // Whether sliding toward direction would change the board, and sets
+  // *score, if given, to the score it would gain, without changing the
+  // game. false once the game is over.
+  bool try_move(Direction direction, int* score = nullptr) const;
+
+  // Takes back the last move, up to options.max_undo moves, at most
+  // GameState::kMaxUndo. Returns false if there is nothing to take back.
+  bool undo();
+
+  std::string save_state() const {
+    return state.save_state();
+  }
+
+  // Loads a state saved by a game of the same size, see
+  // GameState::load_state(). Use GameState::read_options() to create a game
+  // that fits another state.
+  bool load_state(std::string_view state_string);
+
+  // The text of id from options.text_method, or the English one if it has
+  // none. Takes no allocation, and no hashing if the method indexes ids.
+  const char* text(TextId id);
+
+  const char* help() {
+    return text(kHelpText);
+  }
 
  protected:
   SquareMergeGame() {}
 
- private:
+  void init(const GameOptions& options);
+
+  // Slides board, the game's own or a copy, toward direction and adds
+  // merged values to *score. Returns false if nothing moved.
+  virtual bool slide(GameBoard* board, Direction direction, int* score) const;
+
+  // Puts a new 2 (or 4 with 10% probability) at a random empty cell, and
+  // records it in *delta if given.
+  bool spawn(MoveDelta* delta = nullptr);
+
   GameState state;
 };
 
@@ -0,0 +1,450 @@
+// File: game_batch.cpp
+//
+// Brief: Struct-of-arrays games.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "game_batch.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GAME_BATCH_X86
+#endif
+
+namespace {
+
+const uint64_t kNibbleLowBits = 0x1111111111111111ULL;
+// The SplitMix64 step.
+const uint64_t kGolden = 0x9e3779b97f4a7c15ULL;
+
+// Slide results of every 16-bit row of a compact board, for one row length.
+// An entry holds the slid row in the low 16 bits, and a quarter of the
+// merged value in the high 16 bits, since merges make 4 or more.
+struct BatchRowTable {
+  explicit BatchRowTable(int length) {
+    uint8_t line[GameBoard::kCompactSize];
+    for (int row = 0; row < (1 << 16); ++row) {
+      for (int i = 0; i < length; ++i)
+        line[i] = (row >> (4 * i)) & 0xf;
+      uint32_t score = GameBoard::slide_line(line, length) / 4;
+      slid[0][row] = score << 16;
+      for (int i = 0; i < length; ++i)
+        slid[0][row] |= line[i] << (4 * i);
+
+      for (int i = 0; i < length; ++i)
+        line[i] = (row >> (4 * (length - 1 - i))) & 0xf;
+      GameBoard::slide_line(line, length);
+      slid[1][row] = score << 16;
+      for (int i = 0; i < length; ++i)
+        slid[1][row] |= line[i] << (4 * (length - 1 - i));
+    }
+  }
+
+  // Toward column 0, and toward the last column.
+  uint32_t slid[2][1 << 16];
+};
+
+template <int length>
+const BatchRowTable& GetBatchRowTable() {
+  static const BatchRowTable table(length);
+  return table;
+}
+
+const BatchRowTable& BatchRowTableFor(int length) {
+  switch (length) {
+    case 1: return GetBatchRowTable<1>();
+    case 2: return GetBatchRowTable<2>();
+    case 3: return GetBatchRowTable<3>();
+    default: return GetBatchRowTable<4>();
+  }
+}
+
+// Transposes a compact board, as in game.cpp.
+uint64_t Transpose(uint64_t x) {
+  uint64_t a1 = x & 0xf0f00f0ff0f00f0fULL;
+  uint64_t a2 = x & 0x0000f0f00000f0f0ULL;
+  uint64_t a3 = x & 0x0f0f00000f0f0000ULL;
+  uint64_t a = a1 | (a2 << 12) | (a3 >> 12);
+  uint64_t b1 = a & 0xff00ff0000ff00ffULL;
+  uint64_t b2 = a & 0x00ff00ff00000000ULL;
+  uint64_t b3 = a & 0x00000000ff00ff00ULL;
+  return b1 | (b2 >> 24) | (b3 << 24);
+}
+
+// SplitMix64 of one step past x, as in game.cpp.
+uint64_t Mix(uint64_t x) {
+  x += kGolden;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// Mix() of x[i] into out[i] for i in [begin, end).
+void MixAll(const uint64_t* x, uint64_t* out, int begin, int end) {
+  for (int i = begin; i < end; ++i)
+    out[i] = Mix(x[i]);
+}
+
+#ifdef GAME_BATCH_X86
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+#define BMI2_TARGET __attribute__((target("bmi2")))
+
+// The low 64 bits of a * b in each lane, from 32-bit multiplies, since AVX2
+// has no 64-bit one.
+AVX2_TARGET inline __m256i Multiply(__m256i a, __m256i b) {
+  __m256i low = _mm256_mul_epu32(a, b);
+  __m256i cross = _mm256_add_epi64(
+      _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+      _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+  return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+// MixAll() of four games per register.
+AVX2_TARGET void MixAllAvx2(const uint64_t* x, uint64_t* out, int begin,
+                            int end) {
+  const __m256i golden = _mm256_set1_epi64x(int64_t(kGolden));
+  const __m256i first = _mm256_set1_epi64x(int64_t(0xbf58476d1ce4e5b9ULL));
+  const __m256i second = _mm256_set1_epi64x(int64_t(0x94d049bb133111ebULL));
+  int i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m256i v = _mm256_add_epi64(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i)), golden);
+    v = Multiply(_mm256_xor_si256(v, _mm256_srli_epi64(v, 30)), first);
+    v = Multiply(_mm256_xor_si256(v, _mm256_srli_epi64(v, 27)), second);
+    v = _mm256_xor_si256(v, _mm256_srli_epi64(v, 31));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), v);
+  }
+  MixAll(x, out, i, end);
+}
+
+#endif
+
+// MixAll() by the widest kernel this CPU supports, checked once with CPUID.
+void BestMixAll(const uint64_t* x, uint64_t* out, int begin, int end) {
+#ifdef GAME_BATCH_X86
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  if (avx2) {
+    MixAllAvx2(x, out, begin, end);
+    return;
+  }
+#endif
+  MixAll(x, out, begin, end);
+}
+
+// The low bit of every nonzero nibble of bits.
+uint64_t NonzeroNibbles(uint64_t bits) {
+  bits |= bits >> 1;
+  bits |= bits >> 2;
+  return bits & kNibbleLowBits;
+}
+
+// The low bit of every empty nibble of bits, within mask.
+uint64_t EmptyNibbles(uint64_t bits, uint64_t mask) {
+  return ~NonzeroNibbles(bits) & kNibbleLowBits & mask;
+}
+
+// The low bit of every nibble of a that would merge with the same nibble of
+// b, within mask.
+uint64_t MergeableNibbles(uint64_t a, uint64_t b, uint64_t mask) {
+  uint64_t full = a & a >> 1;
+  full &= full >> 2;
+  return ~NonzeroNibbles(a ^ b) & NonzeroNibbles(a) & ~full & mask;
+}
+
+// Bit offset of the nibble holding set low bit number rank, counting from 0,
+// given only low bits of nibbles are set. Finds the byte by comparing rank
+// against the running counts of all bytes at once, without branches.
+int SelectNibble(uint64_t low_bits, int rank) {
+  const uint64_t kOnes = 0x0101010101010101ULL;
+  const uint64_t kHighs = 0x8080808080808080ULL;
+  uint64_t bytes = (low_bits + (low_bits >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  uint64_t counts = bytes * kOnes;
+  uint64_t at_most = ((uint64_t(rank) * kOnes | kHighs) - counts) & kHighs;
+  int byte = int((at_most >> 7) * kOnes >> 56);
+  int before = int((counts << 8) >> (8 * byte) & 0xff);
+  int low = int(low_bits >> (8 * byte) & 1);
+  int high = 1 - (low & ~(rank - before));
+  return 8 * byte + 4 * high;
+}
+
+#ifdef GAME_BATCH_X86
+
+// SelectNibble() by one PDEP.
+BMI2_TARGET int SelectNibbleBmi2(uint64_t low_bits, int rank) {
+  return __builtin_ctzll(_pdep_u64(uint64_t(1) << rank, low_bits));
+}
+
+#endif
+
+// SelectNibble() by the fastest way this CPU supports, checked once with
+// CPUID.
+int BestSelectNibble(uint64_t low_bits, int rank) {
+#ifdef GAME_BATCH_X86
+  static const bool bmi2 = __builtin_cpu_supports("bmi2");
+  if (bmi2)
+    return SelectNibbleBmi2(low_bits, rank);
+#endif
+  return SelectNibble(low_bits, rank);
+}
+
+// The direction of a legal mask that the "random" MoveMethod picks when its
+// draw leaves remainder r mod 12, which any count of legal directions
+// divides.
+struct RandomPicks {
+  RandomPicks() {
+    for (int legal = 1; legal < (1 << kDirections); ++legal) {
+      int directions[kDirections];
+      int count = 0;
+      for (int direction = 0; direction < kDirections; ++direction)
+        if (legal >> direction & 1)
+          directions[count++] = direction;
+      for (int r = 0; r < 12; ++r)
+        direction[legal][r] = uint8_t(directions[r % count]);
+    }
+  }
+
+  uint8_t direction[1 << kDirections][12] = {};
+};
+
+// Counts the nibbles of low_bits set, given only their low bits may be.
+int CountNibbles(uint64_t low_bits) {
+  uint64_t bytes = (low_bits + (low_bits >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return int(bytes * 0x0101010101010101ULL >> 56);
+}
+
+// The low bits of the cells of a compact board of size, 16 bits per row,
+// and of the cells that have a right or a lower neighbour.
+struct CompactMasks {
+  explicit CompactMasks(int size) {
+    for (int row = 0; row < size; ++row) {
+      for (int col = 0; col < size; ++col) {
+        uint64_t bit = uint64_t(1) << (16 * row + 4 * col);
+        cells |= bit;
+        if (col + 1 < size)
+          right |= bit;
+        if (row + 1 < size)
+          lower |= bit;
+      }
+    }
+  }
+
+  uint64_t cells = 0;
+  uint64_t right = 0;
+  uint64_t lower = 0;
+};
+
+// Bit d is set if sliding the compact board bits toward Direction d changes
+// it: some tile has an empty cell or an equal tile on that side.
+int CompactLegal(uint64_t bits, const CompactMasks& masks) {
+  uint64_t tiles = NonzeroNibbles(bits);
+  uint64_t empty = ~tiles & masks.cells;
+  uint64_t across = MergeableNibbles(bits, bits >> 4, masks.right);
+  uint64_t along = MergeableNibbles(bits, bits >> 16, masks.lower);
+  uint64_t left = (empty & tiles >> 4 & masks.right) | across;
+  uint64_t right = (tiles & empty >> 4 & masks.right) | across;
+  uint64_t up = (empty & tiles >> 16 & masks.lower) | along;
+  uint64_t down = (tiles & empty >> 16 & masks.lower) | along;
+  return (up != 0) << kUp | (down != 0) << kDown | (left != 0) << kLeft |
+         (right != 0) << kRight;
+}
+
+}  // namespace
+
+GameBatch::GameBatch(int size, const std::vector<int>& seeds)
+    : size_(GameBoard(size).size()),
+      scores_(seeds.size()),
+      moves_(seeds.size()),
+      draws_(seeds.size()),
+      keys_(seeds.size()),
+      picks_(seeds.size()),
+      legal_(seeds.size(), (1 << kDirections) - 1) {
+  for (int seed: seeds)
+    seeds_.push_back(uint32_t(seed));
+  streams_ = seeds_;
+  if (size_ <= GameBoard::kCompactSize) {
+    words_.assign(seeds.size(), 0);
+  } else {
+    boards_.assign(seeds.size(), GameBoard(size_));
+  }
+  for (int game = 0; game < count(); ++game)
+    live_.push_back(game);
+  for (int tile = 0; tile < 2; ++tile) {
+    draw_all();
+    for (int game = 0; game < count(); ++game)
+      spawn(game);
+  }
+  update_legal();
+}
+
+GameBoard GameBatch::board(int game) const {
+  if (!words_.empty()) {
+    GameBoard board(size_);
+    for (int row = 0; row < size_; ++row)
+      for (int col = 0; col < size_; ++col)
+        board.set(row, col, words_[game] >> (16 * row + 4 * col) & 0xf);
+    return board;
+  }
+  return boards_[game];
+}
+
+void GameBatch::get_state(int game, GameState* state) const {
+  state->board = board(game);
+  state->stats.reset(state->board);
+  state->score = scores_[game];
+  state->moves = moves_[game];
+  state->over = over(game);
+}
+
+void GameBatch::set_board(int game, const GameBoard& board) {
+  if (board.size() != size_)
+    return;
+  bool was_over = over(game);
+  if (!words_.empty()) {
+    words_[game] = 0;
+    for (int row = 0; row < size_; ++row)
+      words_[game] |= board.row_bits(row) << (16 * row);
+    legal_[game] = uint8_t(CompactLegal(words_[game], CompactMasks(size_)));
+  } else {
+    boards_[game] = board;
+    legal_[game] = uint8_t(board.legal_moves());
+  }
+  if (was_over && !over(game))
+    live_.insert(std::lower_bound(live_.begin(), live_.end(), game), game);
+  else if (!was_over && over(game))
+    live_.erase(std::lower_bound(live_.begin(), live_.end(), game));
+}
+
+int GameBatch::advance(const int* directions) {
+  draw_all();
+  for (int game: live_)
+    if (directions[game] >= 0 && directions[game] < kDirections &&
+        legal_[game] >> directions[game] & 1)
+      move(game, directions[game]);
+  update_legal();
+  return running();
+}
+
+int GameBatch::advance(Direction direction) {
+  draw_all();
+  for (int game: live_)
+    if (legal_[game] >> direction & 1)
+      move(game, direction);
+  update_legal();
+  return running();
+}
+
+int GameBatch::advance_random() {
+  static const RandomPicks picks;
+  if (live_.empty())
+    return 0;
+  int begin = live_.front();
+  int end = live_.back() + 1;
+  for (int game = begin; game < end; ++game)
+    keys_[game] = seeds_[game] << 32 | uint32_t(moves_[game]);
+  BestMixAll(keys_.data(), picks_.data(), begin, end);
+  draw_all();
+  for (int game: live_)
+    move(game, picks.direction[legal_[game]][picks_[game] % 12]);
+  update_legal();
+  return running();
+}
+
+void GameBatch::draw_all() {
+  if (!live_.empty())
+    BestMixAll(streams_.data(), draws_.data(), live_.front(),
+               live_.back() + 1);
+}
+
+void GameBatch::move(int game, int direction) {
+  bool reverse = direction == kDown || direction == kRight;
+  if (!words_.empty()) {
+    // Picks the rows or the columns without a branch.
+    uint64_t columns = -uint64_t(direction == kUp || direction == kDown);
+    uint64_t word = words_[game];
+    word = (Transpose(word) & columns) | (word & ~columns);
+    const uint32_t* slid = BatchRowTableFor(size_).slid[reverse];
+    uint64_t result = 0;
+    uint32_t gained = 0;
+    for (int row = 0; row < size_; ++row) {
+      uint32_t entry = slid[(word >> (16 * row)) & 0xffff];
+      result |= uint64_t(entry & 0xffff) << (16 * row);
+      gained += entry >> 16;
+    }
+    words_[game] = (Transpose(result) & columns) | (result & ~columns);
+    scores_[game] += 4 * gained;
+  } else {
+    boards_[game].slide(Direction(direction), &scores_[game]);
+  }
+  ++moves_[game];
+  spawn(game);
+}
+
+void GameBatch::spawn(int game) {
+  // The same odds from one draw as SquareMergeGame::spawn(), which draws
+  // only if a cell is empty.
+  if (!words_.empty()) {
+    static const CompactMasks kMasks[GameBoard::kCompactSize + 1] = {
+        CompactMasks(0), CompactMasks(1), CompactMasks(2), CompactMasks(3),
+        CompactMasks(4)};
+    uint64_t empty = EmptyNibbles(words_[game], kMasks[size_].cells);
+    int count = CountNibbles(empty);
+    if (!count)
+      return;
+    uint32_t draw = uint32_t(draws_[game]);
+    streams_[game] += kGolden;
+    int exponent = draw % 10 ? 1 : 2;
+    words_[game] |= uint64_t(exponent)
+                    << BestSelectNibble(empty, draw / 10 % count);
+    return;
+  }
+
+  GameBoard& board = boards_[game];
+  uint64_t cells = (uint64_t(1) << (4 * size_)) - 1;
+  if (size_ == GameBoard::kMaxSize)
+    cells = ~uint64_t(0);
+  int count = 0;
+  for (int row = 0; row < size_; ++row)
+    count += CountNibbles(EmptyNibbles(board.row_bits(row), cells));
+  if (!count)
+    return;
+  uint32_t draw = uint32_t(draws_[game]);
+  streams_[game] += kGolden;
+  int exponent = draw % 10 ? 1 : 2;
+  int target = draw / 10 % count;
+  for (int row = 0; row < size_; ++row) {
+    uint64_t empty = EmptyNibbles(board.row_bits(row), cells);
+    int in_row = CountNibbles(empty);
+    if (target >= in_row) {
+      target -= in_row;
+      continue;
+    }
+    board.set(row, BestSelectNibble(empty, target) / 4, exponent);
+    return;
+  }
+}
+
+void GameBatch::update_legal() {
+  if (words_.empty()) {
+    for (int game: live_)
+      legal_[game] = uint8_t(boards_[game].legal_moves());
+  } else {
+    // One pass of plain word operations over all games, which vectorizes.
+    CompactMasks masks(size_);
+    int games = count();
+    const uint64_t* words = words_.data();
+    uint8_t* legal = legal_.data();
+    for (int game = 0; game < games; ++game)
+      legal[game] = legal[game] ? uint8_t(CompactLegal(words[game], masks)) : 0;
+  }
+
+  size_t kept = 0;
+  for (int game: live_)
+    if (legal_[game])
+      live_[kept++] = game;
+  live_.resize(kept);
+}
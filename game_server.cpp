@@ -0,0 +1,781 @@
+// File: game_server.cpp
+//
+// Brief: Epoll loops of the game server, one per worker thread.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "game_server.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+
+#include "game.h"
+#include "session_store.h"
+
+namespace {
+
+const int kMaxRequestBytes = 16;
+const int kMaxEvents = 256;
+const int kReadBytes = 1 << 16;
+// Input buffer a connection keeps between reads. A burst of pipelined
+// requests grows it for as long as they wait.
+const int kKeptInputBytes = 256;
+// Milliseconds between sweeps of detached and removed sessions.
+const int kSweepMilliseconds = 100;
+
+// Session states. Other workers only ever turn a detached session into a
+// taken one, to move it to their own shard.
+enum SessionState {
+  kLiveSession,
+  kDetachedSession,
+  kTakenSession
+};
+
+void PutBytes(std::string* out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    out->push_back(char(value >> (8 * i)));
+}
+
+uint64_t GetBytes(const uint8_t* data, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i)
+    value |= uint64_t(data[i]) << (8 * i);
+  return value;
+}
+
+// A non-blocking socket listening on port of all addresses, shared with
+// the other workers. Returns -1 on failure.
+int Listen(int port) {
+  int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  int on = 1;
+  int off = 0;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  sockaddr_in6 address = sockaddr_in6();
+  address.sin6_family = AF_INET6;
+  address.sin6_addr = in6addr_any;
+  address.sin6_port = htons(uint16_t(port));
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) ||
+      bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) ||
+      listen(fd, SOMAXCONN)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int BoundPort(int fd) {
+  sockaddr_in6 address = sockaddr_in6();
+  socklen_t size = sizeof(address);
+  if (getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size))
+    return -1;
+  return ntohs(address.sin6_port);
+}
+
+}  // namespace
+
+struct GameServer::Session {
+  std::unique_ptr<SquareMergeGame> game;
+  // The connection the session talks to, -1 while detached.
+  int owner = -1;
+  // The board as of the last reply.
+  GameBoard shown;
+  std::atomic<int> state{kLiveSession};
+  std::chrono::steady_clock::time_point detached;
+  // Changed since the last checkpoint.
+  bool dirty = false;
+};
+
+class GameServer::Worker {
+ public:
+  Worker(const ServerOptions& options, int index,
+         SessionStore<Session>* store, CheckpointWriter* checkpoint)
+      : options_(options), index_(index), store_(store),
+        checkpoint_(checkpoint) {}
+
+  ~Worker();
+
+  // Sets up the sockets of the worker on port. Returns false on failure.
+  bool open(int port);
+
+  int listen_fd() const {
+    return listen_fd_;
+  }
+
+  void start() {
+    thread_ = std::thread([this] { run(); });
+  }
+
+  void stop();
+
+  // Makes the claimed session of id detached, e.g. one recovered from a
+  // checkpoint. Before start() only.
+  void add_detached(uint32_t id, Session* session);
+
+  // Submits the sessions that changed or ended since the last time to the
+  // checkpoint writer. On the thread of the worker, or after stop().
+  void checkpoint();
+
+  void add_to(ServerStats* stats) const {
+    stats->connections += connection_count_.load(std::memory_order_relaxed);
+    stats->sessions += store_->size(index_);
+    stats->requests += request_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Connection {
+    int fd = -1;
+    std::string in;
+    std::string out;
+    // Bytes of out already written.
+    size_t written = 0;
+    // Not read from while too many replies wait.
+    bool paused = false;
+    // What epoll listens for.
+    bool reading = true;
+    bool writing = false;
+    // The peer shut down its side. Closed once the last replies went out.
+    bool eof = false;
+    std::vector<uint32_t> sessions;
+  };
+
+  void run();
+
+  void accept_all();
+
+  // Reads what fd has, and serves every whole request. Returns false if the
+  // connection is to be closed.
+  bool receive(Connection* connection);
+
+  // Returns true if connection is done: the peer stopped sending and has
+  // every reply.
+  static bool done(const Connection& connection) {
+    return connection.eof && connection.out.empty();
+  }
+
+  // Serves and writes until connection->in has no whole request left, or
+  // the replies wait to be read. Returns false if the connection is to be
+  // closed.
+  bool pump(Connection* connection);
+
+  // Serves the whole requests in connection->in, until kMaxPendingBytes of
+  // replies wait. Returns false on malformed framing.
+  bool serve(Connection* connection);
+
+  void serve_one(Connection* connection, int type, const uint8_t* payload,
+                 int size);
+
+  void new_game(Connection* connection, const uint8_t* payload);
+
+  // Gives the detached session of id to connection, moving it from the
+  // shard of another worker if need be.
+  void attach(Connection* connection, uint32_t id);
+
+  // Adds a session of game for connection to the shard of the worker, and
+  // replies with its whole board.
+  void add_session(Connection* connection, SquareMergeGame* game);
+
+  // Removes the session of id, to be saved as ended.
+  void end_session(uint32_t id);
+
+  // Notes that session changed, to be saved by the next checkpoint.
+  void mark_dirty(uint32_t id, Session* session);
+
+  // Ends the detached sessions past options_.detach_seconds, removes the
+  // ones other workers took, and reclaims removed ones.
+  void sweep();
+
+  // Appends the cells of session that differ from the last reply, or all
+  // tiles if full.
+  void reply_update(Connection* connection, uint32_t id, Session* session,
+                    bool full);
+
+  void reply_error(Connection* connection, ServerError error, uint32_t id);
+
+  // Writes what it can of connection->out. Returns false if the connection
+  // is to be closed.
+  bool flush(Connection* connection);
+
+  // Listens for input, output or both per the state of connection.
+  void watch(Connection* connection);
+
+  void close_connection(int fd);
+
+  ServerOptions options_;
+  int index_;
+  int listen_fd_ = -1;
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  std::thread thread_;
+  // Set by stop(), which also wakes the loop through wake_fd_.
+  std::atomic<bool> stopping_{false};
+  SessionStore<Session>* store_;
+  CheckpointWriter* checkpoint_;
+  std::unordered_map<int, Connection> connections_;
+  // Sessions of the shard that no connection talks to.
+  std::vector<uint32_t> detached_;
+  std::chrono::steady_clock::time_point last_sweep_;
+  // Sessions changed since the last checkpoint, and records of ended ones.
+  std::vector<uint32_t> dirty_;
+  std::string records_;
+  std::string state_buffer_;
+  // Every connection reads through it, so that each keeps only the bytes it
+  // received.
+  std::vector<char> read_buffer_ = std::vector<char>(kReadBytes);
+  std::chrono::steady_clock::time_point last_checkpoint_;
+  std::atomic<long long> connection_count_{0};
+  std::atomic<long long> request_count_{0};
+};
+
+GameServer::Worker::~Worker() {
+  stop();
+  for (auto& connection: connections_)
+    close(connection.first);
+  for (int fd: {listen_fd_, epoll_fd_, wake_fd_})
+    if (fd >= 0)
+      close(fd);
+}
+
+bool GameServer::Worker::open(int port) {
+  listen_fd_ = Listen(port);
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (listen_fd_ < 0 || epoll_fd_ < 0 || wake_fd_ < 0)
+    return false;
+  for (int fd: {listen_fd_, wake_fd_}) {
+    epoll_event event = epoll_event();
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event))
+      return false;
+  }
+  return true;
+}
+
+void GameServer::Worker::stop() {
+  if (!thread_.joinable())
+    return;
+  stopping_.store(true, std::memory_order_relaxed);
+  // Without the wake up the loop still sees stopping_ within its timeout.
+  uint64_t one = 1;
+  while (write(wake_fd_, &one, sizeof(one)) < 0 && errno == EINTR)
+    continue;
+  thread_.join();
+}
+
+void GameServer::Worker::add_detached(uint32_t id, Session* session) {
+  session->owner = -1;
+  session->detached = std::chrono::steady_clock::now();
+  session->state.store(kDetachedSession, std::memory_order_relaxed);
+  detached_.push_back(id);
+}
+
+void GameServer::Worker::checkpoint() {
+  for (uint32_t id: dirty_) {
+    Session* session = store_->find(id);
+    // Ended ones are already in records_.
+    if (!session)
+      continue;
+    session->dirty = false;
+    session->game->game_state().save_state(&state_buffer_);
+    CheckpointWriter::AddState(&records_, id, state_buffer_);
+  }
+  dirty_.clear();
+  checkpoint_->submit(std::move(records_));
+  records_.clear();
+  last_checkpoint_ = std::chrono::steady_clock::now();
+}
+
+void GameServer::Worker::run() {
+  epoll_event events[kMaxEvents];
+  int timeout = kSweepMilliseconds;
+  if (checkpoint_)
+    timeout = std::max(1, std::min(timeout, options_.checkpoint_milliseconds));
+  for (;;) {
+    int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+    if ((count < 0 && errno != EINTR) ||
+        stopping_.load(std::memory_order_relaxed))
+      return;
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_sweep_ >= std::chrono::milliseconds(kSweepMilliseconds))
+      sweep();
+    if (checkpoint_ && now - last_checkpoint_ >=
+                           std::chrono::milliseconds(
+                               options_.checkpoint_milliseconds))
+      checkpoint();
+    for (int i = 0; i < count; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == wake_fd_)
+        return;
+      if (fd == listen_fd_) {
+        accept_all();
+        continue;
+      }
+      auto found = connections_.find(fd);
+      if (found == connections_.end())
+        continue;
+      Connection* connection = &found->second;
+      bool open = !(events[i].events & EPOLLERR);
+      if (open && (events[i].events & EPOLLOUT))
+        open = flush(connection);
+      // A hang up still leaves the last requests to read.
+      if (open && (events[i].events & (EPOLLIN | EPOLLHUP)))
+        open = receive(connection);
+      // Serves what waited while paused, once the replies drained.
+      if (open && connection->paused)
+        open = pump(connection);
+      if (open && done(*connection))
+        open = false;
+      if (open)
+        watch(connection);
+      else
+        close_connection(fd);
+    }
+  }
+}
+
+void GameServer::Worker::accept_all() {
+  for (;;) {
+    int fd = accept4(listen_fd_, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    epoll_event event = epoll_event();
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event)) {
+      close(fd);
+      continue;
+    }
+    connections_[fd].fd = fd;
+    connection_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool GameServer::Worker::receive(Connection* connection) {
+  while (!connection->eof) {
+    ssize_t bytes = read(connection->fd, read_buffer_.data(), kReadBytes);
+    if (bytes < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    if (bytes == 0) {
+      // The peer is done sending, but may still read the last replies.
+      connection->eof = true;
+      break;
+    }
+    connection->in.append(read_buffer_.data(), bytes);
+    // Serves each read before the next, so in holds at most one read.
+    if (!pump(connection))
+      return false;
+    if (connection->paused || bytes < kReadBytes)
+      break;
+  }
+  return true;
+}
+
+bool GameServer::Worker::pump(Connection* connection) {
+  // All replies to what was read go out in one write, unless they fill the
+  // pending bytes first.
+  do {
+    if (!serve(connection) || !flush(connection))
+      return false;
+  } while (connection->paused &&
+           connection->out.size() < size_t(kMaxPendingBytes));
+  return true;
+}
+
+bool GameServer::Worker::serve(Connection* connection) {
+  const uint8_t* data =
+      reinterpret_cast<const uint8_t*>(connection->in.data());
+  size_t size = connection->in.size();
+  size_t offset = 0;
+  bool valid = true;
+  while (size - offset >= 2) {
+    if (connection->out.size() >= size_t(kMaxPendingBytes))
+      break;
+    int length = int(GetBytes(data + offset, 2));
+    if (length < 1 || length > kMaxRequestBytes) {
+      valid = false;
+      break;
+    }
+    if (size - offset < size_t(2 + length))
+      break;
+    serve_one(connection, data[offset + 2], data + offset + 3, length - 1);
+    offset += 2 + length;
+  }
+  connection->in.erase(0, offset);
+  connection->paused = valid && connection->in.size() >= 2 &&
+                       connection->out.size() >= size_t(kMaxPendingBytes);
+  if (!connection->paused &&
+      connection->in.capacity() > size_t(kKeptInputBytes))
+    connection->in.shrink_to_fit();
+  return valid;
+}
+
+void GameServer::Worker::serve_one(Connection* connection, int type,
+                                   const uint8_t* payload, int size) {
+  request_count_.fetch_add(1, std::memory_order_relaxed);
+  if (type == kNewGame) {
+    if (size != 7)
+      reply_error(connection, kBadRequest, 0);
+    else
+      new_game(connection, payload);
+    return;
+  }
+  if (type < kNewGame || type > kAttach ||
+      size != (type == kMove ? 5 : 4)) {
+    reply_error(connection, kBadRequest, 0);
+    return;
+  }
+  uint32_t id = uint32_t(GetBytes(payload, 4));
+  if (type == kAttach) {
+    attach(connection, id);
+    return;
+  }
+  Session* session = nullptr;
+  if (store_->ShardOf(id) == index_)
+    session = store_->find(id);
+  if (!session || session->owner != connection->fd) {
+    reply_error(connection, kNoSession, id);
+    return;
+  }
+  switch (type) {
+    case kMove:
+      if (payload[4] >= kDirections) {
+        reply_error(connection, kBadRequest, id);
+        return;
+      }
+      session->game->advance(Direction(payload[4]));
+      mark_dirty(id, session);
+      break;
+    case kUndo:
+      session->game->undo();
+      mark_dirty(id, session);
+      break;
+  }
+  reply_update(connection, id, session, type == kBoard);
+  if (type == kEndGame) {
+    end_session(id);
+    auto& ids = connection->sessions;
+    ids.erase(std::find(ids.begin(), ids.end(), id));
+  }
+}
+
+void GameServer::Worker::new_game(Connection* connection,
+                                  const uint8_t* payload) {
+  int game_size = payload[0];
+  if (game_size < 1 || game_size > GameBoard::kMaxSize) {
+    reply_error(connection, kBadRequest, 0);
+    return;
+  }
+  if (int(connection->sessions.size()) >= options_.max_sessions) {
+    reply_error(connection, kSessionLimit, 0);
+    return;
+  }
+  GameOptions options = GameOptions();
+  options.game_size = game_size;
+  options.max_undo = std::min(int(GetBytes(payload + 1, 2)),
+                              options_.max_undo);
+  options.rand_seed = int(uint32_t(GetBytes(payload + 3, 4)));
+  add_session(connection, SquareMergeGame::Create(options));
+}
+
+void GameServer::Worker::attach(Connection* connection, uint32_t id) {
+  if (int(connection->sessions.size()) >= options_.max_sessions) {
+    reply_error(connection, kSessionLimit, id);
+    return;
+  }
+  if (store_->ShardOf(id) == index_) {
+    // Claims it the way other workers do, so only one of them wins it.
+    Session* session = store_->find(id);
+    int detached = kDetachedSession;
+    if (!session || !session->state.compare_exchange_strong(
+                        detached, kLiveSession, std::memory_order_acquire)) {
+      reply_error(connection, kNoSession, id);
+      return;
+    }
+    session->owner = connection->fd;
+    connection->sessions.push_back(id);
+    detached_.erase(std::find(detached_.begin(), detached_.end(), id));
+    reply_update(connection, id, session, true);
+    return;
+  }
+
+  // Takes the session from its worker, which removes it on its next sweep,
+  // and plays on from its saved state here.
+  std::string state;
+  {
+    Epoch::Guard guard;
+    Session* session = store_->find(id);
+    int detached = kDetachedSession;
+    if (!session || !session->state.compare_exchange_strong(
+                        detached, kTakenSession, std::memory_order_acquire)) {
+      reply_error(connection, kNoSession, id);
+      return;
+    }
+    session->game->game_state().save_state(&state);
+  }
+  GameOptions options = GameOptions();
+  std::unique_ptr<SquareMergeGame> game;
+  if (GameState::read_options(state, &options))
+    game.reset(SquareMergeGame::Create(options));
+  if (!game || !game->load_state(state)) {
+    reply_error(connection, kNoSession, id);
+    return;
+  }
+  add_session(connection, game.release());
+}
+
+void GameServer::Worker::add_session(Connection* connection,
+                                     SquareMergeGame* game) {
+  Session* session;
+  uint32_t id = store_->add(index_, &session);
+  if (!id) {
+    delete game;
+    reply_error(connection, kSessionLimit, 0);
+    return;
+  }
+  session->game.reset(game);
+  session->owner = connection->fd;
+  connection->sessions.push_back(id);
+  mark_dirty(id, session);
+  reply_update(connection, id, session, true);
+}
+
+void GameServer::Worker::end_session(uint32_t id) {
+  store_->remove(id);
+  if (checkpoint_)
+    CheckpointWriter::AddEnd(&records_, id);
+}
+
+void GameServer::Worker::mark_dirty(uint32_t id, Session* session) {
+  if (!checkpoint_ || session->dirty)
+    return;
+  session->dirty = true;
+  dirty_.push_back(id);
+}
+
+void GameServer::Worker::sweep() {
+  auto now = std::chrono::steady_clock::now();
+  last_sweep_ = now;
+  auto keep = std::chrono::seconds(options_.detach_seconds);
+  size_t kept = 0;
+  for (uint32_t id: detached_) {
+    Session* session = store_->find(id);
+    int state = kDetachedSession;
+    if (now - session->detached < keep &&
+        session->state.load(std::memory_order_relaxed) == state) {
+      detached_[kept++] = id;
+      continue;
+    }
+    // Expires the session unless another worker took it first. Either way
+    // it is gone from here.
+    session->state.compare_exchange_strong(state, kTakenSession,
+                                           std::memory_order_relaxed);
+    end_session(id);
+  }
+  detached_.resize(kept);
+  store_->reclaim(index_);
+}
+
+void GameServer::Worker::reply_update(Connection* connection, uint32_t id,
+                                      Session* session, bool full) {
+  const GameState& state = session->game->game_state();
+  const GameBoard& board = state.board;
+  int size = board.size();
+  std::string& out = connection->out;
+  size_t start = out.size();
+  PutBytes(&out, 0, 2);
+  PutBytes(&out, kUpdate, 1);
+  PutBytes(&out, id, 4);
+  PutBytes(&out, uint32_t(state.score), 4);
+  PutBytes(&out, uint32_t(state.moves), 4);
+  PutBytes(&out, state.over, 1);
+  PutBytes(&out, size, 1);
+  PutBytes(&out, 0, 2);
+  int cells = 0;
+  for (int row = 0; row < size; ++row) {
+    if (!full && board.row_bits(row) == session->shown.row_bits(row))
+      continue;
+    for (int col = 0; col < size; ++col) {
+      int exponent = board.get(row, col);
+      if (full ? exponent != 0 : exponent != session->shown.get(row, col)) {
+        PutBytes(&out, row * size + col, 1);
+        PutBytes(&out, exponent, 1);
+        ++cells;
+      }
+    }
+  }
+  session->shown = board;
+  size_t length = out.size() - start - 2;
+  out[start] = char(length);
+  out[start + 1] = char(length >> 8);
+  out[start + kFrameHeaderSize + kUpdateHeaderSize - 2] = char(cells);
+  out[start + kFrameHeaderSize + kUpdateHeaderSize - 1] = char(cells >> 8);
+}
+
+void GameServer::Worker::reply_error(Connection* connection,
+                                     ServerError error, uint32_t id) {
+  PutBytes(&connection->out, 6, 2);
+  PutBytes(&connection->out, kError, 1);
+  PutBytes(&connection->out, error, 1);
+  PutBytes(&connection->out, id, 4);
+}
+
+bool GameServer::Worker::flush(Connection* connection) {
+  std::string& out = connection->out;
+  while (connection->written < out.size()) {
+    ssize_t bytes = send(connection->fd, out.data() + connection->written,
+                         out.size() - connection->written, MSG_NOSIGNAL);
+    if (bytes < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return false;
+      break;
+    }
+    connection->written += bytes;
+  }
+  if (connection->written == out.size()) {
+    out.clear();
+    connection->written = 0;
+  } else if (connection->written >= out.size() / 2) {
+    // Keeps the unsent tail from growing without bound.
+    out.erase(0, connection->written);
+    connection->written = 0;
+  }
+  return true;
+}
+
+void GameServer::Worker::watch(Connection* connection) {
+  bool reading = !connection->paused && !connection->eof;
+  bool writing = !connection->out.empty();
+  if (reading == connection->reading && writing == connection->writing)
+    return;
+  epoll_event event = epoll_event();
+  event.events = (reading ? uint32_t(EPOLLIN | EPOLLRDHUP) : 0) |
+                 (writing ? uint32_t(EPOLLOUT) : 0);
+  event.data.fd = connection->fd;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection->fd, &event);
+  connection->reading = reading;
+  connection->writing = writing;
+}
+
+void GameServer::Worker::close_connection(int fd) {
+  auto found = connections_.find(fd);
+  if (found == connections_.end())
+    return;
+  auto now = std::chrono::steady_clock::now();
+  for (uint32_t id: found->second.sessions) {
+    if (options_.detach_seconds <= 0) {
+      end_session(id);
+      continue;
+    }
+    // Publishes the last moves of the game to a worker that takes it.
+    Session* session = store_->find(id);
+    session->owner = -1;
+    session->detached = now;
+    session->state.store(kDetachedSession, std::memory_order_release);
+    detached_.push_back(id);
+  }
+  connection_count_.fetch_sub(1, std::memory_order_relaxed);
+  connections_.erase(found);
+  close(fd);
+}
+
+GameServer::GameServer(const ServerOptions& options): options_(options) {}
+
+GameServer::~GameServer() {
+  stop();
+}
+
+bool GameServer::start() {
+  stop();
+  int threads = options_.threads > 0
+                    ? options_.threads
+                    : int(std::max(1u, std::thread::hardware_concurrency()));
+  threads = std::min(threads, int(kMaxWorkers));
+  port_ = options_.port;
+  store_.reset(new SessionStore<Session>(threads, options_.worker_sessions));
+  if (!options_.checkpoint.directory.empty()) {
+    checkpoint_.reset(new CheckpointWriter);
+    if (!checkpoint_->open(options_.checkpoint)) {
+      stop();
+      return false;
+    }
+  }
+  for (int i = 0; i < threads; ++i) {
+    workers_.emplace_back(
+        new Worker(options_, i, store_.get(), checkpoint_.get()));
+    if (!workers_.back()->open(port_)) {
+      stop();
+      return false;
+    }
+    // Binds the port the first socket got to the rest.
+    port_ = BoundPort(workers_.back()->listen_fd());
+  }
+  if (checkpoint_)
+    RecoverCheckpoints(options_.checkpoint.directory,
+                       [this](uint32_t id, std::string_view state) {
+                         recover(id, state);
+                       });
+  for (auto& worker: workers_)
+    worker->start();
+  return true;
+}
+
+void GameServer::recover(uint32_t id, std::string_view state) {
+  GameOptions options = GameOptions();
+  if (!GameState::read_options(state, &options) || options.game_size < 1 ||
+      options.game_size > GameBoard::kMaxSize)
+    return;
+  std::unique_ptr<SquareMergeGame> game(SquareMergeGame::Create(options));
+  Session* session;
+  if (!game || !game->load_state(state) || !store_->claim(id, &session))
+    return;
+  session->game = std::move(game);
+  workers_[store_->ShardOf(id)]->add_detached(id, session);
+}
+
+void GameServer::stop() {
+  for (auto& worker: workers_) {
+    worker->stop();
+    if (checkpoint_)
+      worker->checkpoint();
+  }
+  if (checkpoint_)
+    checkpoint_->close();
+  workers_.clear();
+  checkpoint_.reset();
+  store_.reset();
+}
+
+ServerStats GameServer::stats() const {
+  ServerStats stats;
+  for (const auto& worker: workers_)
+    worker->add_to(&stats);
+  if (checkpoint_)
+    stats.checkpoint_bytes = checkpoint_->written_bytes();
+  return stats;
+}
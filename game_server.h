@@ -0,0 +1,166 @@
+// File: game_server.h
+//
+// Brief: Hosts many SquareMergeGame sessions over TCP with a compact binary
+//        protocol. Every worker thread runs its own epoll loop on its own
+//        SO_REUSEPORT socket, so the kernel spreads connections over the
+//        workers, and a connection stays on one worker for life. Sessions
+//        live in a SessionStore with one shard per worker, which only that
+//        worker writes, so no lock is taken on the move path. Replies carry
+//        only the cells that a request changed.
+//
+//        The sessions of a closed connection wait detach_seconds for a
+//        kAttach from any connection. A connection on another worker takes
+//        the session out of the shard it was in without a lock, and plays
+//        on from its saved state under a new ID in its own shard.
+//
+//        With a checkpoint directory, each worker saves the sessions that
+//        changed once per checkpoint_milliseconds to a CheckpointWriter,
+//        which writes them behind on a thread of its own, see checkpoint.h.
+//        start() first recovers the sessions saved there as detached ones
+//        under their old IDs, so players attach on as after a closed
+//        connection. A crash loses at most the last window of moves.
+//
+//        Frames both ways, all little-endian:
+//          [0, 2)   bytes that follow these two
+//          [2]      type
+//        then the payload of the type. Requests:
+//          kNewGame   [0] game_size, [1, 3) max_undo, [3, 7) rand_seed
+//          kMove      [0, 4) session, [4] Direction
+//          kUndo      [0, 4) session
+//          kBoard     [0, 4) session, to resend every tile
+//          kEndGame   [0, 4) session
+//          kAttach    [0, 4) session of a closed connection, to play on
+//        Every request gets one reply, in order. Replies:
+//          kUpdate    [0, 4) session, [4, 8) score, [8, 12) moves, [12] 1 if
+//                     over, [13] game_size, [14, 16) number of cells, then
+//                     two bytes per cell: the cell, row * size + col, and its
+//                     tile exponent, 0 if it became empty. A new game or
+//                     kBoard lists all tiles of the board, later replies only
+//                     the cells that changed since the last one. The
+//                     session of kAttach may come back under a new ID.
+//          kError     [0] ServerError, [1, 5) session, 0 for none
+//        Malformed framing closes the connection. A connection that leaves
+//        more than kMaxPendingBytes of replies unread is not read from until
+//        it catches up.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: ServerOptions options;
+//        options.port = 2048;
+//        GameServer server(options);
+//        if (!server.start())
+//          ...
+//        ...
+//        server.stop();
+//
+
+#ifndef GAME_SERVER_H_
+#define GAME_SERVER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "checkpoint.h"
+#include "session_store.h"
+
+enum ServerMessage {
+  kNewGame = 1,
+  kMove = 2,
+  kUndo = 3,
+  kBoard = 4,
+  kEndGame = 5,
+  kAttach = 6,
+  kUpdate = 64,
+  kError = 65
+};
+
+enum ServerError {
+  kBadRequest = 1,
+  kNoSession = 2,
+  kSessionLimit = 3
+};
+
+struct ServerOptions {
+  // 0 picks a free port, see GameServer::port().
+  int port = 2048;
+  // Worker threads, or one per hardware thread if <= 0.
+  int threads = 0;
+  // Upper bound of the max_undo of new games.
+  int max_undo = 64;
+  // Sessions one connection may keep open at once.
+  int max_sessions = 1024;
+  // Sessions one worker may keep, up to SessionStore::kMaxSlots.
+  int worker_sessions = 1 << 16;
+  // Seconds the sessions of a closed connection wait for kAttach, or 0 to
+  // end them with the connection.
+  int detach_seconds = 60;
+  // Where sessions are saved, or an empty directory for nowhere. Sessions
+  // of shards past threads are not recovered.
+  CheckpointOptions checkpoint;
+  // Most milliseconds a change waits to be saved.
+  int checkpoint_milliseconds = 1000;
+};
+
+struct ServerStats {
+  long long connections = 0;
+  long long sessions = 0;
+  long long requests = 0;
+  long long checkpoint_bytes = 0;
+};
+
+class GameServer {
+ public:
+  // One shard of SessionStore each.
+  static const int kMaxWorkers = 1 << 8;
+  static const int kMaxPendingBytes = 1 << 18;
+  // Frame header is the length and the type.
+  static const int kFrameHeaderSize = 3;
+  static const int kUpdateHeaderSize = 16;
+
+  explicit GameServer(const ServerOptions& options);
+  GameServer(const GameServer&) = delete;
+  GameServer& operator=(const GameServer&) = delete;
+
+  ~GameServer();
+
+  // Recovers saved sessions, binds the sockets and starts the workers.
+  // Returns false if a socket or the checkpoint directory cannot be set up,
+  // in which case nothing is left running.
+  bool start();
+
+  // Stops the workers, saves what changed since the last checkpoint, and
+  // closes every connection and session.
+  void stop();
+
+  // The port that start() bound.
+  int port() const {
+    return port_;
+  }
+
+  // Open connections and sessions now, and requests served and checkpoint
+  // bytes written so far, summed over the workers.
+  ServerStats stats() const;
+
+ private:
+  class Worker;
+  struct Session;
+
+  // Adds the session of id saved as state to its worker, detached. Drops it
+  // if the state is invalid or its shard is gone.
+  void recover(uint32_t id, std::string_view state);
+
+  ServerOptions options_;
+  int port_ = 0;
+  // Sessions of all workers, a shard per worker.
+  std::unique_ptr<SessionStore<Session>> store_;
+  // nullptr without a checkpoint directory.
+  std::unique_ptr<CheckpointWriter> checkpoint_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+#endif  // GAME_SERVER_H_
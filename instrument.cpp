@@ -0,0 +1,206 @@
+// File: instrument.cpp
+//
+// Brief: Per-thread counters and latency histograms of the engine.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "instrument.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "register.h"
+
+namespace {
+
+const char* const kCounterNames[kCounters] = {
+    "moves", "merges", "spawns", "undos", "event_checks", "creations"};
+const char* const kLatencyNames[kLatencies] = {
+    "advance", "save_state", "load_state"};
+
+}  // namespace
+
+uint64_t InstrumentHistogram::percentile(double q) const {
+  if (!count)
+    return 0;
+  uint64_t rank = std::min(count - 1, uint64_t(q * count));
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < kBuckets; ++bucket) {
+    seen += buckets[bucket];
+    if (seen > rank)
+      return std::min(max, BucketValue(bucket));
+  }
+  return max;
+}
+
+void InstrumentHistogram::merge(const InstrumentHistogram& other) {
+  for (int bucket = 0; bucket < kBuckets; ++bucket)
+    buckets[bucket] += other.buckets[bucket];
+  count += other.count;
+  total += other.total;
+  max = std::max(max, other.max);
+}
+
+std::string InstrumentStats::report() const {
+  std::ostringstream out;
+  for (int counter = 0; counter < kCounters; ++counter)
+    out << kCounterNames[counter] << " " << counters[counter] << "\n";
+  for (int latency = 0; latency < kLatencies; ++latency) {
+    const InstrumentHistogram& histogram = latencies[latency];
+    std::string name = kLatencyNames[latency];
+    out << name << "_count " << histogram.count << "\n"
+        << name << "_mean_ns "
+        << (histogram.count ? double(histogram.total) / histogram.count : 0)
+        << "\n"
+        << name << "_p50_ns " << histogram.percentile(0.5) << "\n"
+        << name << "_p90_ns " << histogram.percentile(0.9) << "\n"
+        << name << "_p99_ns " << histogram.percentile(0.99) << "\n"
+        << name << "_max_ns " << histogram.max << "\n";
+  }
+  return out.str();
+}
+
+#ifdef GAME_INSTRUMENT
+
+namespace {
+
+// Counts of one thread. Only the thread writes them, with plain loads and
+// stores of relaxed atomics, so snapshots may read them at any time.
+struct ThreadSlots {
+  struct Histogram {
+    std::atomic<uint64_t> buckets[InstrumentHistogram::kBuckets] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> max{0};
+  };
+
+  ThreadSlots();
+
+  ~ThreadSlots();
+
+  void add_to(InstrumentStats* stats) const;
+
+  void reset();
+
+  std::atomic<uint64_t> counters[kCounters] = {};
+  Histogram latencies[kLatencies];
+};
+
+void Add(std::atomic<uint64_t>* slot, uint64_t n) {
+  slot->store(slot->load(std::memory_order_relaxed) + n,
+              std::memory_order_relaxed);
+}
+
+uint64_t Get(const std::atomic<uint64_t>& slot) {
+  return slot.load(std::memory_order_relaxed);
+}
+
+// The slots of live threads, and the sums of exited ones.
+struct AllSlots {
+  std::mutex mutex;
+  std::vector<ThreadSlots*> threads;
+  InstrumentStats exited;
+};
+
+AllSlots& GetAllSlots() {
+  static AllSlots* all = new AllSlots;
+  return *all;
+}
+
+ThreadSlots::ThreadSlots() {
+  AllSlots& all = GetAllSlots();
+  std::lock_guard<std::mutex> lock(all.mutex);
+  all.threads.push_back(this);
+}
+
+ThreadSlots::~ThreadSlots() {
+  AllSlots& all = GetAllSlots();
+  std::lock_guard<std::mutex> lock(all.mutex);
+  add_to(&all.exited);
+  all.threads.erase(std::find(all.threads.begin(), all.threads.end(), this));
+}
+
+void ThreadSlots::add_to(InstrumentStats* stats) const {
+  for (int counter = 0; counter < kCounters; ++counter)
+    stats->counters[counter] += Get(counters[counter]);
+  for (int latency = 0; latency < kLatencies; ++latency) {
+    const Histogram& from = latencies[latency];
+    InstrumentHistogram& to = stats->latencies[latency];
+    for (int bucket = 0; bucket < InstrumentHistogram::kBuckets; ++bucket)
+      to.buckets[bucket] += Get(from.buckets[bucket]);
+    to.count += Get(from.count);
+    to.total += Get(from.total);
+    to.max = std::max(to.max, Get(from.max));
+  }
+}
+
+void ThreadSlots::reset() {
+  for (auto& counter: counters)
+    counter.store(0, std::memory_order_relaxed);
+  for (Histogram& histogram: latencies) {
+    for (auto& bucket: histogram.buckets)
+      bucket.store(0, std::memory_order_relaxed);
+    histogram.count.store(0, std::memory_order_relaxed);
+    histogram.total.store(0, std::memory_order_relaxed);
+    histogram.max.store(0, std::memory_order_relaxed);
+  }
+}
+
+ThreadSlots& GetThreadSlots() {
+  thread_local ThreadSlots slots;
+  return slots;
+}
+
+// Counts the objects of every registry, so register.h needs no counters.
+struct CreationHook {
+  CreationHook() {
+    RegisterHooks::created = [] { Instrument::Count(kCreateCounter); };
+  }
+} g_creation_hook;
+
+}  // namespace
+
+void Instrument::Count(InstrumentCounter counter, uint64_t n) {
+  Add(&GetThreadSlots().counters[counter], n);
+}
+
+void Instrument::Record(InstrumentLatency latency, uint64_t nanoseconds) {
+  ThreadSlots::Histogram& histogram = GetThreadSlots().latencies[latency];
+  Add(&histogram.buckets[InstrumentHistogram::Bucket(nanoseconds)], 1);
+  Add(&histogram.count, 1);
+  Add(&histogram.total, nanoseconds);
+  if (nanoseconds > Get(histogram.max))
+    histogram.max.store(nanoseconds, std::memory_order_relaxed);
+}
+
+InstrumentStats Instrument::Snapshot() {
+  AllSlots& all = GetAllSlots();
+  std::lock_guard<std::mutex> lock(all.mutex);
+  InstrumentStats stats = all.exited;
+  for (const ThreadSlots* slots: all.threads)
+    slots->add_to(&stats);
+  return stats;
+}
+
+void Instrument::Reset() {
+  AllSlots& all = GetAllSlots();
+  std::lock_guard<std::mutex> lock(all.mutex);
+  all.exited = InstrumentStats();
+  for (ThreadSlots* slots: all.threads)
+    slots->reset();
+}
+
+#else
+
+InstrumentStats Instrument::Snapshot() {
+  return InstrumentStats();
+}
+
+void Instrument::Reset() {}
+
+#endif  // GAME_INSTRUMENT
@@ -0,0 +1,337 @@
+// File: ntuple.cpp
+//
+// Brief: N-tuple network lookups, scalar and AVX2, and its weights files.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "ntuple.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NTUPLE_X86
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+const char kWeightsMagic[] = "SMGN";
+
+float LoadRelaxed(const float* weight) {
+  float value;
+  __atomic_load(weight, &value, __ATOMIC_RELAXED);
+  return value;
+}
+
+void StoreRelaxed(float* weight, float value) {
+  __atomic_store(weight, &value, __ATOMIC_RELAXED);
+}
+
+// Sums the symmetries in one fixed order, so every path gets the same bits.
+float SumLanes(const float* lanes) {
+  float sum = 0;
+  for (int lane = 0; lane < NTupleNetwork::kSymmetries; ++lane)
+    sum += lanes[lane];
+  return sum;
+}
+
+bool WriteAll(int fd, const char* data, size_t size) {
+  while (size) {
+    ssize_t bytes = write(fd, data, size);
+    if (bytes < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += bytes;
+    size -= bytes;
+  }
+  return true;
+}
+
+#ifdef NTUPLE_X86
+bool HasAvx2() {
+  static const bool has = __builtin_cpu_supports("avx2");
+  return has;
+}
+#endif
+
+}  // namespace
+
+NTupleNetwork::~NTupleNetwork() {
+  if (mapping_)
+    munmap(mapping_, mapping_size_);
+}
+
+NTupleNetwork* NTupleNetwork::Create(const Tuples& tuples) {
+  std::unique_ptr<NTupleNetwork> network(new NTupleNetwork);
+  network->tuples_ = tuples;
+  if (!network->lay_out())
+    return nullptr;
+  // Zero pages, only backed once written.
+  network->mapping_size_ = network->size_ * sizeof(float);
+  void* mapping = mmap(nullptr, network->mapping_size_,
+                       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+  if (mapping == MAP_FAILED)
+    return nullptr;
+  network->mapping_ = mapping;
+  network->weights_ = static_cast<float*>(mapping);
+  return network.release();
+}
+
+NTupleNetwork::Tuples NTupleNetwork::DefaultTuples() {
+  return {{0, 1, 2, 3}, {4, 5, 6, 7}, {0, 1, 4, 5}, {1, 2, 5, 6},
+          {5, 6, 9, 10}};
+}
+
+NTupleNetwork* NTupleNetwork::Load(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+  struct stat info;
+  if (fstat(fd, &info) || info.st_size < kHeaderAlign) {
+    close(fd);
+    return nullptr;
+  }
+  // Private and writable, so training on goes to fresh pages, not the file.
+  void* mapping = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return nullptr;
+  std::unique_ptr<NTupleNetwork> network(new NTupleNetwork);
+  network->mapping_ = mapping;
+  network->mapping_size_ = info.st_size;
+
+  const uint8_t* data = static_cast<const uint8_t*>(mapping);
+  int tuples = data[5];
+  size_t header = HeaderSize(tuples);
+  if (memcmp(data, kWeightsMagic, 4) || data[4] != kWeightsVersion ||
+      size_t(info.st_size) < header)
+    return nullptr;
+  for (int tuple = 0; tuple < tuples; ++tuple) {
+    const uint8_t* cells = data + 8 + 8 * tuple;
+    if (cells[0] > kMaxTupleCells)
+      return nullptr;
+    network->tuples_.emplace_back(cells + 1, cells + 1 + cells[0]);
+  }
+  if (!network->lay_out() ||
+      size_t(info.st_size) != header + network->size_ * sizeof(float))
+    return nullptr;
+  network->weights_ = reinterpret_cast<float*>(
+      static_cast<char*>(mapping) + header);
+  return network.release();
+}
+
+bool NTupleNetwork::save(const std::string& path) const {
+  std::string header(kWeightsMagic, 4);
+  header.push_back(char(kWeightsVersion));
+  header.push_back(char(tuples_.size()));
+  header.append(2, '\0');
+  for (const auto& tuple: tuples_) {
+    header.push_back(char(tuple.size()));
+    for (int cell = 0; cell < kMaxTupleCells + 1; ++cell)
+      header.push_back(char(cell < int(tuple.size()) ? tuple[cell] : 0));
+  }
+  header.resize(HeaderSize(int(tuples_.size())), '\0');
+
+  // A new file renamed over the old one, which may be mapped right now.
+  std::string temporary = path + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+  if (fd < 0)
+    return false;
+  bool written = WriteAll(fd, header.data(), header.size()) &&
+                 WriteAll(fd, reinterpret_cast<const char*>(weights_),
+                          size_ * sizeof(float));
+  if (close(fd) || !written || rename(temporary.c_str(), path.c_str())) {
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+std::mutex g_default_mutex;
+std::shared_ptr<NTupleNetwork> g_default_network;
+
+}  // namespace
+
+std::shared_ptr<NTupleNetwork> NTupleNetwork::Default() {
+  std::lock_guard<std::mutex> lock(g_default_mutex);
+  if (!g_default_network) {
+    const char* path = getenv("SQUARE_MERGE_WEIGHTS");
+    g_default_network.reset(Load(path ? path : "ntuple.weights"));
+    if (!g_default_network)
+      g_default_network.reset(Create(DefaultTuples()));
+  }
+  return g_default_network;
+}
+
+void NTupleNetwork::SetDefault(std::shared_ptr<NTupleNetwork> network) {
+  std::lock_guard<std::mutex> lock(g_default_mutex);
+  g_default_network = std::move(network);
+}
+
+bool NTupleNetwork::lay_out() {
+  if (tuples_.empty() || tuples_.size() > size_t(kMaxTuples))
+    return false;
+  tables_.clear();
+  size_ = 0;
+  for (const auto& tuple: tuples_) {
+    if (tuple.empty() || tuple.size() > size_t(kMaxTupleCells))
+      return false;
+    Table table = Table();
+    table.cells = int(tuple.size());
+    table.offset = size_;
+    for (int i = 0; i < table.cells; ++i) {
+      if (tuple[i] < 0 || tuple[i] >= 16)
+        return false;
+      for (int symmetry = 0; symmetry < kSymmetries; ++symmetry) {
+        int row = tuple[i] / 4;
+        int col = tuple[i] % 4;
+        GameBoard::SymmetricCell(4, symmetry, &row, &col);
+        int cell = row * 4 + col;
+        table.shifts[i][symmetry] = 4 * (cell % 8);
+        table.high[i][symmetry] = cell >= 8 ? -1 : 0;
+      }
+    }
+    tables_.push_back(table);
+    // 16^cells, a whole number of cache lines.
+    size_ += size_t(1) << (4 * table.cells);
+  }
+  return true;
+}
+
+size_t NTupleNetwork::HeaderSize(int tuples) {
+  return (8 + 8 * size_t(tuples) + kHeaderAlign - 1) / kHeaderAlign *
+         kHeaderAlign;
+}
+
+void NTupleNetwork::index(uint64_t bits,
+                          uint32_t (*indexes)[kSymmetries]) const {
+  uint32_t halves[2] = {uint32_t(bits), uint32_t(bits >> 32)};
+  for (size_t t = 0; t < tables_.size(); ++t) {
+    const Table& table = tables_[t];
+    for (int symmetry = 0; symmetry < kSymmetries; ++symmetry) {
+      uint32_t index = 0;
+      for (int i = table.cells - 1; i >= 0; --i)
+        index = index << 4 |
+                (halves[table.high[i][symmetry] & 1] >>
+                     table.shifts[i][symmetry] & 0xf);
+      indexes[t][symmetry] = index;
+    }
+  }
+}
+
+#ifdef NTUPLE_X86
+
+// The AVX2 lookup, one lane per symmetry: picks the half of the board each
+// cell is in, shifts its tile down and appends it to the index, and then
+// gathers the eight weights of a tuple at once.
+class NTupleAvx2 {
+ public:
+  AVX2_TARGET static float Evaluate(const NTupleNetwork& network,
+                                    uint64_t bits) {
+    __m256i low_half = _mm256_set1_epi32(int32_t(uint32_t(bits)));
+    __m256i high_half = _mm256_set1_epi32(int32_t(uint32_t(bits >> 32)));
+    __m256i tile_mask = _mm256_set1_epi32(0xf);
+    __m256 sum = _mm256_setzero_ps();
+    for (const NTupleNetwork::Table& table: network.tables_) {
+      __m256i index = _mm256_setzero_si256();
+      for (int i = table.cells - 1; i >= 0; --i) {
+        __m256i half = _mm256_blendv_epi8(low_half, high_half,
+                                          Load(table.high[i]));
+        __m256i tile = _mm256_and_si256(
+            _mm256_srlv_epi32(half, Load(table.shifts[i])), tile_mask);
+        index = _mm256_or_si256(_mm256_slli_epi32(index, 4), tile);
+      }
+      sum = _mm256_add_ps(sum, _mm256_i32gather_ps(
+          network.weights_ + table.offset, index, sizeof(float)));
+    }
+    alignas(32) float lanes[NTupleNetwork::kSymmetries];
+    _mm256_store_ps(lanes, sum);
+    return SumLanes(lanes);
+  }
+
+ private:
+  AVX2_TARGET static __m256i Load(const int32_t* lanes) {
+    return _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes));
+  }
+};
+
+#endif  // NTUPLE_X86
+
+float NTupleNetwork::evaluate(uint64_t bits) const {
+#ifdef NTUPLE_X86
+  if (HasAvx2())
+    return NTupleAvx2::Evaluate(*this, bits);
+#endif
+  return evaluate_shared(bits);
+}
+
+float NTupleNetwork::evaluate_shared(uint64_t bits) const {
+  uint32_t indexes[kMaxTuples][kSymmetries];
+  index(bits, indexes);
+  float lanes[kSymmetries] = {};
+  for (size_t t = 0; t < tables_.size(); ++t) {
+    const float* weights = weights_ + tables_[t].offset;
+    for (int symmetry = 0; symmetry < kSymmetries; ++symmetry)
+      lanes[symmetry] += LoadRelaxed(weights + indexes[t][symmetry]);
+  }
+  return SumLanes(lanes);
+}
+
+void NTupleNetwork::update(uint64_t bits, float step) {
+  uint32_t indexes[kMaxTuples][kSymmetries];
+  index(bits, indexes);
+  for (size_t t = 0; t < tables_.size(); ++t) {
+    float* weights = weights_ + tables_[t].offset;
+    for (int symmetry = 0; symmetry < kSymmetries; ++symmetry) {
+      float* weight = weights + indexes[t][symmetry];
+      StoreRelaxed(weight, LoadRelaxed(weight) + step);
+    }
+  }
+}
+
+float NTupleEvaluator::evaluate(const GameBoard& board) {
+  if (board.size() != GameBoard::kCompactSize)
+    return 0;
+  return network_->evaluate(board.compact_bits());
+}
+
+int NTupleMoveMethod::decide(const GameState& state) {
+  const GameBoard& board = state.board;
+  bool valued = board.size() == GameBoard::kCompactSize;
+  int legal = board.legal_moves();
+  int best = -1;
+  float best_value = 0;
+  for (int direction = 0; direction < kDirections; ++direction) {
+    if (!(legal >> direction & 1))
+      continue;
+    GameBoard after = board;
+    int reward = 0;
+    after.slide(Direction(direction), &reward);
+    float value = reward;
+    if (valued)
+      value += network_->evaluate(after.compact_bits());
+    if (best < 0 || value > best_value) {
+      best = direction;
+      best_value = value;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,201 @@
+// File: ntuple.h
+//
+// Brief: An n-tuple network for 4x4 boards, learned by TD(0) instead of
+//        handcrafted. Each tuple is a few cells of the board. Their tile
+//        exponents index the weight table of the tuple, and the value of a
+//        board sums the weights of every tuple over all 8 symmetries of the
+//        board. With AVX2 the 8 symmetries of a tuple are indexed in the
+//        lanes of one register and looked up with one gather.
+//
+//        All weights live in one mapping, each table on a cache line
+//        boundary. A new network maps zero pages, and a saved one maps its
+//        file copy-on-write, so neither reads weights before they are used
+//        and a large model costs no load time. Weights files are, all
+//        little-endian:
+//          [0, 4)   "SMGN"
+//          [4]      version
+//          [5]      tuples
+//          [6, 8)   0
+//        then 8 bytes per tuple, its number of cells and the cells,
+//        row * 4 + col, zero padded to kHeaderAlign bytes, and then the
+//        float weights of each tuple in turn, 16^cells of them.
+//
+//        Training plays greedy games on many threads that update the same
+//        weights with relaxed atomic loads and stores and no lock, racing
+//        updates to one weight losing one of them (Hogwild).
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: Registered as the "ntuple" MoveMethod, which picks the slide of
+//        the best reward plus afterstate value, and as the "ntuple"
+//        BoardEvaluator, e.g. for the leaves of expectimax. Both use
+//        NTupleNetwork::Default(), loaded from $SQUARE_MERGE_WEIGHTS or
+//        ntuple.weights on first use, or an untrained network if neither
+//        is there.
+//
+//            ExpectimaxMoveMethod* ai = new ExpectimaxMoveMethod;
+//            ai->set_evaluator(BoardEvaluator::CreateShared("ntuple"));
+//
+//        Train one with the simulator, see Train() in simulator.h:
+//
+//            std::unique_ptr<NTupleNetwork> network(NTupleNetwork::Create(
+//                NTupleNetwork::DefaultTuples()));
+//            Train(network.get(), options, 0.1f);
+//            network->save("ntuple.weights");
+//
+
+#ifndef NTUPLE_H_
+#define NTUPLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "game.h"
+
+inline constexpr char kNTupleMoveMethod[] = "ntuple";
+inline constexpr char kNTupleEvaluator[] = "ntuple";
+
+class NTupleNetwork {
+ public:
+  static const int kWeightsVersion = 1;
+  static const int kMaxTuples = 32;
+  static const int kMaxTupleCells = 6;
+  static const int kSymmetries = GameBoard::kSymmetries;
+  static const int kHeaderAlign = 64;
+
+  // Tuples of cells, row * 4 + col.
+  using Tuples = std::vector<std::vector<int>>;
+
+  NTupleNetwork(const NTupleNetwork&) = delete;
+  NTupleNetwork& operator=(const NTupleNetwork&) = delete;
+
+  ~NTupleNetwork();
+
+  // A network of tuples with all weights 0. Returns nullptr if there are
+  // more than kMaxTuples, or a tuple is empty, longer than kMaxTupleCells,
+  // or off the board.
+  static NTupleNetwork* Create(const Tuples& tuples);
+
+  // An edge and an inner row, and a corner, an edge and a center 2x2
+  // square, which the symmetries turn into every row, column and square:
+  // 5 tuples of 4 cells, 1.25 MB of weights.
+  static Tuples DefaultTuples();
+
+  // Maps the weights file at path, copy-on-write. Returns nullptr if it
+  // cannot be read or is malformed.
+  static NTupleNetwork* Load(const std::string& path);
+
+  // Writes the weights file. Returns false on failure.
+  bool save(const std::string& path) const;
+
+  // The process-wide network of the registered children, loaded on first
+  // use, see the usage above. Never nullptr.
+  static std::shared_ptr<NTupleNetwork> Default();
+
+  // Replaces Default(), e.g. with a network just trained.
+  static void SetDefault(std::shared_ptr<NTupleNetwork> network);
+
+  const Tuples& tuples() const {
+    return tuples_;
+  }
+
+  // Weights of all tuples.
+  size_t size() const {
+    return size_;
+  }
+
+  // Looked up weights per board.
+  int features() const {
+    return int(tables_.size()) * kSymmetries;
+  }
+
+  // Value of the 4x4 board of GameBoard::compact_bits(), with AVX2 if the
+  // CPU has it. Not while another thread trains the network.
+  float evaluate(uint64_t bits) const;
+
+  // Same without SIMD, reading each weight with a relaxed atomic load, so
+  // it may run while other threads train.
+  float evaluate_shared(uint64_t bits) const;
+
+  // Adds step to every weight that bits looks up, see evaluate_shared().
+  void update(uint64_t bits, float step);
+
+ private:
+  friend class NTupleAvx2;
+
+  // A tuple in the layout AVX2 lanes want: for cell i and symmetry s, the
+  // shift of its tile in its half of the board and whether that is the
+  // high half.
+  struct alignas(32) Table {
+    int32_t shifts[kMaxTupleCells][kSymmetries];
+    int32_t high[kMaxTupleCells][kSymmetries];
+    int cells;
+    size_t offset;
+  };
+
+  NTupleNetwork() {}
+
+  // Lays out tables_ for tuples_ and sets size_. Returns false if tuples_
+  // are invalid.
+  bool lay_out();
+
+  // Fills indexes[t][s], the index of bits in table t under symmetry s.
+  void index(uint64_t bits, uint32_t (*indexes)[kSymmetries]) const;
+
+  static size_t HeaderSize(int tuples);
+
+  Tuples tuples_;
+  std::vector<Table> tables_;
+  size_t size_ = 0;
+  // The mapping, where the weights start at weights_.
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  float* weights_ = nullptr;
+};
+
+class NTupleEvaluator:
+    public Register<NTupleEvaluator, BoardEvaluator, kNTupleEvaluator> {
+ public:
+  NTupleEvaluator(): network_(NTupleNetwork::Default()) {}
+
+  const char* info() override {
+    return "Values boards with an n-tuple network.";
+  }
+
+  void set_network(std::shared_ptr<NTupleNetwork> network) {
+    network_ = std::move(network);
+  }
+
+  // 0 for boards other than 4x4.
+  float evaluate(const GameBoard& board) override;
+
+ private:
+  std::shared_ptr<NTupleNetwork> network_;
+};
+
+class NTupleMoveMethod:
+    public Register<NTupleMoveMethod, MoveMethod, kNTupleMoveMethod> {
+ public:
+  NTupleMoveMethod(): network_(NTupleNetwork::Default()) {}
+
+  const char* info() override {
+    return "Plays the slide of the best reward plus n-tuple value.";
+  }
+
+  void set_network(std::shared_ptr<NTupleNetwork> network) {
+    network_ = std::move(network);
+  }
+
+  // Boards other than 4x4 take the first legal slide.
+  int decide(const GameState& state) override;
+
+ private:
+  std::shared_ptr<NTupleNetwork> network_;
+};
+
+#endif  // NTUPLE_H_
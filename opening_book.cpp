@@ -0,0 +1,207 @@
+// File: opening_book.cpp
+//
+// Brief: Opening book lookups and files.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "opening_book.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+namespace {
+
+const char kBookMagic[] = "SMGB";
+
+// Lays out sorted, from index i on, as the subtree of node k of a 1-based
+// Eytzinger tree in *keys and *directions. Returns the next index.
+size_t LayOut(const std::vector<std::pair<uint64_t, uint8_t>>& sorted,
+              size_t i, size_t k, std::vector<uint64_t>* keys,
+              std::vector<uint8_t>* directions) {
+  if (k > sorted.size())
+    return i;
+  i = LayOut(sorted, i, 2 * k, keys, directions);
+  (*keys)[k - 1] = sorted[i].first;
+  (*directions)[k - 1] = sorted[i].second;
+  return LayOut(sorted, i + 1, 2 * k + 1, keys, directions);
+}
+
+bool WriteAll(int fd, const char* data, size_t size) {
+  while (size) {
+    ssize_t bytes = write(fd, data, size);
+    if (bytes < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += bytes;
+    size -= bytes;
+  }
+  return true;
+}
+
+std::mutex g_default_mutex;
+bool g_default_loaded = false;
+std::shared_ptr<const OpeningBook> g_default_book;
+
+}  // namespace
+
+bool OpeningBook::open(const std::string& path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat info;
+  if (fstat(fd, &info) || info.st_size < kHeaderSize) {
+    ::close(fd);
+    return false;
+  }
+  void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED)
+    return false;
+  const uint8_t* data = static_cast<const uint8_t*>(mapping);
+  uint64_t entries;
+  memcpy(&entries, data + 8, sizeof(entries));
+  if (memcmp(data, kBookMagic, 4) || data[4] != kBookVersion ||
+      entries > (uint64_t(info.st_size) - kHeaderSize) / 9 ||
+      uint64_t(info.st_size) != kHeaderSize + entries * 9) {
+    munmap(mapping, info.st_size);
+    return false;
+  }
+  mapping_ = mapping;
+  mapping_size_ = info.st_size;
+  size_ = entries;
+  keys_ = reinterpret_cast<const uint64_t*>(data + kHeaderSize);
+  directions_ = data + kHeaderSize + 8 * entries;
+  return true;
+}
+
+void OpeningBook::close() {
+  if (mapping_)
+    munmap(mapping_, mapping_size_);
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+  size_ = 0;
+  keys_ = nullptr;
+  directions_ = nullptr;
+}
+
+int OpeningBook::find(const GameBoard& board) const {
+  uint64_t key;
+  int symmetry;
+  if (!size_ || !Canonical(board, &key, &symmetry))
+    return -1;
+  // Descends to the first key not below key: left while above it, and the
+  // trailing right turns undone at the end.
+  const uint64_t* keys = keys_ - 1;
+  size_t k = 1;
+  while (k <= size_) {
+    __builtin_prefetch(keys + 16 * k);
+    k = 2 * k + (keys[k] < key);
+  }
+  k >>= __builtin_ffsll(~k);
+  if (!k || keys[k] != key)
+    return -1;
+  Direction direction = GameBoard::SymmetricDirection(
+      Direction(directions_[k - 1] & 3), GameBoard::InverseSymmetry(symmetry));
+  return board.can_slide(direction) ? direction : -1;
+}
+
+bool OpeningBook::Canonical(const GameBoard& board, uint64_t* key,
+                            int* symmetry) {
+  if (board.size() != GameBoard::kCompactSize)
+    return false;
+  *key = board.compact_bits();
+  *symmetry = 0;
+  for (int i = 1; i < GameBoard::kSymmetries; ++i) {
+    uint64_t bits = GameBoard::SymmetricBits(board.compact_bits(), i);
+    if (bits < *key) {
+      *key = bits;
+      *symmetry = i;
+    }
+  }
+  return true;
+}
+
+std::shared_ptr<const OpeningBook> OpeningBook::Default() {
+  std::lock_guard<std::mutex> lock(g_default_mutex);
+  if (!g_default_loaded) {
+    g_default_loaded = true;
+    const char* path = getenv("SQUARE_MERGE_BOOK");
+    std::shared_ptr<OpeningBook> book(new OpeningBook);
+    if (path && book->open(path))
+      g_default_book = std::move(book);
+  }
+  return g_default_book;
+}
+
+void OpeningBook::SetDefault(std::shared_ptr<const OpeningBook> book) {
+  std::lock_guard<std::mutex> lock(g_default_mutex);
+  g_default_loaded = true;
+  g_default_book = std::move(book);
+}
+
+void OpeningBookWriter::add(const GameBoard& board, Direction direction) {
+  uint64_t key;
+  int symmetry;
+  if (OpeningBook::Canonical(board, &key, &symmetry))
+    entries_.emplace_back(
+        key, uint8_t(GameBoard::SymmetricDirection(direction, symmetry)));
+}
+
+void OpeningBookWriter::merge(const OpeningBookWriter& other) {
+  entries_.insert(entries_.end(), other.entries_.begin(),
+                  other.entries_.end());
+}
+
+bool OpeningBookWriter::write(const std::string& path) const {
+  std::vector<std::pair<uint64_t, uint8_t>> sorted = entries_;
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const std::pair<uint64_t, uint8_t>& a,
+                      const std::pair<uint64_t, uint8_t>& b) {
+                     return a.first < b.first;
+                   });
+  sorted.erase(std::unique(sorted.begin(), sorted.end(),
+                           [](const std::pair<uint64_t, uint8_t>& a,
+                              const std::pair<uint64_t, uint8_t>& b) {
+                             return a.first == b.first;
+                           }),
+               sorted.end());
+  std::vector<uint64_t> keys(sorted.size());
+  std::vector<uint8_t> directions(sorted.size());
+  LayOut(sorted, 0, 1, &keys, &directions);
+
+  char header[OpeningBook::kHeaderSize] = {};
+  memcpy(header, kBookMagic, 4);
+  header[4] = char(OpeningBook::kBookVersion);
+  uint64_t entries = sorted.size();
+  memcpy(header + 8, &entries, sizeof(entries));
+
+  std::string temporary = path + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+  if (fd < 0)
+    return false;
+  bool written =
+      WriteAll(fd, header, sizeof(header)) &&
+      WriteAll(fd, reinterpret_cast<const char*>(keys.data()),
+               keys.size() * sizeof(uint64_t)) &&
+      WriteAll(fd, reinterpret_cast<const char*>(directions.data()),
+               directions.size());
+  if (close(fd) || !written || rename(temporary.c_str(), path.c_str())) {
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
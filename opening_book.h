@@ -0,0 +1,121 @@
+// File: opening_book.h
+//
+// Brief: An opening book of 4x4 positions and the move to play in each,
+//        keyed by the canonical form of the board: the least compact_bits()
+//        of its 8 rotations and reflections, so one entry serves all boards
+//        symmetric to it. Lookups map the board to its canonical form, find
+//        the key, and map the stored move back.
+//
+//        Books are built offline from the decisions of a policy in the
+//        simulator, see BuildOpeningBook() in simulator.h, and mapped into
+//        memory read-only. The keys are stored in Eytzinger order, the
+//        implicit layout of a complete binary search tree, where the next
+//        four levels of a search sit in the same two cache lines and can be
+//        prefetched, all little-endian:
+//          [0, 4)   "SMGB"
+//          [4]      version
+//          [5, 8)   0
+//          [8, 16)  entries
+//          [16, 64) 0
+//        then the 8-byte keys, and then one byte per key, its direction.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: OpeningBookWriter writer;
+//        BuildOpeningBook(options, 30, &writer);
+//        writer.write("opening.book");
+//
+//        std::shared_ptr<OpeningBook> book(new OpeningBook);
+//        book->open("opening.book");
+//        int direction = book->find(state.board);
+//
+//        The expectimax MoveMethod plays from OpeningBook::Default() before
+//        it searches, which reads $SQUARE_MERGE_BOOK on first use.
+//
+
+#ifndef OPENING_BOOK_H_
+#define OPENING_BOOK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "game.h"
+
+class OpeningBook {
+ public:
+  static const int kBookVersion = 1;
+  static const int kHeaderSize = 64;
+
+  OpeningBook() {}
+  OpeningBook(const OpeningBook&) = delete;
+  OpeningBook& operator=(const OpeningBook&) = delete;
+
+  ~OpeningBook() {
+    close();
+  }
+
+  // Maps the book at path. Returns false if it cannot be read or is
+  // malformed.
+  bool open(const std::string& path);
+
+  void close();
+
+  // Number of positions.
+  size_t size() const {
+    return size_;
+  }
+
+  // The direction to slide board toward, or -1 if the board is not in the
+  // book, not 4x4, or that slide would not change it.
+  int find(const GameBoard& board) const;
+
+  // The canonical form of a 4x4 board in *key, and the symmetry that moves
+  // the board to it in *symmetry. Returns false for other sizes.
+  static bool Canonical(const GameBoard& board, uint64_t* key, int* symmetry);
+
+  // The book that move methods play from, loaded from $SQUARE_MERGE_BOOK on
+  // first use. nullptr if there is none.
+  static std::shared_ptr<const OpeningBook> Default();
+
+  // Replaces Default().
+  static void SetDefault(std::shared_ptr<const OpeningBook> book);
+
+ private:
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  size_t size_ = 0;
+  const uint64_t* keys_ = nullptr;
+  const uint8_t* directions_ = nullptr;
+};
+
+// Collects positions and moves for an OpeningBook.
+class OpeningBookWriter {
+ public:
+  // Adds the move toward direction on board, if it is 4x4. The first move
+  // added for a position wins.
+  void add(const GameBoard& board, Direction direction);
+
+  // Adds all positions of other, after the ones here.
+  void merge(const OpeningBookWriter& other);
+
+  // Positions added, counting repeats.
+  size_t size() const {
+    return entries_.size();
+  }
+
+  // Writes the book to path, by way of a new file renamed over it. Returns
+  // false on failure.
+  bool write(const std::string& path) const;
+
+ private:
+  // Canonical keys and directions on the canonical boards.
+  std::vector<std::pair<uint64_t, uint8_t>> entries_;
+};
+
+#endif  // OPENING_BOOK_H_
@@ -6,7 +6,7 @@
 //
 // Author: Pufan He <hpfdf@126.com>
 //
-// Version: 2014/08/21
+// Version: 2026/10/14
 //
 // Usage: Write your own Base class extending
 //            RegisterBase<Base, constructor_arguments_types...>.
@@ -36,6 +36,42 @@
 //                 Base::uptr = std::unique_ptr<Base>;
 //                 Base::ptr = std::shared_ptr<Base>;
 //
+//          static Handle Find(const string& name);
+//          static Base* Create(Handle handle, Argument... args);
+//          >> Resolve a registered name once, then create from the handle
+//             without hashing the name again. Handles stay valid for the
+//             life of the program. They follow their name, creating nullptr
+//             while it is removed and the new child once it is set again.
+//          >> Find returns an empty handle, which only creates nullptr, if
+//             the name is not registered.
+//          >> CreateUnique and CreateShared take handles as well.
+//
+//          static Base* Create(RegisterArena* arena, name or handle, ...);
+//          static Base::ptr CreateShared(RegisterArena* arena, name or
+//                                        handle, ...);
+//          >> Create the child inside arena, which owns it and destroys it
+//             together with everything else in the arena, e.g. when a game
+//             ends. The returned ptr does not own the child, so copying it
+//             does not touch any reference count. Do not delete the child
+//             or use it after arena->clear().
+//
+//          static Base::ptr Shared(name or handle, Argument... args);
+//          >> Return the one child of the name for the whole program,
+//             created with args on first use, for stateless children that
+//             every game can share. It does not follow its name if the name
+//             is removed or set again later.
+//
+//          static Base::ptr Borrow(Base* object);
+//          >> Return a ptr that does not own object.
+//
+//          static void RegisterDeferred();
+//          >> Register the names of children now instead of on the first
+//             lookup, see Register below.
+//
+//          RegisterHooks::created = function;
+//          >> Call function, e.g. a counter, for every object that any Base
+//             creates.
+//
 //          static bool HasChild(const string& name);
 //          >> Return whether a name is registered by any child class of Base.
 //
@@ -69,6 +105,10 @@
 //                 class Child: Register<Child, Base>
 //             The Base class does not register the Child class for create.
 //             However, user may use SetName() later to enable the register.
+//          >> Loading the program only links a stub of the name and the
+//             factory of Child, without allocating or hashing. The names of
+//             Base are registered on the first lookup of any of them, so a
+//             program pays only for the bases it uses.
 //
 //             Child must have constructor functions with all configures of
 //             arguments which aer declared in all RegisterBases extended by
@@ -108,16 +148,121 @@
 #ifndef REGISTER_H_
 #define REGISTER_H_
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <vector>
 #include <string>
 #include <memory>
-#include <unordered_map>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+// Hooks that watch every RegisterBase, e.g. to count what they create. Set
+// them once, before anything is created.
+struct RegisterHooks {
+  // Called for every object Create() makes, if set.
+  static inline void (*created)() = nullptr;
+};
+
+// A bump allocator that owns the objects made in it, e.g. everything one game
+// creates. Destroys the objects in reverse order of creation on clear() or
+// destruction at once, and keeps its blocks for the next objects after
+// clear().
+class RegisterArena {
+ public:
+  explicit RegisterArena(size_t block_size = 4096)
+      : block_size_(block_size) {}
+
+  ~RegisterArena() {
+    clear();
+  }
+
+  RegisterArena(const RegisterArena&) = delete;
+  RegisterArena& operator=(const RegisterArena&) = delete;
+
+  template <class T, typename... Argument>
+  T* make(Argument&&... args) {
+    if (std::is_trivially_destructible<T>::value)
+      return new (allocate(sizeof(T), alignof(T)))
+          T(std::forward<Argument>(args)...);
+    Record* record = new (allocate(sizeof(Record), alignof(Record))) Record;
+    T* object = new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Argument>(args)...);
+    record->destroy = [](void* object) {
+      static_cast<T*>(object)->~T();
+    };
+    record->object = object;
+    record->next = records_;
+    records_ = record;
+    return object;
+  }
+
+  // Returns raw memory, freed by clear() or destruction.
+  void* allocate(size_t size, size_t align) {
+    for (;;) {
+      if (block_ < blocks_.size()) {
+        Block& block = blocks_[block_];
+        uintptr_t base = reinterpret_cast<uintptr_t>(block.memory.get());
+        size_t start = ((base + offset_ + align - 1) & ~(align - 1)) - base;
+        if (start + size <= block.size) {
+          offset_ = start + size;
+          return block.memory.get() + start;
+        }
+        if (block_ + 1 < blocks_.size()) {
+          ++block_;
+          offset_ = 0;
+          continue;
+        }
+      }
+      size_t block_size = std::max(block_size_, size + align);
+      blocks_.push_back(Block{std::unique_ptr<char[]>(new char[block_size]),
+                              block_size});
+      block_ = blocks_.size() - 1;
+      offset_ = 0;
+    }
+  }
+
+  // Destroys all objects and rewinds to the first block.
+  void clear() {
+    while (records_) {
+      Record* record = records_;
+      records_ = record->next;
+      record->destroy(record->object);
+    }
+    block_ = 0;
+    offset_ = 0;
+  }
+
+ private:
+  struct Block {
+    std::unique_ptr<char[]> memory;
+    size_t size;
+  };
+
+  struct Record {
+    void (*destroy)(void*);
+    void* object;
+    Record* next;
+  };
+
+  size_t block_size_;
+  std::vector<Block> blocks_;
+  size_t block_ = 0;
+  size_t offset_ = 0;
+  Record* records_ = nullptr;
+};
 
 template <class Base, typename... Argument>
 struct RegisterCreatorBase {
   virtual Base* Create(Argument...) {
     return nullptr;
   }
+
+  virtual Base* CreateIn(RegisterArena*, Argument...) {
+    return nullptr;
+  }
 };
 
 template <class Child, class Base, typename... Argument>
@@ -125,6 +270,10 @@ struct RegisterCreator: RegisterCreatorBase<Base, Argument...> {
   Base* Create(Argument... args) override {
     return new Child(args...);
   }
+
+  Base* CreateIn(RegisterArena* arena, Argument... args) override {
+    return arena->make<Child>(args...);
+  }
 };
 
 template <class Child, class Base, typename... Argument>
@@ -137,39 +286,212 @@ class RegisterCreatorContainer{
   static RegisterCreator<Child, Base, Argument...> creator_;
 };
 
+// An open-addressing hash map from names to creators, probing linearly.
+// Entries are never moved or erased, a removed name only loses its creator,
+// so the index of an entry is a stable handle of its name.
+template <class Creator>
+class RegisterTable {
+ public:
+  int size() const {
+    return int(entries_.size());
+  }
+
+  // Returns the index of name, or -1 if it has no entry.
+  int find(const std::string& name) const {
+    if (slots_.empty())
+      return -1;
+    size_t hash = Hash(name);
+    size_t mask = slots_.size() - 1;
+    for (size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+      int index = slots_[slot];
+      if (index < 0 ||
+          (entries_[index].hash == hash && entries_[index].name == name))
+        return index;
+    }
+  }
+
+  // Returns the index of name, adding an entry without creator if needed.
+  int insert(const std::string& name) {
+    int index = find(name);
+    if (index >= 0)
+      return index;
+    index = size();
+    entries_.push_back(Entry{name, Hash(name), nullptr});
+    if (2 * entries_.size() > slots_.size())
+      grow();
+    else
+      place(index);
+    return index;
+  }
+
+  const std::string& name(int index) const {
+    return entries_[index].name;
+  }
+
+  Creator* creator(int index) const {
+    return entries_[index].creator;
+  }
+
+  void set_creator(int index, Creator* creator) {
+    entries_[index].creator = creator;
+  }
+
+ private:
+  struct Entry {
+    std::string name;
+    size_t hash;
+    Creator* creator;
+  };
+
+  static size_t Hash(const std::string& name) {
+    return std::hash<std::string>()(name);
+  }
+
+  void place(int index) {
+    size_t mask = slots_.size() - 1;
+    size_t slot = entries_[index].hash & mask;
+    while (slots_[slot] >= 0)
+      slot = (slot + 1) & mask;
+    slots_[slot] = index;
+  }
+
+  // Doubles the slots, keeping them at most half full.
+  void grow() {
+    slots_.assign(std::max<size_t>(16, 2 * slots_.size()), -1);
+    for (int index = 0; index < size(); ++index)
+      place(index);
+  }
+
+  std::vector<Entry> entries_;
+  std::vector<int> slots_;
+};
+
 template <class Base, typename... Argument>
 class RegisterBase {
  public:
   typedef std::unique_ptr<Base> uptr;
   typedef std::shared_ptr<Base> ptr;
-  typedef std::unordered_map<std::string, RegisterCreatorBase<Base, Argument...>*>
-      RegisterTable;
+  typedef RegisterCreatorBase<Base, Argument...> Creator;
+  typedef RegisterTable<Creator> Table;
 
-  static Base* Create(const std::string& name, Argument... args) {
-    if (!creators_.count(name))
+  // A child named before the first lookup, registered by it.
+  struct Stub {
+    const char* name;
+    Creator* (*creator)();
+    // Tells the child its name once registered.
+    void (*named)(const char*);
+    Stub* next;
+  };
+
+  // A registered name resolved by Find().
+  class Handle {
+   public:
+    Handle() {}
+
+   private:
+    friend class RegisterBase;
+
+    explicit Handle(int index): index_(index) {}
+
+    int index_ = -1;
+  };
+
+  static Handle Find(const std::string& name) {
+    int index = creators().find(name);
+    return Handle(index >= 0 && creators().creator(index) ? index : -1);
+  }
+
+  static Base* Create(Handle handle, Argument... args) {
+    if (handle.index_ < 0)
       return nullptr;
-    else
-      return creators_[name]->Create(args...);
+    Creator* creator = creators().creator(handle.index_);
+    if (!creator)
+      return nullptr;
+    if (RegisterHooks::created)
+      RegisterHooks::created();
+    return creator->Create(args...);
+  }
+
+  static Base* Create(const std::string& name, Argument... args) {
+    return Create(Find(name), args...);
   }
 
-  static uptr&& CreateUnique(const std::string& name, Argument... args) {
+  static uptr CreateUnique(Handle handle, Argument... args) {
+    return uptr(Create(handle, args...));
+  }
+
+  static uptr CreateUnique(const std::string& name, Argument... args) {
     return uptr(Create(name, args...));
   }
 
-  static ptr&& CreateShared(const std::string& name, Argument... args) {
+  static ptr CreateShared(Handle handle, Argument... args) {
+    return ptr(Create(handle, args...));
+  }
+
+  static ptr CreateShared(const std::string& name, Argument... args) {
     return ptr(Create(name, args...));
   }
 
+  static Base* Create(RegisterArena* arena, Handle handle,
+                      Argument... args) {
+    if (handle.index_ < 0)
+      return nullptr;
+    Creator* creator = creators().creator(handle.index_);
+    if (!creator)
+      return nullptr;
+    if (RegisterHooks::created)
+      RegisterHooks::created();
+    return creator->CreateIn(arena, args...);
+  }
+
+  static Base* Create(RegisterArena* arena, const std::string& name,
+                      Argument... args) {
+    return Create(arena, Find(name), args...);
+  }
+
+  static ptr CreateShared(RegisterArena* arena, Handle handle,
+                          Argument... args) {
+    return Borrow(Create(arena, handle, args...));
+  }
+
+  static ptr CreateShared(RegisterArena* arena, const std::string& name,
+                          Argument... args) {
+    return Borrow(Create(arena, name, args...));
+  }
+
+  static ptr Shared(Handle handle, Argument... args) {
+    if (handle.index_ < 0 || !creators().creator(handle.index_))
+      return nullptr;
+    std::lock_guard<std::mutex> lock(singletons_mutex());
+    std::vector<uptr>& all = singletons();
+    if (all.size() <= size_t(handle.index_))
+      all.resize(handle.index_ + 1);
+    uptr& singleton = all[handle.index_];
+    if (!singleton)
+      singleton.reset(Create(handle, args...));
+    return Borrow(singleton.get());
+  }
+
+  static ptr Shared(const std::string& name, Argument... args) {
+    return Shared(Find(name), args...);
+  }
+
+  // Returns a ptr that does not own object, which copies without touching
+  // any reference count.
+  static ptr Borrow(Base* object) {
+    return ptr(ptr(), object);
+  }
+
   static bool HasChild(const std::string& name) {
-    return creators_.count(name);
+    return Find(name).index_ >= 0;
   }
 
   static bool RemoveChild(const std::string& name) {
-    if (HasChild(name)) {
-      creators_.erase(creators_.find(name));
-      return true;
-    }
-    return false;
+    Handle handle = Find(name);
+    if (handle.index_ < 0)
+      return false;
+    creators().set_creator(handle.index_, nullptr);
+    return true;
   }
 
   template <class Child>
@@ -177,7 +499,9 @@ class RegisterBase {
     if (!name.empty()) {
       if (HasChild(name))
         return false;
-      creators_[name] = RegisterCreatorContainer<Child, Base>::GetCreator();
+      creators().set_creator(
+          creators().insert(name),
+          RegisterCreatorContainer<Child, Base, Argument...>::GetCreator());
       return true;
     }
     return false;
@@ -185,11 +509,36 @@ class RegisterBase {
 
   static std::vector<std::string> GetChildren() {
     std::vector<std::string> result;
-    for (const auto& it: creators_)
-      result.push_back(it->first);
+    for (int index = 0; index < creators().size(); ++index)
+      if (creators().creator(index))
+        result.push_back(creators().name(index));
+    std::sort(result.begin(), result.end());
     return result;
   }
 
+  // Registers the names deferred so far now, e.g. to time them.
+  static void RegisterDeferred() {
+    creators();
+  }
+
+  // Registers stub on the next lookup. stub lives as long as the program.
+  static void Defer(Stub* stub) {
+    std::lock_guard<std::mutex> lock(stubs_mutex());
+    stub->next = nullptr;
+    if (stubs().load(std::memory_order_relaxed))
+      last_stub()->next = stub;
+    else
+      stubs().store(stub, std::memory_order_release);
+    last_stub() = stub;
+  }
+
+  template <class Child>
+  static Creator* CreatorOf() {
+    return RegisterCreatorContainer<Child, Base, Argument...>::GetCreator();
+  }
+
+  virtual ~RegisterBase() {}
+
   virtual const char* name() {
     return "";
   }
@@ -199,66 +548,122 @@ class RegisterBase {
   }
 
  private:
-  static RegisterTable creators_;
+  // A function-local table, so it exists before any static registration.
+  static Table& creators() {
+    static Table table;
+    if (stubs().load(std::memory_order_acquire))
+      RegisterStubs(&table);
+    return table;
+  }
+
+  // Registers the deferred stubs in order, the first of a name winning as
+  // SetChild() does. Lookups on other threads wait here until all are in.
+  static void RegisterStubs(Table* table) {
+    std::lock_guard<std::mutex> lock(stubs_mutex());
+    while (Stub* stub = stubs().load(std::memory_order_relaxed)) {
+      int index = table->insert(stub->name);
+      if (!table->creator(index)) {
+        table->set_creator(index, stub->creator());
+        stub->named(stub->name);
+      }
+      stubs().store(stub->next, std::memory_order_release);
+    }
+  }
+
+  // Stubs not registered yet, oldest first.
+  static std::atomic<Stub*>& stubs() {
+    static std::atomic<Stub*> stubs{nullptr};
+    return stubs;
+  }
+
+  static Stub*& last_stub() {
+    static Stub* last = nullptr;
+    return last;
+  }
+
+  static std::mutex& stubs_mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  static std::vector<uptr>& singletons() {
+    static std::vector<uptr> singletons;
+    return singletons;
+  }
+
+  static std::mutex& singletons_mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
 };
 
+template <class Child, class Base, const char* Name>
+class Register;
+
 template <class Child, class Base, const char* Name>
 class RegisterActivator {
  public:
   RegisterActivator() {
-    static bool registered = false;
-    if (!registered) {
-      registered = true;
-      if (Name != nullptr)
-        Base::SetChild<Child>(Name);
-    }
+    // Constant initialized, so this only links it.
+    static typename Base::Stub stub = {
+        Name, &Base::template CreatorOf<Child>,
+        &Register<Child, Base, Name>::Named, nullptr};
+    if (Name != nullptr)
+      Base::Defer(&stub);
   }
 };
 
 template <class Child, class Base, const char* Name = nullptr>
 class Register: public Base {
  public:
-  Register() {
-    if (Name != nullptr)
-      name_ = Name;
-    else
-      name_ = "";
-  }
-
   static const char* GetName() {
-    return name_.c_str();
+    return registered_name().c_str();
   }
 
   static bool SetName(const std::string& name) {
-    Base::RemoveChild(name_);
-    if (Base::SetChild<Child>(name)) {
-      name_ = name;
+    Base::RemoveChild(registered_name());
+    if (Base::template SetChild<Child>(name)) {
+      registered_name() = name;
       return true;
     }
     return false;
   }
 
   virtual const char* info() override {
-    return ("Registered sub-class \"" + name_ + "\".").c_str();
+    return ("Registered sub-class \"" + registered_name() + "\".").c_str();
   };
 
   const char* name() override {
-    return name_.c_str();
+    return registered_name().c_str();
   }
 
  private:
-  void activate() {
-    if (Name != nullptr)
-      &activator_;
+  friend class RegisterActivator<Child, Base, Name>;
+
+  // The name, once Base registered its stubs.
+  static std::string& registered_name() {
+    Base::RegisterDeferred();
+    return stored_name();
+  }
+
+  static std::string& stored_name() {
+    static std::string name;
+    return name;
+  }
+
+  static void Named(const char* name) {
+    stored_name() = name;
   }
 
   static RegisterActivator<Child, Base, Name> activator_;
-  static std::string name_;
-};
 
-template <class Base, typename... Argument>
-typename RegisterBase<Base, Argument...>::RegisterTable
-RegisterBase<Base, Argument...>::creators_;
+  // Naming activator_ in a template argument instantiates its definition
+  // along with the class, so named children register before main().
+  template <typename T, T>
+  struct Activate {};
+  typedef Activate<RegisterActivator<Child, Base, Name>&, activator_>
+      activate_;
+};
 
 template <class Child, class Base, typename... Argument>
 RegisterCreator<Child, Base, Argument...>
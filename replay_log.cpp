@@ -0,0 +1,325 @@
+// File: replay_log.cpp
+//
+// Brief: Append-only replay logs and their memory mapped reader.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "replay_log.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const char kLogMagic[] = "SMGR";
+
+void PutBytes(std::string* out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    out->push_back(char(value >> (8 * i)));
+}
+
+uint64_t GetBytes(const uint8_t* data, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i)
+    value |= uint64_t(data[i]) << (8 * i);
+  return value;
+}
+
+std::string FileHeader() {
+  std::string header(kLogMagic, 4);
+  PutBytes(&header, ReplayWriter::kLogVersion, 1);
+  header.append(3, '\0');
+  return header;
+}
+
+// Bytes of the moves of game.
+size_t MoveBytes(const ReplayGame& game) {
+  return game.packed ? (size_t(game.count) + 3) / 4 : game.count;
+}
+
+// Reads the header, the name and the moves of the game record at data into
+// *game, given kGameHeaderSize bytes there. Returns the bytes they take.
+size_t ParseGame(const uint8_t* data, bool packed, ReplayGame* game) {
+  game->rand_seed = int(uint32_t(GetBytes(data, 4)));
+  game->max_undo = int(uint32_t(GetBytes(data + 4, 4)));
+  game->count = uint32_t(GetBytes(data + 8, 4));
+  game->game_size = data[12];
+  size_t name_size = data[13];
+  game->random_source = std::string_view(
+      reinterpret_cast<const char*>(data) + ReplayWriter::kGameHeaderSize,
+      name_size);
+  game->moves = data + ReplayWriter::kGameHeaderSize + name_size;
+  game->packed = packed;
+  return ReplayWriter::kGameHeaderSize + name_size + MoveBytes(*game);
+}
+
+}  // namespace
+
+bool ReplayWriter::open(const std::string& path, bool packed,
+                        int snapshot_interval) {
+  close();
+  packed_ = packed;
+  snapshot_interval_ = std::max(0, snapshot_interval);
+  failed_ = false;
+  file_ = fopen(path.c_str(), "ab+");
+  if (!file_)
+    return false;
+  std::string header = FileHeader();
+  char existing[kFileHeaderSize];
+  rewind(file_);
+  size_t read = fread(existing, 1, kFileHeaderSize, file_);
+  if (read == 0) {
+    failed_ = fwrite(header.data(), 1, header.size(), file_) != header.size();
+  } else if (read != size_t(kFileHeaderSize) ||
+             memcmp(existing, header.data(), kFileHeaderSize)) {
+    fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+  return !failed_;
+}
+
+bool ReplayWriter::add(const GameOptions& options, const uint8_t* moves,
+                       size_t count) {
+  encode(options, moves, count, &chunk_);
+  ++chunk_games_;
+  return chunk_.size() < size_t(kChunkBytes) || flush();
+}
+
+bool ReplayWriter::add_encoded(std::string_view games, int count) {
+  chunk_.append(games.data(), games.size());
+  chunk_games_ += count;
+  return chunk_.size() < size_t(kChunkBytes) || flush();
+}
+
+bool ReplayWriter::close() {
+  if (!file_)
+    return true;
+  flush();
+  failed_ |= fclose(file_) != 0;
+  file_ = nullptr;
+  return !failed_;
+}
+
+void ReplayWriter::encode(const GameOptions& options, const uint8_t* moves,
+                          size_t count, std::string* out) const {
+  size_t record = out->size();
+  std::string_view source;
+  if (options.random_source)
+    source = options.random_source->name();
+  source = source.substr(0, 255);
+  PutBytes(out, uint32_t(options.rand_seed), 4);
+  PutBytes(out, uint32_t(options.max_undo), 4);
+  PutBytes(out, uint32_t(count), 4);
+  PutBytes(out, uint8_t(options.game_size), 1);
+  PutBytes(out, source.size(), 1);
+  out->append(source.data(), source.size());
+  if (!packed_) {
+    out->append(reinterpret_cast<const char*>(moves), count);
+  } else {
+    size_t start = out->size();
+    out->resize(start + (count + 3) / 4);
+    char* packed_moves = &(*out)[start];
+    for (size_t i = 0; i < count; ++i)
+      packed_moves[i / 4] |= char((moves[i] & 3) << (2 * (i % 4)));
+  }
+  if (!snapshot_interval_)
+    return;
+
+  PutBytes(out, uint32_t(snapshot_interval_), 4);
+  if (count < size_t(snapshot_interval_))
+    return;
+  // Plays the record back as the reader will, without history, and keeps
+  // its states with the max_undo of options.
+  ReplayGame game;
+  ParseGame(reinterpret_cast<const uint8_t*>(out->data()) + record,
+            packed_, &game);
+  game.max_undo = 0;
+  RegisterArena arena;
+  SquareMergeGame* played = game.create(&arena);
+  std::string state;
+  std::string snapshots;
+  uint32_t max_undo = std::min(options.max_undo, GameState::kMaxUndo);
+  for (size_t i = 0; played && i < count; ++i) {
+    played->advance(Direction(moves[i] & 3));
+    if ((i + 1) % snapshot_interval_)
+      continue;
+    played->game_state().save_state(&state);
+    for (int byte = 0; byte < 4; ++byte)
+      state[12 + byte] = char(max_undo >> (8 * byte));
+    snapshots.append(state);
+  }
+  out->append(snapshots);
+}
+
+bool ReplayWriter::flush() {
+  if (!file_ || !chunk_games_)
+    return !failed_;
+  std::string header;
+  PutBytes(&header, uint32_t(chunk_games_), 4);
+  PutBytes(&header, uint32_t(chunk_.size()), 4);
+  PutBytes(&header, (packed_ ? kPackedMoves : 0) |
+                        (snapshot_interval_ ? kSnapshots : 0), 1);
+  header.append(3, '\0');
+  failed_ |= fwrite(header.data(), 1, header.size(), file_) != header.size();
+  failed_ |= fwrite(chunk_.data(), 1, chunk_.size(), file_) != chunk_.size();
+  chunk_.clear();
+  chunk_games_ = 0;
+  return !failed_;
+}
+
+void ReplayGame::get_options(GameOptions* options) const {
+  options->rand_seed = rand_seed;
+  options->game_size = game_size;
+  options->max_undo = max_undo;
+  options->random_source.reset();
+  if (!random_source.empty())
+    options->random_source = RandomSource::Shared(std::string(random_source));
+}
+
+SquareMergeGame* ReplayGame::create(RegisterArena* arena) const {
+  GameOptions options = GameOptions();
+  get_options(&options);
+  if (!random_source.empty() && !options.random_source)
+    return nullptr;
+  return SquareMergeGame::Create(arena, options);
+}
+
+SquareMergeGame* ReplayGame::seek(RegisterArena* arena, uint32_t move) const {
+  if (move > count)
+    return nullptr;
+  SquareMergeGame* game = create(arena);
+  if (!game)
+    return nullptr;
+  uint32_t start = 0;
+  if (snapshot_interval && move >= snapshot_interval) {
+    uint32_t i = move / snapshot_interval - 1;
+    if (!game->load_state(snapshot(i)))
+      return nullptr;
+    start = (i + 1) * snapshot_interval;
+  }
+  for (uint32_t i = start; i < move; ++i) {
+    int moves = game->game_state().moves;
+    game->advance(Direction(this->move(i)));
+    if (game->game_state().moves == moves)
+      return nullptr;
+  }
+  return game;
+}
+
+bool ReplayGame::play(SquareMergeGame* game) const {
+  if (!game)
+    return false;
+  for (uint32_t i = 0; i < count; ++i) {
+    int moves = game->game_state().moves;
+    game->advance(Direction(move(i)));
+    if (game->game_state().moves == moves)
+      return false;
+  }
+  return true;
+}
+
+bool ReplayReader::open(const std::string& path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat info;
+  if (fstat(fd, &info) || info.st_size < ReplayWriter::kFileHeaderSize) {
+    ::close(fd);
+    return false;
+  }
+  void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  data_ = static_cast<const uint8_t*>(data);
+  size_ = info.st_size;
+  madvise(data, size_, MADV_SEQUENTIAL);
+
+  std::string header = FileHeader();
+  if (memcmp(data_, header.data(), header.size())) {
+    close();
+    return false;
+  }
+  size_t offset = ReplayWriter::kFileHeaderSize;
+  while (offset < size_) {
+    if (size_ - offset < size_t(ReplayWriter::kChunkHeaderSize)) {
+      close();
+      return false;
+    }
+    Chunk chunk;
+    chunk.offset = offset + ReplayWriter::kChunkHeaderSize;
+    chunk.games = uint32_t(GetBytes(data_ + offset, 4));
+    chunk.bytes = uint32_t(GetBytes(data_ + offset + 4, 4));
+    chunk.flags = data_[offset + 8];
+    if (size_ - chunk.offset < chunk.bytes) {
+      close();
+      return false;
+    }
+    chunks_.push_back(chunk);
+    games_ += chunk.games;
+    offset = chunk.offset + chunk.bytes;
+  }
+  return true;
+}
+
+void ReplayReader::close() {
+  if (data_)
+    munmap(const_cast<uint8_t*>(data_), size_);
+  data_ = nullptr;
+  size_ = 0;
+  chunks_.clear();
+  games_ = 0;
+}
+
+bool ReplayReader::read_chunk(int chunk, std::vector<ReplayGame>* games) const {
+  games->clear();
+  if (chunk < 0 || chunk >= chunks())
+    return false;
+  const Chunk& info = chunks_[chunk];
+  const uint8_t* data = data_ + info.offset;
+  const uint8_t* end = data + info.bytes;
+  bool packed = info.flags & ReplayWriter::kPackedMoves;
+  bool snapshots = info.flags & ReplayWriter::kSnapshots;
+  games->reserve(info.games);
+  for (uint32_t i = 0; i < info.games; ++i) {
+    ReplayGame game;
+    size_t size = size_t(end - data);
+    if (size < size_t(ReplayWriter::kGameHeaderSize) ||
+        size < ParseGame(data, packed, &game)) {
+      games->clear();
+      return false;
+    }
+    data = game.moves + MoveBytes(game);
+    if (snapshots) {
+      if (end - data < 4) {
+        games->clear();
+        return false;
+      }
+      game.snapshot_interval = uint32_t(GetBytes(data, 4));
+      game.snapshots = data + 4;
+      int cells = game.game_size * game.game_size;
+      game.snapshot_size = GameState::kStateHeaderSize + (cells + 1) / 2;
+      size_t bytes = game.snapshot_count() * game.snapshot_size;
+      if (size_t(end - game.snapshots) < bytes) {
+        games->clear();
+        return false;
+      }
+      data = game.snapshots + bytes;
+    }
+    games->push_back(game);
+  }
+  if (data != end) {
+    games->clear();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,220 @@
+// File: replay_log.h
+//
+// Brief: An append-only log of whole games for archives and offline
+//        analysis. A game is its options and seed, then one direction per
+//        move, since spawns follow from the seed. Games are grouped into
+//        chunks of about kChunkBytes, and a chunk may pack four moves per
+//        byte. A chunk may also keep a snapshot of every game each K moves,
+//        so a game opens at any move after at most K - 1 moves replayed. The
+//        reader maps the file into memory and hands out games that point
+//        into the mapping, so chunks can be replayed in parallel without
+//        copying.
+//
+//        File: "SMGR", version, 3 zero bytes, then chunks.
+//        Chunk, all little-endian:
+//          [0, 4)   number of games
+//          [4, 8)   bytes of games that follow the chunk header
+//          [8]      flags, kPackedMoves | kSnapshots
+//          [9, 12)  zero
+//        Game:
+//          [0, 4)   rand_seed
+//          [4, 8)   max_undo
+//          [8, 12)  number of moves
+//          [12]     game_size
+//          [13]     length of the name of the random source, 0 for none
+//        then the name, and then the moves: one Direction per byte, or four
+//        per byte from the low bits up if packed. With snapshots, the moves
+//        are followed by
+//          [0, 4)   K, the moves between snapshots, 0 for none
+//        and the states after moves K, 2K, ... up to the number of moves,
+//        each the binary state of GameState::save_state() without history
+//        records, which is kStateHeaderSize + (cells + 1) / 2 bytes.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: ReplayWriter writer;
+//        writer.open("games.smgr");
+//        writer.add(options, moves.data(), moves.size());
+//        writer.close();
+//
+//        ReplayReader reader;
+//        reader.open("games.smgr");
+//        std::vector<ReplayGame> games;
+//        for (int chunk = 0; chunk < reader.chunks(); ++chunk) {
+//          reader.read_chunk(chunk, &games);
+//          for (const ReplayGame& game: games)
+//            game.play(game.create(&arena));
+//        }
+//
+//        SquareMergeGame* game = games[0].seek(&arena, 50000);
+//
+
+#ifndef REPLAY_LOG_H_
+#define REPLAY_LOG_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "game.h"
+
+class ReplayWriter {
+ public:
+  static const int kLogVersion = 1;
+  static const int kFileHeaderSize = 8;
+  static const int kChunkHeaderSize = 12;
+  static const int kGameHeaderSize = 14;
+  static const int kChunkBytes = 1 << 20;
+  // Chunk flag of four moves per byte.
+  static const int kPackedMoves = 1;
+  // Chunk flag of snapshots after the moves of every game.
+  static const int kSnapshots = 2;
+
+  ReplayWriter() {}
+  ReplayWriter(const ReplayWriter&) = delete;
+  ReplayWriter& operator=(const ReplayWriter&) = delete;
+
+  ~ReplayWriter() {
+    close();
+  }
+
+  // Starts a new log at path, or appends to the log there. Snapshots every
+  // snapshot_interval moves if > 0. Returns false if the file cannot be
+  // opened or is not a log.
+  bool open(const std::string& path, bool packed = true,
+            int snapshot_interval = 0);
+
+  // Adds a game that started from options and slid toward moves[0, count)
+  // in order. Returns false if writing failed.
+  bool add(const GameOptions& options, const uint8_t* moves, size_t count);
+
+  // Adds count games from encode().
+  bool add_encoded(std::string_view games, int count);
+
+  // Writes the last chunk and closes the file. Returns false if writing
+  // failed.
+  bool close();
+
+  bool packed() const {
+    return packed_;
+  }
+
+  int snapshot_interval() const {
+    return snapshot_interval_;
+  }
+
+  // Appends the record of one game to *out as add() would write it, e.g. to
+  // collect games in many threads and add them in one order. Plays the game
+  // again to take its snapshots.
+  void encode(const GameOptions& options, const uint8_t* moves, size_t count,
+              std::string* out) const;
+
+ private:
+  // Writes the games gathered so far as one chunk.
+  bool flush();
+
+  FILE* file_ = nullptr;
+  bool packed_ = true;
+  int snapshot_interval_ = 0;
+  bool failed_ = false;
+  std::string chunk_;
+  int chunk_games_ = 0;
+};
+
+// One game of a mapped log. Valid while its reader stays open.
+struct ReplayGame {
+  int rand_seed = 0;
+  int game_size = 0;
+  int max_undo = 0;
+  std::string_view random_source;
+  uint32_t count = 0;
+  const uint8_t* moves = nullptr;
+  bool packed = false;
+  // Moves between snapshots, 0 for none.
+  uint32_t snapshot_interval = 0;
+  const uint8_t* snapshots = nullptr;
+  size_t snapshot_size = 0;
+
+  // Direction of move i.
+  int move(uint32_t i) const {
+    return (packed ? moves[i / 4] >> (2 * (i % 4)) : moves[i]) & 3;
+  }
+
+  // Fills the numeric options and the random source of *options.
+  void get_options(GameOptions* options) const;
+
+  // Creates the game at its start in arena, or nullptr if the random source
+  // is not registered.
+  SquareMergeGame* create(RegisterArena* arena) const;
+
+  // Plays all moves through SquareMergeGame::advance(). Returns false if one
+  // did not change the board, i.e. the log does not fit the game.
+  bool play(SquareMergeGame* game) const;
+
+  // Snapshots of the game, the state after move (i + 1) * snapshot_interval
+  // being snapshot(i).
+  uint32_t snapshot_count() const {
+    return snapshot_interval ? count / snapshot_interval : 0;
+  }
+
+  // A binary state for GameState::load_state().
+  std::string_view snapshot(uint32_t i) const {
+    return std::string_view(
+        reinterpret_cast<const char*>(snapshots) + i * snapshot_size,
+        snapshot_size);
+  }
+
+  // Creates the game in arena as it was after move moves, from the last
+  // snapshot before it. Returns nullptr if there are fewer moves, the game
+  // cannot be created, or the log does not fit it.
+  SquareMergeGame* seek(RegisterArena* arena, uint32_t move) const;
+};
+
+class ReplayReader {
+ public:
+  ReplayReader() {}
+  ReplayReader(const ReplayReader&) = delete;
+  ReplayReader& operator=(const ReplayReader&) = delete;
+
+  ~ReplayReader() {
+    close();
+  }
+
+  // Maps the log at path and indexes its chunks. Returns false if it cannot
+  // be mapped or a chunk header is malformed.
+  bool open(const std::string& path);
+
+  void close();
+
+  int chunks() const {
+    return int(chunks_.size());
+  }
+
+  long long games() const {
+    return games_;
+  }
+
+  // Replaces *games by the games of chunk, in order. Returns false and
+  // leaves *games empty if the chunk is malformed. Safe to call from many
+  // threads at once.
+  bool read_chunk(int chunk, std::vector<ReplayGame>* games) const;
+
+ private:
+  struct Chunk {
+    size_t offset;
+    uint32_t games;
+    uint32_t bytes;
+    uint8_t flags;
+  };
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  std::vector<Chunk> chunks_;
+  long long games_ = 0;
+};
+
+#endif  // REPLAY_LOG_H_
@@ -0,0 +1,121 @@
+// File: resource_text.cpp
+//
+// Brief: Loading of resource texts.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "resource_text.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+struct Line {
+  std::string_view entry;
+  std::string_view text;
+};
+
+// Copies text to out with its escapes decoded, and returns the end.
+char* Unescape(std::string_view text, char* out) {
+  for (size_t i = 0; i < text.size(); ++i) {
+    char c = text[i];
+    if (c == '\\' && i + 1 < text.size()) {
+      switch (text[++i]) {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case '\\': c = '\\'; break;
+        default: c = text[--i]; break;
+      }
+    }
+    *out++ = c;
+  }
+  return out;
+}
+
+// The lines of language in data.
+std::vector<Line> FindLines(std::string_view data, std::string_view language) {
+  std::vector<Line> lines;
+  while (!data.empty()) {
+    size_t end = data.find('\n');
+    std::string_view line = data.substr(0, end);
+    data.remove_prefix(end == data.npos ? data.size() : end + 1);
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    if (line.empty() || line[0] == '#')
+      continue;
+    size_t first = line.find('\t');
+    if (first == line.npos || line.substr(0, first) != language)
+      continue;
+    size_t second = line.find('\t', first + 1);
+    if (second == line.npos)
+      continue;
+    lines.push_back({line.substr(first + 1, second - first - 1),
+                     line.substr(second + 1)});
+  }
+  return lines;
+}
+
+}  // namespace
+
+const char* ResourceText::get_text(std::string_view entry) {
+  std::call_once(loaded_, [this] { load(); });
+  auto found = texts_.find(entry);
+  return found != texts_.end() ? found->second : "";
+}
+
+const char* ResourceText::get_text(TextId id) {
+  std::call_once(loaded_, [this] { load(); });
+  return ids_[id];
+}
+
+void ResourceText::load() {
+  for (const char*& text: ids_)
+    text = "";
+  int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  struct stat info;
+  if (fstat(fd, &info) || info.st_size <= 0) {
+    close(fd);
+    return;
+  }
+  void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return;
+  madvise(data, info.st_size, MADV_SEQUENTIAL);
+  std::vector<Line> lines = FindLines(
+      std::string_view(static_cast<const char*>(data), info.st_size),
+      language_);
+  size_t bytes = 0;
+  for (const Line& line: lines)
+    bytes += line.entry.size() + line.text.size() + 2;
+  strings_.reset(new char[bytes]);
+  texts_.reserve(lines.size());
+  char* out = strings_.get();
+  for (const Line& line: lines) {
+    if (texts_.count(line.entry))
+      continue;
+    char* entry = out;
+    out = std::copy(line.entry.begin(), line.entry.end(), out);
+    *out++ = '\0';
+    char* text = out;
+    out = Unescape(line.text, out);
+    *out++ = '\0';
+    texts_.emplace(std::string_view(entry, line.entry.size()), text);
+  }
+  munmap(data, info.st_size);
+  for (int id = 0; id < kTextIds; ++id) {
+    auto found = texts_.find(kTextEntries[id]);
+    if (found != texts_.end())
+      ids_[id] = found->second;
+  }
+}
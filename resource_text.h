@@ -0,0 +1,92 @@
+// File: resource_text.h
+//
+// Brief: A TextMethod with the texts of one language from a resource file,
+//        loaded on the first get_text(). The file is mapped into memory,
+//        only the lines of the language are copied out, each text once and
+//        NUL-terminated in one buffer, and the mapping is dropped again, so
+//        the other languages cost neither memory nor parsing. Lookups after
+//        that take no lock and copy nothing.
+//
+//        The texts of TextId are indexed at load as well, so looking them
+//        up does not even hash.
+//
+//        Resource files are lines of
+//          language<TAB>entry<TAB>text
+//        where \n, \t and \\ in text stand for a newline, a tab and a
+//        backslash. Empty lines and lines starting with # are skipped, and
+//        the first text of an entry wins.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: Registered as "resource", reading "en" from texts.tsv:
+//
+//            options.text_method = TextMethod::CreateShared("resource");
+//
+//        Pick another file or language through the concrete class, before
+//        the first get_text():
+//
+//            ResourceText* texts = new ResourceText;
+//            texts->set_path("/usr/share/square-merge/texts.tsv");
+//            texts->set_language("zh");
+//            options.text_method.reset(texts);
+//
+
+#ifndef RESOURCE_TEXT_H_
+#define RESOURCE_TEXT_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "game.h"
+
+inline constexpr char kResourceTextMethod[] = "resource";
+
+class ResourceText:
+    public Register<ResourceText, TextMethod, kResourceTextMethod> {
+ public:
+  ResourceText() {}
+
+  const char* info() override {
+    return "Texts of one language from a resource file.";
+  }
+
+  void set_path(std::string path) {
+    path_ = std::move(path);
+  }
+
+  void set_language(std::string language) {
+    language_ = std::move(language);
+  }
+
+  // Loads the texts on the first call, from any thread. Returns "" if the
+  // file or the entry is missing.
+  const char* get_text(std::string_view entry) override;
+
+  // Same, by index.
+  const char* get_text(TextId id) override;
+
+  // Texts loaded, 0 before the first get_text().
+  int size() const {
+    return int(texts_.size());
+  }
+
+ private:
+  void load();
+
+  std::string path_ = "texts.tsv";
+  std::string language_ = "en";
+  std::once_flag loaded_;
+  // All texts and their entries, NUL-terminated.
+  std::unique_ptr<char[]> strings_;
+  // Entries to texts, both in strings_.
+  std::unordered_map<std::string_view, const char*> texts_;
+  // Texts of kTextEntries.
+  const char* ids_[kTextIds] = {};
+};
+
+#endif  // RESOURCE_TEXT_H_
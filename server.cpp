@@ -0,0 +1,93 @@
+// File: server.cpp
+//
+// Brief: Host square merge games for remote players until interrupted.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include <getopt.h>
+#include <signal.h>
+#include <cstdio>
+#include <cstdlib>
+
+#include "game_server.h"
+
+namespace {
+
+void Usage() {
+  fprintf(stderr,
+          "server [-p port] [-t threads] [-u max_undo] [-m max_sessions]\n"
+          "       [-d seconds] [-c directory] [-w milliseconds]\n"
+          "  -p  TCP port, 2048 by default, 0 for any free one\n"
+          "  -t  worker threads, one per hardware thread by default\n"
+          "  -u  most moves a game may take back, 64 by default\n"
+          "  -m  most open games per connection, 1024 by default\n"
+          "  -d  seconds games of a closed connection wait to be attached\n"
+          "      again, 60 by default\n"
+          "  -c  directory to save games in and recover them from on start,\n"
+          "      none by default\n"
+          "  -w  most milliseconds a move waits to be saved, 1000 by\n"
+          "      default\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ServerOptions options;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:t:u:m:d:c:w:h")) != -1) {
+    switch (opt) {
+      case 'p':
+        options.port = atoi(optarg);
+        break;
+      case 't':
+        options.threads = atoi(optarg);
+        break;
+      case 'u':
+        options.max_undo = atoi(optarg);
+        break;
+      case 'm':
+        options.max_sessions = atoi(optarg);
+        break;
+      case 'd':
+        options.detach_seconds = atoi(optarg);
+        break;
+      case 'c':
+        options.checkpoint.directory = optarg;
+        break;
+      case 'w':
+        options.checkpoint_milliseconds = atoi(optarg);
+        break;
+      default:
+        Usage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  // Workers inherit the mask, so only sigwait() below sees the signals.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  GameServer server(options);
+  if (!server.start()) {
+    fprintf(stderr, "Cannot listen on port %d or save games in \"%s\"\n",
+            options.port, options.checkpoint.directory.c_str());
+    return EXIT_FAILURE;
+  }
+  printf("port %d\nrecovered %lld\n", server.port(),
+         server.stats().sessions);
+  fflush(stdout);
+  int signal;
+  sigwait(&signals, &signal);
+  ServerStats stats = server.stats();
+  printf("connections %lld\nsessions %lld\nrequests %lld\n"
+         "checkpoint_bytes %lld\n",
+         stats.connections, stats.sessions, stats.requests,
+         stats.checkpoint_bytes);
+  server.stop();
+  return EXIT_SUCCESS;
+}
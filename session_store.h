@@ -0,0 +1,250 @@
+// File: session_store.h
+//
+// Brief: A sharded table of sessions, e.g. one shard per worker thread of
+//        GameServer. Only the thread that owns a shard adds or removes its
+//        sessions, so writes take no lock. Any thread may find a session by
+//        ID without a lock, with one load of its slot, while it holds an
+//        Epoch::Guard (see epoch.h): removed sessions are destroyed only once
+//        no guard that could have seen them is left.
+//
+//        Shards and sessions each take whole cache lines, and a shard
+//        allocates its sessions in blocks of its own, on its owner thread,
+//        so two shards never write one cache line.
+//
+//        Session IDs, 0 for none:
+//          [0, kShardBits)                     shard
+//          [kShardBits, kShardBits + kSlotBits)  slot in the shard
+//          the rest                            generation of the slot
+//        The generation changes each time a slot is reused, so a stale ID
+//        finds nothing for a long while, and slots are reused oldest first.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: SessionStore<Session> store(workers, 1 << 16);
+//
+//        // On the thread of shard:
+//        Session* session;
+//        uint32_t id = store.add(shard, &session);
+//        ...
+//        store.remove(id);
+//        store.reclaim(shard);
+//
+//        // On any thread:
+//        {
+//          Epoch::Guard guard;
+//          Session* session = store.find(id);
+//          ...
+//        }
+//
+
+#ifndef SESSION_STORE_H_
+#define SESSION_STORE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "epoch.h"
+
+template <typename Value>
+class SessionStore {
+ public:
+  static const int kShardBits = 8;
+  static const int kMaxShards = 1 << kShardBits;
+  static const int kSlotBits = 18;
+  static const int kMaxSlots = 1 << kSlotBits;
+  static const int kGenerations = 1 << (32 - kShardBits - kSlotBits);
+  // Sessions a shard allocates at once.
+  static const int kBlockSize = 64;
+
+  // Makes shards shards of up to slots sessions each.
+  SessionStore(int shards, int slots);
+  SessionStore(const SessionStore&) = delete;
+  SessionStore& operator=(const SessionStore&) = delete;
+
+  // Destroys all sessions. No guard may still use them.
+  ~SessionStore() = default;
+
+  int shards() const {
+    return int(shards_.size());
+  }
+
+  static int ShardOf(uint32_t id) {
+    return int(id & (kMaxShards - 1));
+  }
+
+  // Sessions in shard now, from any thread.
+  int size(int shard) const {
+    return shards_[shard]->size.load(std::memory_order_relaxed);
+  }
+
+  // Adds a default constructed session to shard, and points *value at it.
+  // Returns its ID, or 0 if the shard is full. On the thread of shard only.
+  uint32_t add(int shard, Value** value);
+
+  // Adds a default constructed session under id, e.g. one recovered from a
+  // checkpoint, and points *value at it. Returns false if the slot of id is
+  // taken or out of range. Before any thread uses the shard of id.
+  bool claim(uint32_t id, Value** value);
+
+  // Removes the session of id, which is destroyed by a later reclaim().
+  // Returns false if there is none. On the thread of its shard only.
+  bool remove(uint32_t id);
+
+  // The session of id, or nullptr. On the thread of its shard, or on any
+  // thread inside an Epoch::Guard.
+  Value* find(uint32_t id) const;
+
+  // Destroys the removed sessions of shard that no guard can still see. On
+  // the thread of shard only, now and then.
+  void reclaim(int shard);
+
+ private:
+  struct alignas(64) Entry {
+    uint32_t id = 0;
+    Value value;
+  };
+
+  struct Retired {
+    Entry* entry;
+    uint64_t epoch;
+  };
+
+  // Puts a new session in slot of shard, under the generation of the slot.
+  Entry* place(int shard_index, int slot);
+
+  struct alignas(64) Shard {
+    explicit Shard(int slots);
+
+    std::unique_ptr<std::atomic<Entry*>[]> slots;
+    std::vector<uint8_t> generations;
+    std::deque<int> free_slots;
+    std::vector<std::unique_ptr<Entry[]>> blocks;
+    std::vector<Entry*> free_entries;
+    std::deque<Retired> retired;
+    std::atomic<int> size{0};
+  };
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  int slots_;
+};
+
+template <typename Value>
+SessionStore<Value>::Shard::Shard(int slots)
+    : slots(new std::atomic<Entry*>[slots]), generations(slots, 0) {
+  for (int slot = 0; slot < slots; ++slot) {
+    this->slots[slot].store(nullptr, std::memory_order_relaxed);
+    free_slots.push_back(slot);
+  }
+}
+
+template <typename Value>
+SessionStore<Value>::SessionStore(int shards, int slots)
+    : slots_(std::max(1, std::min(slots, int(kMaxSlots)))) {
+  shards = std::max(1, std::min(shards, int(kMaxShards)));
+  for (int shard = 0; shard < shards; ++shard)
+    shards_.emplace_back(new Shard(slots_));
+}
+
+template <typename Value>
+uint32_t SessionStore<Value>::add(int shard_index, Value** value) {
+  Shard& shard = *shards_[shard_index];
+  // Slots that claim() took are still listed, and dropped here.
+  std::deque<int>& free_slots = shard.free_slots;
+  while (!free_slots.empty() &&
+         shard.slots[free_slots.front()].load(std::memory_order_relaxed))
+    free_slots.pop_front();
+  if (free_slots.empty())
+    return 0;
+  int slot = free_slots.front();
+  free_slots.pop_front();
+  // Generations start at 1, so no ID is 0.
+  uint8_t& generation = shard.generations[slot];
+  generation = generation % (kGenerations - 1) + 1;
+  Entry* entry = place(shard_index, slot);
+  *value = &entry->value;
+  return entry->id;
+}
+
+template <typename Value>
+bool SessionStore<Value>::claim(uint32_t id, Value** value) {
+  int shard_index = ShardOf(id);
+  int slot = int(id >> kShardBits) & (kMaxSlots - 1);
+  int generation = int(id >> (kShardBits + kSlotBits));
+  if (shard_index >= shards() || slot >= slots_ || !generation)
+    return false;
+  Shard& shard = *shards_[shard_index];
+  if (shard.slots[slot].load(std::memory_order_relaxed))
+    return false;
+  shard.generations[slot] = uint8_t(generation);
+  *value = &place(shard_index, slot)->value;
+  return true;
+}
+
+template <typename Value>
+typename SessionStore<Value>::Entry* SessionStore<Value>::place(
+    int shard_index, int slot) {
+  Shard& shard = *shards_[shard_index];
+  if (shard.free_entries.empty()) {
+    shard.blocks.emplace_back(new Entry[kBlockSize]);
+    for (int i = kBlockSize - 1; i >= 0; --i)
+      shard.free_entries.push_back(&shard.blocks.back()[i]);
+  }
+  Entry* entry = shard.free_entries.back();
+  shard.free_entries.pop_back();
+  entry->id = uint32_t(shard.generations[slot]) << (kShardBits + kSlotBits) |
+              uint32_t(slot) << kShardBits | uint32_t(shard_index);
+  shard.slots[slot].store(entry);
+  shard.size.fetch_add(1, std::memory_order_relaxed);
+  return entry;
+}
+
+template <typename Value>
+bool SessionStore<Value>::remove(uint32_t id) {
+  Shard& shard = *shards_[ShardOf(id)];
+  int slot = int(id >> kShardBits) & (kMaxSlots - 1);
+  Entry* entry = shard.slots[slot].load(std::memory_order_relaxed);
+  if (!entry || entry->id != id)
+    return false;
+  // Sequentially consistent, see Epoch::Guard.
+  shard.slots[slot].store(nullptr);
+  shard.retired.push_back({entry, Epoch::Current()});
+  shard.free_slots.push_back(slot);
+  shard.size.fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
+
+template <typename Value>
+Value* SessionStore<Value>::find(uint32_t id) const {
+  int shard = ShardOf(id);
+  int slot = int(id >> kShardBits) & (kMaxSlots - 1);
+  if (shard >= shards() || slot >= slots_)
+    return nullptr;
+  Entry* entry = shards_[shard]->slots[slot].load();
+  return entry && entry->id == id ? &entry->value : nullptr;
+}
+
+template <typename Value>
+void SessionStore<Value>::reclaim(int shard_index) {
+  Shard& shard = *shards_[shard_index];
+  if (shard.retired.empty())
+    return;
+  uint64_t reclaimable = Epoch::Reclaimable();
+  while (!shard.retired.empty() &&
+         shard.retired.front().epoch < reclaimable) {
+    Entry* entry = shard.retired.front().entry;
+    shard.retired.pop_front();
+    entry->value.~Value();
+    new (&entry->value) Value();
+    entry->id = 0;
+    shard.free_entries.push_back(entry);
+  }
+}
+
+#endif  // SESSION_STORE_H_
@@ -0,0 +1,259 @@
+// File: simulate.cpp
+//
+// Brief: Play many games without a terminal and report statistics.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include <getopt.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "event_pipeline.h"
+#include "instrument.h"
+#include "ntuple.h"
+#include "opening_book.h"
+#include "simulator.h"
+
+namespace {
+
+void Usage() {
+  fprintf(stderr,
+          "simulate [-n games] [-s size] [-p policy] [-t threads]\n"
+          "         [-r seed] [-g random_source] [-m max_moves] [-c chunk]\n"
+          "         [-e events] [-w log] [-k interval] [-R log] [-i] [-l]\n"
+          "         [-W weights] [-T weights] [-a rate] [-O book] [-B book]\n"
+          "  -g  registered stream of tile spawns, splitmix by default\n"
+          "  -e  comma separated events to count, e.g. 2048,corner\n"
+          "  -w  append the simulated games to a replay log\n"
+          "  -k  with -w, snapshot every game each interval moves\n"
+          "  -R  play the games of a replay log again instead\n"
+          "  -W  n-tuple weights of the ntuple policy and evaluator\n"
+          "  -T  train the n-tuple weights file on the games instead, new\n"
+          "      ones if it is missing, and save them in it\n"
+          "  -a  learning rate of -T, 0.1 by default\n"
+          "  -O  opening book of the expectimax policy\n"
+          "  -B  build an opening book of the policy's moves in the first\n"
+          "      max_moves moves of the games instead, 30 by default\n"
+          "  -i  also dump the engine counters, if built with INSTRUMENT=1\n"
+          "  -l  list the registered policies, events and random sources\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  SimulationOptions options;
+  std::string write_path;
+  int snapshot_interval = 0;
+  bool dump_instrument = false;
+  std::string replay_path;
+  std::string weights_path;
+  std::string train_path;
+  float learning_rate = 0.1f;
+  std::string book_path;
+  std::string build_path;
+  options.game.game_size = 4;
+  options.game.rand_seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv,
+                       "n:s:p:t:r:g:m:c:e:w:k:R:W:T:a:O:B:ilh")) != -1) {
+    switch (opt) {
+      case 'n':
+        options.games = atoll(optarg);
+        break;
+      case 's':
+        options.game.game_size = atoi(optarg);
+        break;
+      case 'p':
+        options.policy = optarg;
+        break;
+      case 't':
+        options.threads = atoi(optarg);
+        break;
+      case 'r':
+        options.game.rand_seed = atoi(optarg);
+        break;
+      case 'g':
+        options.game.random_source = RandomSource::Shared(optarg);
+        if (!options.game.random_source) {
+          fprintf(stderr, "Unknown random source \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'm':
+        options.max_moves = atoll(optarg);
+        break;
+      case 'c':
+        options.chunk = atoi(optarg);
+        break;
+      case 'e':
+        for (const char* name = optarg; *name; ) {
+          const char* end = strchr(name, ',');
+          if (!end)
+            end = name + strlen(name);
+          if (end > name)
+            options.events.emplace_back(name, end);
+          name = *end ? end + 1 : end;
+        }
+        break;
+      case 'w':
+        write_path = optarg;
+        break;
+      case 'k':
+        snapshot_interval = atoi(optarg);
+        break;
+      case 'R':
+        replay_path = optarg;
+        break;
+      case 'W':
+        weights_path = optarg;
+        break;
+      case 'T':
+        train_path = optarg;
+        break;
+      case 'a':
+        learning_rate = float(atof(optarg));
+        break;
+      case 'O':
+        book_path = optarg;
+        break;
+      case 'B':
+        build_path = optarg;
+        break;
+      case 'i':
+        dump_instrument = true;
+        if (!Instrument::kEnabled)
+          fprintf(stderr, "Built without INSTRUMENT=1, counting nothing\n");
+        break;
+      case 'l':
+        for (const auto& name: MoveMethod::GetChildren())
+          printf("policy %s\n", name.c_str());
+        for (const auto& name: Event::GetChildren())
+          printf("event %s\n", name.c_str());
+        for (const auto& name: RandomSource::GetChildren())
+          printf("random_source %s\n", name.c_str());
+        for (const auto& name: BoardEvaluator::GetChildren())
+          printf("evaluator %s\n", name.c_str());
+        return EXIT_SUCCESS;
+      default:
+        Usage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (!weights_path.empty()) {
+    std::shared_ptr<NTupleNetwork> network(
+        NTupleNetwork::Load(weights_path));
+    if (!network) {
+      fprintf(stderr, "Cannot read weights \"%s\"\n", weights_path.c_str());
+      return EXIT_FAILURE;
+    }
+    NTupleNetwork::SetDefault(std::move(network));
+  }
+
+  if (!book_path.empty()) {
+    std::shared_ptr<OpeningBook> book(new OpeningBook);
+    if (!book->open(book_path)) {
+      fprintf(stderr, "Cannot read opening book \"%s\"\n", book_path.c_str());
+      return EXIT_FAILURE;
+    }
+    OpeningBook::SetDefault(std::move(book));
+  }
+
+  if (!train_path.empty()) {
+    if (options.game.game_size != GameBoard::kCompactSize) {
+      fprintf(stderr, "Trains on %dx%d boards only\n",
+              GameBoard::kCompactSize, GameBoard::kCompactSize);
+      return EXIT_FAILURE;
+    }
+    std::unique_ptr<NTupleNetwork> network(NTupleNetwork::Load(train_path));
+    if (!network)
+      network.reset(NTupleNetwork::Create(NTupleNetwork::DefaultTuples()));
+    SimulationStats stats = Train(network.get(), options, learning_rate);
+    printf("%s", stats.report().c_str());
+    if (!network->save(train_path)) {
+      fprintf(stderr, "Cannot write weights \"%s\"\n", train_path.c_str());
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  if (!replay_path.empty()) {
+    ReplayReader reader;
+    if (!reader.open(replay_path)) {
+      fprintf(stderr, "Cannot read replay log \"%s\"\n", replay_path.c_str());
+      return EXIT_FAILURE;
+    }
+    bool valid = true;
+    SimulationStats stats = Replay(reader, options.threads, &valid);
+    printf("%s", stats.report().c_str());
+    if (dump_instrument)
+      printf("%s", Instrument::Snapshot().report().c_str());
+    if (!valid) {
+      fprintf(stderr, "Replay log \"%s\" is corrupt\n", replay_path.c_str());
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  if (options.game.game_size < 1 ||
+      options.game.game_size > GameBoard::kMaxSize) {
+    fprintf(stderr, "Board size from 1 to %d\n", GameBoard::kMaxSize);
+    return EXIT_FAILURE;
+  }
+  if (!MoveMethod::HasChild(options.policy)) {
+    fprintf(stderr, "Unknown policy \"%s\"\n", options.policy.c_str());
+    return EXIT_FAILURE;
+  }
+  if (!build_path.empty()) {
+    if (options.game.game_size != GameBoard::kCompactSize) {
+      fprintf(stderr, "Builds books of %dx%d boards only\n",
+              GameBoard::kCompactSize, GameBoard::kCompactSize);
+      return EXIT_FAILURE;
+    }
+    OpeningBookWriter book;
+    SimulationStats stats = BuildOpeningBook(
+        options, options.max_moves > 0 ? int(options.max_moves) : 30, &book);
+    printf("%s", stats.report().c_str());
+    printf("book_decisions %zu\n", book.size());
+    if (!book.write(build_path)) {
+      fprintf(stderr, "Cannot write opening book \"%s\"\n",
+              build_path.c_str());
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+  for (const auto& name: options.events) {
+    if (!Event::HasChild(name)) {
+      fprintf(stderr, "Unknown event \"%s\"\n", name.c_str());
+      return EXIT_FAILURE;
+    }
+  }
+  if (options.events.size() > size_t(EventPipeline::kMaxEvents)) {
+    fprintf(stderr, "At most %d events\n", EventPipeline::kMaxEvents);
+    return EXIT_FAILURE;
+  }
+
+  ReplayWriter writer;
+  if (!write_path.empty()) {
+    if (!writer.open(write_path, true, snapshot_interval)) {
+      fprintf(stderr, "Cannot write replay log \"%s\"\n", write_path.c_str());
+      return EXIT_FAILURE;
+    }
+    options.replays = &writer;
+  }
+
+  SimulationStats stats = Simulate(options);
+  printf("%s", stats.report().c_str());
+  if (dump_instrument)
+    printf("%s", Instrument::Snapshot().report().c_str());
+  if (!writer.close()) {
+    fprintf(stderr, "Cannot write replay log \"%s\"\n", write_path.c_str());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
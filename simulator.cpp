@@ -0,0 +1,400 @@
+// File: simulator.cpp
+//
+// Brief: Headless batch simulation.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "simulator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+
+#include "event_pipeline.h"
+#include "thread_pool.h"
+
+void SimulationStats::add(const GameState& state, uint32_t events) {
+  ++games;
+  for (; events; events &= events - 1) {
+    size_t i = __builtin_ctz(events);
+    if (event_games.size() <= i)
+      event_games.resize(i + 1);
+    ++event_games[i];
+  }
+  moves += state.moves;
+  total_score += state.score;
+  best_score = std::max(best_score, state.score);
+  size_t tile = state.board.max_exponent();
+  if (max_tiles.size() <= tile)
+    max_tiles.resize(tile + 1);
+  ++max_tiles[tile];
+  size_t bits = 0;
+  while (bits < 32 && (state.score >> bits))
+    ++bits;
+  if (scores.size() <= bits)
+    scores.resize(bits + 1);
+  ++scores[bits];
+}
+
+void SimulationStats::merge(const SimulationStats& other) {
+  games += other.games;
+  moves += other.moves;
+  total_score += other.total_score;
+  best_score = std::max(best_score, other.best_score);
+  if (max_tiles.size() < other.max_tiles.size())
+    max_tiles.resize(other.max_tiles.size());
+  for (size_t i = 0; i < other.max_tiles.size(); ++i)
+    max_tiles[i] += other.max_tiles[i];
+  if (scores.size() < other.scores.size())
+    scores.resize(other.scores.size());
+  for (size_t i = 0; i < other.scores.size(); ++i)
+    scores[i] += other.scores[i];
+  if (event_names.empty())
+    event_names = other.event_names;
+  if (event_games.size() < other.event_games.size())
+    event_games.resize(other.event_games.size());
+  for (size_t i = 0; i < other.event_games.size(); ++i)
+    event_games[i] += other.event_games[i];
+}
+
+std::string SimulationStats::report() const {
+  std::ostringstream out;
+  out << "games " << games << "\n"
+      << "moves " << moves << "\n"
+      << "seconds " << seconds << "\n"
+      << "games_per_second " << games_per_second() << "\n"
+      << "moves_per_second " << moves_per_second() << "\n"
+      << "mean_score " << (games ? double(total_score) / games : 0) << "\n"
+      << "best_score " << best_score << "\n";
+  for (size_t i = 0; i < max_tiles.size(); ++i)
+    if (max_tiles[i])
+      out << "max_tile_" << (i ? 1 << i : 0) << " " << max_tiles[i] << "\n";
+  for (size_t i = 0; i < scores.size(); ++i)
+    if (scores[i])
+      out << "score_below_" << (1LL << i) << " " << scores[i] << "\n";
+  for (size_t i = 0; i < event_names.size(); ++i)
+    out << "event_" << event_names[i] << " "
+        << (i < event_games.size() ? event_games[i] : 0) << "\n";
+  return out.str();
+}
+
+int GameSeed(int rand_seed, long long index) {
+  uint64_t x = uint64_t(uint32_t(rand_seed)) << 32 ^ uint64_t(index);
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return int(uint32_t(x ^ (x >> 31)));
+}
+
+namespace {
+
+// Makes one move of game. Returns false instead if the game is over, out of
+// moves, or the policy gave up.
+bool PlayMove(SquareMergeGame* game, MoveMethod* policy, long long max_moves,
+              std::vector<uint8_t>* moves) {
+  const GameState& state = game->game_state();
+  if (state.over || (max_moves > 0 && state.moves >= max_moves))
+    return false;
+  int direction = policy->decide(state);
+  if (direction < 0 || direction >= kDirections)
+    return false;
+  int before = state.moves;
+  game->advance(Direction(direction));
+  if (moves && state.moves != before)
+    moves->push_back(uint8_t(direction));
+  return true;
+}
+
+// Plays game to the end on the afterstates of network, training it on the
+// way, see Train().
+void TrainGame(SquareMergeGame* game, NTupleNetwork* network, float step,
+               long long max_moves) {
+  const GameState& state = game->game_state();
+  bool learning = false;
+  uint64_t last = 0;
+  while (!state.over && !(max_moves > 0 && state.moves >= max_moves)) {
+    int legal = state.board.legal_moves();
+    int best = -1;
+    float best_value = 0;
+    uint64_t best_after = 0;
+    for (int direction = 0; direction < kDirections; ++direction) {
+      if (!(legal >> direction & 1))
+        continue;
+      GameBoard after = state.board;
+      int reward = 0;
+      after.slide(Direction(direction), &reward);
+      float value = reward + network->evaluate_shared(after.compact_bits());
+      if (best < 0 || value > best_value) {
+        best = direction;
+        best_value = value;
+        best_after = after.compact_bits();
+      }
+    }
+    if (best < 0)
+      break;
+    if (learning)
+      network->update(last,
+                      step * (best_value - network->evaluate_shared(last)));
+    learning = true;
+    last = best_after;
+    game->advance(Direction(best));
+  }
+  if (learning && state.over)
+    network->update(last, -step * network->evaluate_shared(last));
+}
+
+}  // namespace
+
+bool PlayGame(SquareMergeGame* game, MoveMethod* policy, long long max_moves,
+              std::vector<uint8_t>* moves) {
+  while (PlayMove(game, policy, max_moves, moves)) {}
+  const GameState& state = game->game_state();
+  return state.over || (max_moves > 0 && state.moves >= max_moves);
+}
+
+SimulationStats Simulate(const SimulationOptions& options) {
+  MoveMethod::Handle policy = MoveMethod::Find(options.policy);
+  if (!MoveMethod::HasChild(options.policy))
+    return SimulationStats();
+
+  auto start = std::chrono::steady_clock::now();
+  long long chunk = std::max(1, options.chunk);
+  long long tasks = (options.games + chunk - 1) / chunk;
+  std::vector<SimulationStats> results(tasks);
+  // Encoded games of each task for options.replays.
+  std::vector<std::string> replays(options.replays ? tasks : 0);
+  {
+    ThreadPool pool(options.threads);
+    for (long long task = 0; task < tasks; ++task) {
+      pool.submit([&options, &results, &replays, policy, chunk, task] {
+        std::string* replay = options.replays ? &replays[task] : nullptr;
+        GameOptions game_options = options.game;
+        game_options.move_method.reset(MoveMethod::Create(policy));
+        MoveMethod* method = game_options.move_method.get();
+        // Names of the events in, by their bits.
+        EventPipeline pipeline;
+        std::vector<std::string> event_names;
+        for (const auto& name: options.events)
+          if (pipeline.add(name) >= 0)
+            event_names.push_back(name);
+
+        RegisterArena arena;
+        long long end = std::min(options.games, (task + 1) * chunk);
+        if (!pipeline.size()) {
+          // Nothing to check in batches, so play the games one by one.
+          std::vector<uint8_t> moves;
+          for (long long index = task * chunk; index < end; ++index) {
+            game_options.rand_seed = GameSeed(options.game.rand_seed, index);
+            SquareMergeGame* game =
+                SquareMergeGame::Create(&arena, game_options);
+            moves.clear();
+            PlayGame(game, method, options.max_moves,
+                     replay ? &moves : nullptr);
+            results[task].add(game->game_state());
+            if (replay)
+              options.replays->encode(game_options, moves.data(), moves.size(),
+                                      replay);
+            arena.clear();
+          }
+          return;
+        }
+
+        std::vector<SquareMergeGame*> games;
+        for (long long index = task * chunk; index < end; ++index) {
+          game_options.rand_seed = GameSeed(options.game.rand_seed, index);
+          games.push_back(SquareMergeGame::Create(&arena, game_options));
+        }
+
+        // Checks the events on every state of the live games, each move in
+        // one batch, then moves them all once.
+        std::vector<int> live(games.size());
+        for (size_t i = 0; i < games.size(); ++i)
+          live[i] = int(i);
+        std::vector<uint32_t> seen(games.size());
+        std::vector<std::vector<uint8_t>> moves(replay ? games.size() : 0);
+        std::vector<const GameState*> states;
+        std::vector<uint32_t> fired;
+        while (!live.empty()) {
+          states.clear();
+          for (int i: live)
+            states.push_back(&games[i]->game_state());
+          pipeline.run(states.data(), int(states.size()), &fired);
+          for (size_t k = 0; k < live.size(); ++k)
+            seen[live[k]] |= fired[k];
+          size_t kept = 0;
+          for (int i: live)
+            if (PlayMove(games[i], method, options.max_moves,
+                         replay ? &moves[i] : nullptr))
+              live[kept++] = i;
+          live.resize(kept);
+        }
+
+        for (size_t i = 0; i < games.size(); ++i) {
+          results[task].add(games[i]->game_state(), seen[i]);
+          if (replay)
+            options.replays->encode(games[i]->game_state().options,
+                                    moves[i].data(), moves[i].size(), replay);
+        }
+        results[task].event_names = event_names;
+      });
+    }
+    pool.wait();
+  }
+
+  SimulationStats stats;
+  for (const auto& result: results)
+    stats.merge(result);
+  for (long long task = 0; task < (long long)(replays.size()); ++task) {
+    long long end = std::min(options.games, (task + 1) * chunk);
+    options.replays->add_encoded(replays[task], int(end - task * chunk));
+  }
+  stats.seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+SimulationStats Train(NTupleNetwork* network, const SimulationOptions& options,
+                      float learning_rate) {
+  if (options.game.game_size != GameBoard::kCompactSize)
+    return SimulationStats();
+
+  auto start = std::chrono::steady_clock::now();
+  float step = learning_rate / network->features();
+  long long chunk = std::max(1, options.chunk);
+  long long tasks = (options.games + chunk - 1) / chunk;
+  std::vector<SimulationStats> results(tasks);
+  {
+    ThreadPool pool(options.threads);
+    for (long long task = 0; task < tasks; ++task) {
+      pool.submit([&options, &results, network, step, chunk, task] {
+        GameOptions game_options = options.game;
+        game_options.max_undo = 0;
+        RegisterArena arena;
+        long long end = std::min(options.games, (task + 1) * chunk);
+        for (long long index = task * chunk; index < end; ++index) {
+          game_options.rand_seed = GameSeed(options.game.rand_seed, index);
+          SquareMergeGame* game = SquareMergeGame::Create(&arena,
+                                                          game_options);
+          TrainGame(game, network, step, options.max_moves);
+          results[task].add(game->game_state());
+          arena.clear();
+        }
+      });
+    }
+    pool.wait();
+  }
+
+  SimulationStats stats;
+  for (const auto& result: results)
+    stats.merge(result);
+  stats.seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+SimulationStats BuildOpeningBook(const SimulationOptions& options, int moves,
+                                 OpeningBookWriter* book) {
+  MoveMethod::Handle policy = MoveMethod::Find(options.policy);
+  if (!MoveMethod::HasChild(options.policy) ||
+      options.game.game_size != GameBoard::kCompactSize)
+    return SimulationStats();
+
+  auto start = std::chrono::steady_clock::now();
+  long long chunk = std::max(1, options.chunk);
+  long long tasks = (options.games + chunk - 1) / chunk;
+  std::vector<SimulationStats> results(tasks);
+  std::vector<OpeningBookWriter> books(tasks);
+  {
+    ThreadPool pool(options.threads);
+    for (long long task = 0; task < tasks; ++task) {
+      pool.submit([&options, &results, &books, policy, moves, chunk, task] {
+        GameOptions game_options = options.game;
+        game_options.max_undo = 0;
+        game_options.move_method.reset(MoveMethod::Create(policy));
+        MoveMethod* method = game_options.move_method.get();
+        // Canonical positions decided so far, and their canonical moves.
+        std::unordered_map<uint64_t, int> decided;
+        RegisterArena arena;
+        long long end = std::min(options.games, (task + 1) * chunk);
+        for (long long index = task * chunk; index < end; ++index) {
+          game_options.rand_seed = GameSeed(options.game.rand_seed, index);
+          SquareMergeGame* game = SquareMergeGame::Create(&arena,
+                                                          game_options);
+          const GameState& state = game->game_state();
+          while (!state.over && state.moves < moves) {
+            uint64_t key;
+            int symmetry;
+            OpeningBook::Canonical(state.board, &key, &symmetry);
+            int direction;
+            auto found = decided.find(key);
+            if (found != decided.end()) {
+              direction = GameBoard::SymmetricDirection(
+                  Direction(found->second),
+                  GameBoard::InverseSymmetry(symmetry));
+            } else {
+              direction = method->decide(state);
+              if (direction < 0 || direction >= kDirections)
+                break;
+              books[task].add(state.board, Direction(direction));
+              decided.emplace(key, GameBoard::SymmetricDirection(
+                                       Direction(direction), symmetry));
+            }
+            game->advance(Direction(direction));
+          }
+          results[task].add(state);
+          arena.clear();
+        }
+      });
+    }
+    pool.wait();
+  }
+
+  SimulationStats stats;
+  for (long long task = 0; task < tasks; ++task) {
+    stats.merge(results[task]);
+    book->merge(books[task]);
+  }
+  stats.seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+SimulationStats Replay(const ReplayReader& reader, int threads, bool* valid) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<SimulationStats> results(reader.chunks());
+  std::atomic<bool> all_valid(true);
+  {
+    ThreadPool pool(threads);
+    for (int chunk = 0; chunk < reader.chunks(); ++chunk) {
+      pool.submit([&reader, &results, &all_valid, chunk] {
+        std::vector<ReplayGame> games;
+        if (!reader.read_chunk(chunk, &games))
+          all_valid = false;
+        RegisterArena arena;
+        for (const ReplayGame& replay: games) {
+          SquareMergeGame* game = replay.create(&arena);
+          if (!replay.play(game))
+            all_valid = false;
+          if (game)
+            results[chunk].add(game->game_state());
+          arena.clear();
+        }
+      });
+    }
+    pool.wait();
+  }
+
+  SimulationStats stats;
+  for (const auto& result: results)
+    stats.merge(result);
+  stats.seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  if (valid)
+    *valid = all_valid;
+  return stats;
+}
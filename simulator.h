@@ -0,0 +1,135 @@
+// File: simulator.h
+//
+// Brief: Headless batch simulation. Plays many independent games with a
+//        registered MoveMethod across a work-stealing thread pool, and
+//        collects throughput, score and max tile statistics. The games of a
+//        task move in lockstep, so registered events are checked over all
+//        of them at once by an EventPipeline. Simulated games can be logged
+//        to a replay log and played back from it in parallel.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: SimulationOptions options;
+//        options.game.game_size = 4;
+//        options.policy = "greedy";
+//        options.games = 1000000;
+//        options.events = {"2048", "corner"};
+//        SimulationStats stats = Simulate(options);
+//        std::cout << stats.report();
+//
+//        std::unique_ptr<NTupleNetwork> network(NTupleNetwork::Create(
+//            NTupleNetwork::DefaultTuples()));
+//        options.games = 100000;
+//        std::cout << Train(network.get(), options, 0.1f).report();
+//
+//        ReplayReader reader;
+//        reader.open("games.smgr");
+//        std::cout << Replay(reader, 0).report();
+//
+
+#ifndef SIMULATOR_H_
+#define SIMULATOR_H_
+
+#include <string>
+#include <vector>
+
+#include "game.h"
+#include "ntuple.h"
+#include "opening_book.h"
+#include "replay_log.h"
+
+struct SimulationOptions {
+  // Options of every game. rand_seed is the base seed that the seed of each
+  // game derives from, and move_method is replaced by one policy per task.
+  GameOptions game = GameOptions();
+  // Name of the registered MoveMethod that plays.
+  std::string policy = "random";
+  long long games = 1000;
+  // Worker threads, or one per hardware thread if <= 0.
+  int threads = 0;
+  // Games per task, which is also how many games share one policy object.
+  int chunk = 64;
+  // Stops a game after this many moves if > 0.
+  long long max_moves = 0;
+  // Names of registered events to count the games they capture in, up to
+  // EventPipeline::kMaxEvents.
+  std::vector<std::string> events;
+  // Receives every game, in the order of their seeds, if set.
+  ReplayWriter* replays = nullptr;
+};
+
+struct SimulationStats {
+  long long games = 0;
+  long long moves = 0;
+  long long total_score = 0;
+  int best_score = 0;
+  double seconds = 0;
+  // Games by their max tile exponent.
+  std::vector<long long> max_tiles;
+  // Games by the bit length of their score, e.g. scores in [512, 1024) count
+  // at index 10.
+  std::vector<long long> scores;
+  // Names of the counted events, and the games each captured at least once.
+  std::vector<std::string> event_names;
+  std::vector<long long> event_games;
+
+  // Adds one finished game, in which the events with their bit set in
+  // events fired.
+  void add(const GameState& state, uint32_t events = 0);
+
+  void merge(const SimulationStats& other);
+
+  double games_per_second() const {
+    return seconds > 0 ? games / seconds : 0;
+  }
+
+  double moves_per_second() const {
+    return seconds > 0 ? moves / seconds : 0;
+  }
+
+  // One "name value" pair per line.
+  std::string report() const;
+};
+
+// The seed of game index of a batch with base seed rand_seed.
+int GameSeed(int rand_seed, long long index);
+
+// Plays one game to the end with policy, and records the directions it slid
+// toward in *moves if given. Returns false if the policy gave up before the
+// game was over.
+bool PlayGame(SquareMergeGame* game, MoveMethod* policy,
+              long long max_moves = 0, std::vector<uint8_t>* moves = nullptr);
+
+// Plays options.games games. Returns empty stats if the policy is not
+// registered.
+SimulationStats Simulate(const SimulationOptions& options);
+
+// Trains network by TD(0) on options.games games of 4x4 boards, each move to
+// the afterstate of the best reward plus value. The value of an afterstate
+// moves toward the reward and value of the next one, by learning_rate spread
+// over the features, and the last one of a lost game toward 0. All threads
+// update network at once, see NTupleNetwork. policy, events and replays of
+// options are unused, and max_undo is 0. Returns the stats of the games
+// played, or empty stats if options.game is not 4x4.
+SimulationStats Train(NTupleNetwork* network, const SimulationOptions& options,
+                      float learning_rate);
+
+// Plays the first moves of options.games 4x4 games with options.policy, and
+// adds its move in each position to *book, in the order of the seeds. A
+// task asks the policy once per canonical position and plays the same move
+// when it comes back. events, max_moves and replays of options are unused.
+// Returns the stats of the games played so far, or empty stats if the
+// policy is not registered or options.game is not 4x4.
+SimulationStats BuildOpeningBook(const SimulationOptions& options, int moves,
+                                 OpeningBookWriter* book);
+
+// Plays every game of reader again through SquareMergeGame::advance(), one
+// task per chunk on threads workers (one per hardware thread if <= 0), and
+// collects the same statistics. Sets *valid, if given, to whether every
+// chunk was well formed and every move changed its board.
+SimulationStats Replay(const ReplayReader& reader, int threads,
+                       bool* valid = nullptr);
+
+#endif  // SIMULATOR_H_
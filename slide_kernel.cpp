@@ -0,0 +1,399 @@
+// File: slide_kernel.cpp
+//
+// Brief: Scalar, SSE4.1, AVX2 and NEON row kernels for wide boards.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "slide_kernel.h"
+
+#include <memory>
+
+#include "game.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SLIDE_KERNEL_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SLIDE_KERNEL_NEON
+#endif
+
+int SlideKernel::slide_rows(uint64_t* rows, int count, int length,
+                            bool reverse) {
+  int score = 0;
+  uint8_t line[GameBoard::kMaxSize];
+  for (int row = 0; row < count; ++row) {
+    uint64_t bits = rows[row];
+    for (int i = 0; i < length; ++i)
+      line[reverse ? length - 1 - i : i] = (bits >> (4 * i)) & 0xf;
+    score += GameBoard::slide_line(line, length);
+    bits = 0;
+    for (int i = 0; i < length; ++i)
+      bits |= uint64_t(line[reverse ? length - 1 - i : i]) << (4 * i);
+    rows[row] = bits;
+  }
+  return score;
+}
+
+namespace {
+
+class ScalarSlideKernel: public Register<ScalarSlideKernel, SlideKernel> {};
+
+#if defined(SLIDE_KERNEL_X86) || defined(SLIDE_KERNEL_NEON)
+
+// Shuffle controls shared by the SIMD kernels. Index 0x80 selects zero.
+struct ShuffleTables {
+  ShuffleTables() {
+    for (int mask = 0; mask < 256; ++mask) {
+      int count = 0;
+      for (int i = 0; i < 8; ++i)
+        if (mask >> i & 1)
+          compress[mask][count++] = i;
+      while (count < 8)
+        compress[mask][count++] = 0x80;
+    }
+    for (int k = 0; k <= 16; ++k)
+      for (int j = 0; j < 16; ++j) {
+        shift_up[k][j] = j >= k ? j - k : 0x80;
+        reverse[k][j] = j < k ? k - 1 - j : 0x80;
+      }
+  }
+
+  // Packs the bytes selected by an 8-bit mask to the front of 8 bytes.
+  alignas(16) uint8_t compress[256][8];
+  // Moves bytes up by k positions.
+  alignas(16) uint8_t shift_up[17][16];
+  // Reverses the first k bytes.
+  alignas(16) uint8_t reverse[17][16];
+};
+
+const ShuffleTables& Tables() {
+  static const ShuffleTables tables;
+  return tables;
+}
+
+// Tiles i that merge with tile i + 1, given the bits e of equal neighbours.
+// Within each run of equal tiles the pairs start at the run's first tile and
+// then at every second tile.
+inline int MergeStarts(int equal) {
+  int starts = equal & ~(equal << 1);
+  int even_runs = equal & ~(equal + (starts & 0x5555));
+  int odd_runs = equal & ~even_runs;
+  return (even_runs & 0x5555) | (odd_runs & 0xaaaa);
+}
+
+inline int MergedScore(const uint8_t* tiles, int merge) {
+  int score = 0;
+  for (; merge; merge &= merge - 1)
+    score += 1 << tiles[__builtin_ctz(merge)];
+  return score;
+}
+
+#endif
+
+#ifdef SLIDE_KERNEL_X86
+
+#define SSE_TARGET __attribute__((target("sse4.1")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+SSE_TARGET inline __m128i Unpack(uint64_t bits) {
+  __m128i x = _mm_cvtsi64_si128(bits);
+  __m128i nibble = _mm_set1_epi8(0x0f);
+  return _mm_unpacklo_epi8(_mm_and_si128(x, nibble),
+                           _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+}
+
+SSE_TARGET inline uint64_t Pack(__m128i tiles) {
+  __m128i pairs = _mm_maddubs_epi16(tiles, _mm_set1_epi16(0x1001));
+  return _mm_cvtsi128_si64(_mm_packus_epi16(pairs, pairs));
+}
+
+SSE_TARGET inline __m128i Load(const uint8_t* bytes) {
+  return _mm_load_si128(reinterpret_cast<const __m128i*>(bytes));
+}
+
+SSE_TARGET inline __m128i LoadHalf(const uint8_t* bytes) {
+  return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(bytes));
+}
+
+// Shuffle that packs the nonzero bytes to the front (in two 8-byte halves).
+SSE_TARGET inline __m128i CompressControl(int nonzero,
+                                          const ShuffleTables& tables) {
+  return _mm_unpacklo_epi64(
+      LoadHalf(tables.compress[nonzero & 0xff]),
+      _mm_add_epi8(LoadHalf(tables.compress[nonzero >> 8 & 0xff]),
+                   _mm_set1_epi8(8)));
+}
+
+// Moves all nonzero bytes to the front, keeping their order.
+SSE_TARGET inline __m128i Compress(__m128i tiles,
+                                   const ShuffleTables& tables) {
+  int nonzero = ~_mm_movemask_epi8(
+      _mm_cmpeq_epi8(tiles, _mm_setzero_si128())) & 0xffff;
+  __m128i halves = _mm_shuffle_epi8(tiles,
+                                    CompressControl(nonzero, tables));
+  __m128i upper = _mm_shuffle_epi8(
+      _mm_srli_si128(halves, 8),
+      Load(tables.shift_up[__builtin_popcount(nonzero & 0xff)]));
+  return _mm_or_si128(_mm_move_epi64(halves), upper);
+}
+
+// 0xff in byte i for each bit i of mask.
+SSE_TARGET inline __m128i Expand(int mask) {
+  __m128i bytes = _mm_shuffle_epi8(
+      _mm_cvtsi32_si128(mask),
+      _mm_set_epi8(1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0));
+  __m128i bits = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1,
+                              -128, 64, 32, 16, 8, 4, 2, 1);
+  return _mm_cmpeq_epi8(_mm_and_si128(bytes, bits), bits);
+}
+
+// Bits of tiles equal to their right neighbour and still able to merge.
+SSE_TARGET inline int EqualPairs(__m128i tiles) {
+  __m128i mergeable = _mm_andnot_si128(
+      _mm_cmpeq_epi8(tiles, _mm_setzero_si128()),
+      _mm_cmplt_epi8(tiles, _mm_set1_epi8(GameBoard::kMaxExponent)));
+  __m128i equal = _mm_cmpeq_epi8(tiles, _mm_srli_si128(tiles, 1));
+  return _mm_movemask_epi8(_mm_and_si128(equal, mergeable));
+}
+
+class SseSlideKernel: public Register<SseSlideKernel, SlideKernel> {
+ public:
+  bool supported() override {
+    return __builtin_cpu_supports("sse4.1");
+  }
+
+  SSE_TARGET int slide_rows(uint64_t* rows, int count, int length,
+                            bool reverse) override {
+    const ShuffleTables& tables = Tables();
+    __m128i flip = Load(tables.reverse[length]);
+    int score = 0;
+    for (int row = 0; row < count; ++row)
+      rows[row] = SlideRow(rows[row], reverse, flip, tables, &score);
+    return score;
+  }
+
+  SSE_TARGET static uint64_t SlideRow(uint64_t bits, bool reverse,
+                                      __m128i flip,
+                                      const ShuffleTables& tables,
+                                      int* score) {
+    __m128i line = Unpack(bits);
+    if (reverse)
+      line = _mm_shuffle_epi8(line, flip);
+    line = Compress(line, tables);
+    int merge = MergeStarts(EqualPairs(line));
+    if (merge) {
+      alignas(16) uint8_t tiles[16];
+      line = _mm_sub_epi8(line, Expand(merge));
+      _mm_store_si128(reinterpret_cast<__m128i*>(tiles), line);
+      *score += MergedScore(tiles, merge);
+      line = _mm_blendv_epi8(line, _mm_setzero_si128(), Expand(merge << 1));
+      line = Compress(line, tables);
+    }
+    if (reverse)
+      line = _mm_shuffle_epi8(line, flip);
+    return Pack(line);
+  }
+};
+
+// Same steps as SseSlideKernel, on two rows at once: one per 128-bit lane.
+class Avx2SlideKernel: public Register<Avx2SlideKernel, SlideKernel> {
+ public:
+  bool supported() override {
+    return __builtin_cpu_supports("avx2");
+  }
+
+  AVX2_TARGET int slide_rows(uint64_t* rows, int count, int length,
+                             bool reverse) override {
+    const ShuffleTables& tables = Tables();
+    __m128i flip = Load(tables.reverse[length]);
+    __m256i flips = _mm256_broadcastsi128_si256(flip);
+    int score = 0;
+    int row = 0;
+    for (; row + 1 < count; row += 2) {
+      __m256i lines = Unpack(rows[row], rows[row + 1]);
+      if (reverse)
+        lines = _mm256_shuffle_epi8(lines, flips);
+      lines = Compress(lines, tables);
+      unsigned equal = _mm256_movemask_epi8(EqualPairs(lines));
+      int merge0 = MergeStarts(equal & 0xffff);
+      int merge1 = MergeStarts(equal >> 16);
+      if (merge0 | merge1) {
+        alignas(32) uint8_t tiles[32];
+        lines = _mm256_sub_epi8(lines, Expand(merge0, merge1));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(tiles), lines);
+        score += MergedScore(tiles, merge0) + MergedScore(tiles + 16, merge1);
+        lines = _mm256_blendv_epi8(lines, _mm256_setzero_si256(),
+                                   Expand(merge0 << 1, merge1 << 1));
+        lines = Compress(lines, tables);
+      }
+      if (reverse)
+        lines = _mm256_shuffle_epi8(lines, flips);
+      __m256i pairs = _mm256_maddubs_epi16(lines, _mm256_set1_epi16(0x1001));
+      __m256i packed = _mm256_packus_epi16(pairs, pairs);
+      rows[row] = _mm256_extract_epi64(packed, 0);
+      rows[row + 1] = _mm256_extract_epi64(packed, 2);
+    }
+    if (row < count)
+      rows[row] = SseSlideKernel::SlideRow(rows[row], reverse, flip, tables,
+                                           &score);
+    return score;
+  }
+
+ private:
+  AVX2_TARGET static __m256i Unpack(uint64_t first, uint64_t second) {
+    __m256i x = _mm256_set_epi64x(0, second, 0, first);
+    __m256i nibble = _mm256_set1_epi8(0x0f);
+    return _mm256_unpacklo_epi8(
+        _mm256_and_si256(x, nibble),
+        _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+  }
+
+  AVX2_TARGET static __m256i Compress(__m256i tiles,
+                                      const ShuffleTables& tables) {
+    unsigned nonzero = ~_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(tiles, _mm256_setzero_si256()));
+    int low = nonzero & 0xffff;
+    int high = nonzero >> 16;
+    __m256i halves = _mm256_shuffle_epi8(
+        tiles, _mm256_set_m128i(CompressControl(high, tables),
+                                CompressControl(low, tables)));
+    __m256i upper = _mm256_shuffle_epi8(
+        _mm256_srli_si256(halves, 8),
+        _mm256_set_m128i(
+            Load(tables.shift_up[__builtin_popcount(high & 0xff)]),
+            Load(tables.shift_up[__builtin_popcount(low & 0xff)])));
+    return _mm256_or_si256(
+        _mm256_blend_epi32(halves, _mm256_setzero_si256(), 0xcc), upper);
+  }
+
+  AVX2_TARGET static __m256i EqualPairs(__m256i tiles) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i mergeable = _mm256_andnot_si256(
+        _mm256_cmpeq_epi8(tiles, zero),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(GameBoard::kMaxExponent), tiles));
+    __m256i equal = _mm256_cmpeq_epi8(tiles, _mm256_srli_si256(tiles, 1));
+    return _mm256_and_si256(equal, mergeable);
+  }
+
+  AVX2_TARGET static __m256i Expand(int first, int second) {
+    return _mm256_set_m128i(::Expand(second), ::Expand(first));
+  }
+};
+
+#endif  // SLIDE_KERNEL_X86
+
+#ifdef SLIDE_KERNEL_NEON
+
+inline uint8x16_t Unpack(uint64_t bits) {
+  uint8x8_t x = vcreate_u8(bits);
+  uint8x8_t low = vand_u8(x, vdup_n_u8(0x0f));
+  uint8x8_t high = vshr_n_u8(x, 4);
+  return vcombine_u8(vzip1_u8(low, high), vzip2_u8(low, high));
+}
+
+inline uint64_t Pack(uint8x16_t tiles) {
+  uint8x16_t pairs = vorrq_u8(vuzp1q_u8(tiles, tiles),
+                              vshlq_n_u8(vuzp2q_u8(tiles, tiles), 4));
+  return vgetq_lane_u64(vreinterpretq_u64_u8(pairs), 0);
+}
+
+// Bit i set for each byte i that is 0xff.
+inline int MoveMask(uint8x16_t bytes) {
+  static const uint8_t kBits[16] = {
+    1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+  };
+  uint8x16_t bits = vandq_u8(bytes, vld1q_u8(kBits));
+  return vaddv_u8(vget_low_u8(bits)) | vaddv_u8(vget_high_u8(bits)) << 8;
+}
+
+inline uint8x16_t Expand(int mask) {
+  static const uint8_t kBits[16] = {
+    1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+  };
+  uint8x16_t bytes = vcombine_u8(vdup_n_u8(mask & 0xff),
+                                 vdup_n_u8(mask >> 8 & 0xff));
+  return vtstq_u8(bytes, vld1q_u8(kBits));
+}
+
+inline uint8x16_t Compress(uint8x16_t tiles, const ShuffleTables& tables) {
+  int nonzero = MoveMask(vtstq_u8(tiles, tiles));
+  uint8x16_t control = vcombine_u8(
+      vld1_u8(tables.compress[nonzero & 0xff]),
+      vadd_u8(vld1_u8(tables.compress[nonzero >> 8]), vdup_n_u8(8)));
+  uint8x16_t halves = vqtbl1q_u8(tiles, control);
+  uint8x16_t upper = vqtbl1q_u8(
+      vextq_u8(halves, vdupq_n_u8(0), 8),
+      vld1q_u8(tables.shift_up[__builtin_popcount(nonzero & 0xff)]));
+  return vorrq_u8(vcombine_u8(vget_low_u8(halves), vdup_n_u8(0)), upper);
+}
+
+inline int EqualPairs(uint8x16_t tiles) {
+  uint8x16_t mergeable = vandq_u8(
+      vtstq_u8(tiles, tiles),
+      vcltq_u8(tiles, vdupq_n_u8(GameBoard::kMaxExponent)));
+  uint8x16_t equal = vceqq_u8(tiles, vextq_u8(tiles, vdupq_n_u8(0), 1));
+  return MoveMask(vandq_u8(equal, mergeable));
+}
+
+class NeonSlideKernel: public Register<NeonSlideKernel, SlideKernel> {
+ public:
+  int slide_rows(uint64_t* rows, int count, int length,
+                 bool reverse) override {
+    const ShuffleTables& tables = Tables();
+    uint8x16_t flip = vld1q_u8(tables.reverse[length]);
+    int score = 0;
+    for (int row = 0; row < count; ++row) {
+      uint8x16_t line = Unpack(rows[row]);
+      if (reverse)
+        line = vqtbl1q_u8(line, flip);
+      line = Compress(line, tables);
+      int merge = MergeStarts(EqualPairs(line));
+      if (merge) {
+        uint8_t tiles[16];
+        line = vsubq_u8(line, Expand(merge));
+        vst1q_u8(tiles, line);
+        score += MergedScore(tiles, merge);
+        line = vbslq_u8(Expand(merge << 1), vdupq_n_u8(0), line);
+        line = Compress(line, tables);
+      }
+      if (reverse)
+        line = vqtbl1q_u8(line, flip);
+      rows[row] = Pack(line);
+    }
+    return score;
+  }
+};
+
+#endif  // SLIDE_KERNEL_NEON
+
+bool RegisterSlideKernels() {
+  bool registered = ScalarSlideKernel::SetName("scalar");
+#ifdef SLIDE_KERNEL_X86
+  registered &= SseSlideKernel::SetName("sse4.1");
+  registered &= Avx2SlideKernel::SetName("avx2");
+#endif
+#ifdef SLIDE_KERNEL_NEON
+  registered &= NeonSlideKernel::SetName("neon");
+#endif
+  return registered;
+}
+
+SlideKernel* PickSlideKernel() {
+  RegisterSlideKernels();
+  for (const char* name: {"avx2", "sse4.1", "neon"}) {
+    SlideKernel::uptr kernel(SlideKernel::Create(name));
+    if (kernel && kernel->supported())
+      return kernel.release();
+  }
+  return SlideKernel::Create("scalar");
+}
+
+}  // namespace
+
+SlideKernel* SlideKernel::Best() {
+  static const SlideKernel::uptr best(PickSlideKernel());
+  return best.get();
+}
@@ -0,0 +1,52 @@
+// File: slide_kernel.h
+//
+// Brief: Kernels that slide and merge the rows of a wide (larger than 4x4)
+//        GameBoard. The base class is the scalar reference. The SIMD children
+//        handle a whole row of up to 16 tiles per register. They drop empty
+//        cells with byte shuffles, then merge equal neighbours with a compare
+//        and a blend.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: SlideKernel::Best() returns the fastest kernel this CPU supports,
+//        checked once with CPUID. GameBoard::slide() uses it, so every
+//        MoveMethod that slides through GameBoard gets it. Registered names
+//        are "scalar", "sse4.1", "avx2" and "neon", so a specific kernel can
+//        be created by name, e.g. to compare it against the reference:
+//
+//            SlideKernel::uptr kernel(SlideKernel::Create("sse4.1"));
+//            if (kernel && kernel->supported())
+//              score = kernel->slide_rows(rows, count, length, false);
+//
+
+#ifndef SLIDE_KERNEL_H_
+#define SLIDE_KERNEL_H_
+
+#include <cstdint>
+
+#include "register.h"
+
+class SlideKernel: public RegisterBase<SlideKernel> {
+ public:
+  virtual const char* info() override {
+    return "Kernels to slide the rows of large boards.";
+  }
+
+  // Returns true if this CPU can run the kernel.
+  virtual bool supported() {
+    return true;
+  }
+
+  // Slides count rows in place. Each row keeps length tiles as 4-bit
+  // exponents, column i at bits [4 * i, 4 * i + 4). The tiles move toward
+  // column 0, or toward column length - 1 if reverse. Returns the total value
+  // of merged tiles.
+  virtual int slide_rows(uint64_t* rows, int count, int length, bool reverse);
+
+  // The fastest supported kernel. Never nullptr.
+  static SlideKernel* Best();
+};
+
+#endif  // SLIDE_KERNEL_H_
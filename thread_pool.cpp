@@ -0,0 +1,118 @@
+// File: thread_pool.cpp
+//
+// Brief: The work-stealing thread pool.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace {
+
+// The pool and index of the worker running on this thread, if any.
+thread_local const void* current_pool = nullptr;
+thread_local int current_worker = -1;
+
+}  // namespace
+
+ThreadPool::ThreadPool(int threads)
+    : queued_(0), pending_(0), next_(0), stop_(false) {
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 0; i < threads; ++i)
+    workers_.emplace_back(new Worker);
+  for (int i = 0; i < threads; ++i)
+    threads_.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto& thread: threads_)
+    thread.join();
+}
+
+void ThreadPool::submit(Task task) {
+  int index = current_pool == this ? current_worker :
+              int(next_++ % workers_.size());
+  ++pending_;
+  {
+    std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+    workers_[index]->tasks.push_front(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++queued_;
+  }
+  wake_.notify_one();
+  done_.notify_all();
+}
+
+void ThreadPool::wait() {
+  while (pending_ > 0) {
+    if (run_one())
+      continue;
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0 || queued_ > 0; });
+  }
+}
+
+bool ThreadPool::run_one() {
+  Task task;
+  int index = current_pool == this ? current_worker : 0;
+  if (!take(index, &task))
+    return false;
+  finish(&task);
+  return true;
+}
+
+bool ThreadPool::take(int index, Task* task) {
+  int count = int(workers_.size());
+  for (int i = 0; i < count; ++i) {
+    Worker& worker = *workers_[(index + i) % count];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty())
+      continue;
+    if (i == 0) {
+      *task = std::move(worker.tasks.front());
+      worker.tasks.pop_front();
+    } else {
+      *task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+    }
+    --queued_;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::run(int index) {
+  current_pool = this;
+  current_worker = index;
+  for (;;) {
+    Task task;
+    if (take(index, &task)) {
+      finish(&task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+    if (stop_ && queued_ == 0)
+      return;
+  }
+}
+
+void ThreadPool::finish(Task* task) {
+  (*task)();
+  if (--pending_ == 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_.notify_all();
+  }
+}
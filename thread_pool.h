@@ -0,0 +1,77 @@
+// File: thread_pool.h
+//
+// Brief: A work-stealing thread pool. Every worker owns a deque of tasks.
+//        It takes tasks from the front of its own deque, and steals from the
+//        back of the others when it runs dry.
+//
+// Author: Pufan He <hpfdf@126.com>
+//
+// Version: 2026/10/14
+//
+// Usage: ThreadPool pool(8);
+//        for (int i = 0; i < 100; ++i)
+//          pool.submit([i] { Work(i); });
+//        pool.wait();
+//
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+ public:
+  typedef std::function<void()> Task;
+
+  // Starts threads workers, or one per hardware thread if threads <= 0.
+  explicit ThreadPool(int threads = 0);
+
+  // Finishes the queued tasks, then joins the workers.
+  ~ThreadPool();
+
+  int size() const {
+    return int(threads_.size());
+  }
+
+  // Queues task. Tasks submitted by a worker go to its own deque, others are
+  // spread over all workers.
+  void submit(Task task);
+
+  // Blocks until all submitted tasks are done, running tasks meanwhile.
+  void wait();
+
+  // Runs one queued task on the calling thread. Returns false if none.
+  bool run_one();
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Takes a task, from the front of worker index or the back of the others.
+  bool take(int index, Task* task);
+
+  void run(int index);
+
+  void finish(Task* task);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  std::atomic<int> queued_;
+  std::atomic<int> pending_;
+  std::atomic<unsigned> next_;
+  bool stop_;
+};
+
+#endif  // THREAD_POOL_H_